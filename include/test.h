@@ -6,14 +6,26 @@
 #include "wdst.h"
 #include "wprint.h"
 
+// Returns 0 to run the tests, 1 after printing the help or the test list and -1 for an invalid command line
 int t_init(int argc, char **argv);
 int t_finish(void);
 
 typedef int (*test_fn)(void);
 int t_run(test_fn fn, int print);
 int t_run_named(test_fn fn, const char *name, int print);
+
+typedef struct ttest_s {
+	const char *name;
+	test_fn fn;
+} ttest_t;
+
+// Tests declared with TEST, STEST and BENCH sorted by name, enumerating them runs no test code
+size_t t_test_count(void);
+const ttest_t *t_test_get(size_t index);
+const ttest_t *t_test_find(const char *name);
 int t_enter(const char *name);
 void t_leave(int state);
+int t_result(int state);
 
 typedef int (*setup_fn)(void *priv);
 typedef int (*teardown_fn)(void *priv);
@@ -27,9 +39,71 @@ wdst_t t_set_wdst(wdst_t dst);
 
 void *t_get_priv(void);
 
-void t_start(void);
+int t_start(void);
 int t_end(int passed, const char *file, const char *func, int line);
 
+// Fail the running test if it does not end within ms milliseconds from now, 0 cancels the timeout
+void t_timeout(unsigned ms);
+
+size_t t_bench_begin(void);
+size_t t_bench_next(void);
+
+typedef void (*prop_fn)(int passed);
+int t_prop(prop_fn fn, const char *func);
+
+// Generators draw from the choices of the running property case, smaller choices give simpler values
+unsigned long long t_gen_choice(unsigned long long max);
+unsigned long long t_gen_uint(unsigned long long min, unsigned long long max);
+long long t_gen_int(long long min, long long max);
+// Printable characters unless chars is given, the string is kept until the next case
+const char *t_gen_str(size_t max, const char *chars);
+
+typedef struct tgen_buf_s {
+	unsigned char *data;
+	size_t len;
+} tgen_buf_t;
+
+tgen_buf_t t_gen_buf(size_t max);
+
+void t_prop_show(const char *fmt, ...);
+void t_prop_show_buf(const char *name, tgen_buf_t buf);
+
+typedef void (*fuzz_fn)(int passed, const unsigned char *data, size_t size);
+// Replays the corpus of the target, with --fuzz mutates it guided by the coverage of code built with -fsanitize-coverage
+// when the framework is built with T_FUZZ_COV, without it the mutations are not guided
+int t_fuzz(fuzz_fn fn, const char *func);
+
+// Writes the output for the len bytes at in to out, at most out_max bytes, and returns its length
+typedef size_t (*diff_fn)(const unsigned char *in, size_t len, unsigned char *out, size_t out_max);
+// Runs both functions on the corpus of the test and on generated inputs of at most in_max bytes and compares their outputs
+int t_diff(diff_fn ref, diff_fn opt, size_t in_max, size_t out_max, const char *ref_str, const char *opt_str, const char *func);
+
+typedef void (*table_fn)(int passed, const void *row);
+// Runs fn on each of the cnt rows of size bytes at rows that the filters select, row i is selected by the name NAME_i
+int t_table(table_fn fn, const void *rows, size_t cnt, size_t size, const char *func);
+
+typedef struct talloc_mark_s {
+	unsigned long long allocs;
+	long long live;
+} talloc_mark_t;
+
+// Allocations are only counted in a glibc build with T_ALLOC_HOOK and no sanitizer, otherwise the budgets fail
+int t_alloc_counted(void);
+talloc_mark_t t_alloc_mark(void);
+unsigned long long t_alloc_allocs(const talloc_mark_t *mark);
+unsigned long long t_alloc_peak(const talloc_mark_t *mark);
+
+// Keep the compiler from optimizing away the computation of the value at ptr
+static inline void t_do_not_optimize(const void *ptr)
+{
+#if defined(__GNUC__)
+	__asm__ volatile("" : : "g"(ptr) : "memory");
+#else
+	const void *volatile sink = ptr;
+	(void)sink;
+#endif
+}
+
 void t_cstart(void);
 int t_cend(int passed, const char *func);
 
@@ -43,6 +117,9 @@ int t_strncmp(const char *act, const char *exp, size_t len);
 int t_wstrcmp(const wchar_t *act, const wchar_t *exp);
 int t_wstrncmp(const wchar_t *act, const wchar_t *exp, size_t len);
 
+int t_memcmp(const void *act, const void *exp, size_t size);
+int t_farrcmp(const void *act, const void *exp, size_t cnt, size_t esize, double eps, unsigned long long ulp);
+
 void t_expect_ch(int passed, const char *file, const char *func, int line, const char *check);
 
 void t_expect_g(int passed, const char *file, const char *func, int line, const char *act, size_t act_size, const char *exp,
@@ -59,24 +136,62 @@ void t_expect_fmt(int passed, const char *file, const char *func, int line, cons
 void t_expect_wstr(int passed, const char *file, const char *func, int line, const wchar_t *act, const wchar_t *exp);
 void t_expect_wstrn(int passed, const char *file, const char *func, int line, const wchar_t *act, const wchar_t *exp, size_t len);
 
+void t_expect_mem(int passed, const char *file, const char *func, int line, const char *act_str, const char *exp_str, const void *act,
+		  const void *exp, size_t cnt, size_t esize);
+void t_expect_farr(int passed, const char *file, const char *func, int line, const char *act_str, const char *exp_str, const void *act,
+		   const void *exp, size_t cnt, size_t esize, double eps, unsigned long long ulp);
+
+void t_expect_alloc(int passed, const char *file, const char *func, int line, const char *what, const char *mark, unsigned long long act,
+		    unsigned long long max);
+
 void t_expect_fail(int passed, const char *fmt, ...);
 
 int t_fprintf(void *priv, const char *fmt, ...);
 void t_expect_fstr_start(const char *exp, size_t len);
+void t_expect_fstr_stream_start(const char *exp, size_t len);
 int t_expect_fstr_end(int passed, const char *file, const char *func, int line);
 
+// Registers a test in the t_tests section without running it
+#if defined(_MSC_VER)
+	#pragma section("t_tests$b", read, write)
+	#define T_REG_SECTION __declspec(allocate("t_tests$b"))
+	#define T_REG_USED
+#elif defined(__APPLE__)
+	#define T_REG_SECTION __attribute__((section("__DATA,t_tests")))
+	#define T_REG_USED    __attribute__((used))
+#elif defined(__GNUC__) && defined(__ELF__)
+	#define T_REG_SECTION __attribute__((section("t_tests")))
+	#define T_REG_USED    __attribute__((used))
+#endif
+
+#if defined(T_REG_SECTION)
+	#define T_REG(_name, _fn)                                                                                                          \
+		static const ttest_t t_reg_##_fn = {#_name, _fn};                                                                          \
+		T_REG_SECTION T_REG_USED static const ttest_t *t_reg_ptr_##_fn = &t_reg_##_fn;
+#else
+	#define T_REG(_name, _fn)
+#endif
+
 // Declare subtest
-#define STEST(_name)	   int test_##_name(void)
+#define STEST(_name)                                                                                                                       \
+	int test_##_name(void);                                                                                                            \
+	T_REG(_name, test_##_name)                                                                                                         \
+	int test_##_name(void)
 #define STESTP(_name, ...) int test_##_name(__VA_ARGS__)
 
 // Declare test
-#define TEST(_name)	  static inline int test_##_name(void)
+#define TEST(_name)                                                                                                                        \
+	static inline int test_##_name(void);                                                                                              \
+	T_REG(_name, test_##_name)                                                                                                         \
+	static inline int test_##_name(void)
 #define TESTP(_name, ...) static inline int test_##_name(__VA_ARGS__)
 
-// Test start
+// Test start, a test of another shard returns here
 #define START                                                                                                                              \
 	int _passed = 1;                                                                                                                   \
-	t_start()
+	if (t_start()) {                                                                                                                   \
+		return -1;                                                                                                                 \
+	}
 
 // Test result
 #define RES t_end(_passed, __FILE__, __func__, __LINE__)
@@ -102,7 +217,7 @@ int t_expect_fstr_end(int passed, const char *file, const char *func, int line);
 #define T_RUN(_fn, _call)                                                                                                                  \
 	do {                                                                                                                               \
 		int _t_state = t_enter(#_fn);                                                                                              \
-		int _t_ret   = _t_state >= 0 ? (_call) : -1;                                                                               \
+		int _t_ret   = _t_state >= 0 ? (_call) : t_result(_t_state);                                                               \
 		t_leave(_t_state);                                                                                                         \
 		if (_t_ret > 0) {                                                                                                          \
 			_sfailed++;                                                                                                        \
@@ -115,6 +230,114 @@ int t_expect_fstr_end(int passed, const char *file, const char *func, int line);
 
 #define RUNP(_fn, ...) T_RUN(_fn, test_##_fn(__VA_ARGS__))
 
+// Declare benchmark
+#define BENCH(_name)                                                                                                                       \
+	static inline int bench_##_name(void);                                                                                             \
+	T_REG(_name, bench_##_name)                                                                                                        \
+	static inline int bench_##_name(void)
+
+// Benchmark loop, runs the body in calibrated and timed batches
+#define BLOOP                                                                                                                              \
+	for (size_t _t_iters = t_bench_begin(); _t_iters > 0; _t_iters = t_bench_next())                                                   \
+		for (size_t _t_iter = 0; _t_iter < _t_iters; _t_iter++)
+
+// Run benchmark
+#define RUN_BENCH(_fn) T_RUN(_fn, bench_##_fn())
+
+#define T_CAT(_a, _b)  T_CAT_(_a, _b)
+#define T_CAT_(_a, _b) _a##_b
+
+#define T_ARGC(...)					 T_ARGC_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define T_ARGC_(_1, _2, _3, _4, _5, _6, _7, _8, _n, ...) _n
+
+#define T_COMMA() ,
+#define T_NONE()
+
+// Applies _m to each parenthesized argument, up to 8
+#define T_EACH(_m, _sep, ...)	    T_CAT(T_EACH_, T_ARGC(__VA_ARGS__))(_m, _sep, __VA_ARGS__)
+#define T_EACH_1(_m, _sep, _x)	    _m _x
+#define T_EACH_2(_m, _sep, _x, ...) _m _x _sep() T_EACH_1(_m, _sep, __VA_ARGS__)
+#define T_EACH_3(_m, _sep, _x, ...) _m _x _sep() T_EACH_2(_m, _sep, __VA_ARGS__)
+#define T_EACH_4(_m, _sep, _x, ...) _m _x _sep() T_EACH_3(_m, _sep, __VA_ARGS__)
+#define T_EACH_5(_m, _sep, _x, ...) _m _x _sep() T_EACH_4(_m, _sep, __VA_ARGS__)
+#define T_EACH_6(_m, _sep, _x, ...) _m _x _sep() T_EACH_5(_m, _sep, __VA_ARGS__)
+#define T_EACH_7(_m, _sep, _x, ...) _m _x _sep() T_EACH_6(_m, _sep, __VA_ARGS__)
+#define T_EACH_8(_m, _sep, _x, ...) _m _x _sep() T_EACH_7(_m, _sep, __VA_ARGS__)
+
+// Property generators: (type, variable, value, how the value of a failing case is printed)
+#define T_GEN(_type, _var, _gen)   (_type, _var, _gen, (void)0)
+#define T_INT(_var, _min, _max)	   (int, _var, (int)t_gen_int(_min, _max), t_prop_show("%s = %d", #_var, _var))
+#define T_UINT(_var, _min, _max)   (unsigned, _var, (unsigned)t_gen_uint(_min, _max), t_prop_show("%s = %u", #_var, _var))
+#define T_LLONG(_var, _min, _max)  (long long, _var, t_gen_int(_min, _max), t_prop_show("%s = %lld", #_var, _var))
+#define T_STR(_var, _max)	   (const char *, _var, t_gen_str(_max, NULL), t_prop_show("%s = \"%s\"", #_var, _var))
+#define T_STRC(_var, _max, _chars) (const char *, _var, t_gen_str(_max, _chars), t_prop_show("%s = \"%s\"", #_var, _var))
+#define T_BUF(_var, _max)	   (tgen_buf_t, _var, t_gen_buf(_max), t_prop_show_buf(#_var, _var))
+
+#define T_PROP_PARAM(_type, _var, _gen, _show) _type _var
+#define T_PROP_DRAW(_type, _var, _gen, _show)  _type _var = _gen;
+#define T_PROP_SHOW(_type, _var, _gen, _show)  _show;
+#define T_PROP_ARG(_type, _var, _gen, _show)   _var
+
+// Declare property, a test that runs its body with the values of the generators for each case and shrinks the first failing one
+#define PROPERTY(_name, ...)                                                                                                               \
+	static inline void prop_##_name(int _passed, T_EACH(T_PROP_PARAM, T_COMMA, __VA_ARGS__));                                         \
+	static void prop_case_##_name(int _passed)                                                                                         \
+	{                                                                                                                                  \
+		T_EACH(T_PROP_DRAW, T_NONE, __VA_ARGS__)                                                                                   \
+		T_EACH(T_PROP_SHOW, T_NONE, __VA_ARGS__)                                                                                   \
+		prop_##_name(_passed, T_EACH(T_PROP_ARG, T_COMMA, __VA_ARGS__));                                                           \
+	}                                                                                                                                  \
+	TEST(_name)                                                                                                                        \
+	{                                                                                                                                  \
+		START;                                                                                                                     \
+		if (t_prop(prop_case_##_name, __func__)) {                                                                                 \
+			_passed = 0;                                                                                                       \
+		}                                                                                                                          \
+		END;                                                                                                                       \
+	}                                                                                                                                  \
+	static inline void prop_##_name(int _passed, T_EACH(T_PROP_PARAM, T_COMMA, __VA_ARGS__))
+
+// Declare fuzz target, a test that runs its body on the size bytes at data for each input of its corpus
+#define FUZZ(_name)                                                                                                                        \
+	static inline void fuzz_##_name(int _passed, const unsigned char *data, size_t size);                                              \
+	TEST(_name)                                                                                                                        \
+	{                                                                                                                                  \
+		START;                                                                                                                     \
+		if (t_fuzz(fuzz_##_name, __func__)) {                                                                                      \
+			_passed = 0;                                                                                                       \
+		}                                                                                                                          \
+		END;                                                                                                                       \
+	}                                                                                                                                  \
+	static inline void fuzz_##_name(int _passed, const unsigned char *data, size_t size)
+
+// Declare differential test, a test that fails on the first input _ref and _opt disagree on and shows how fast each of them is
+#define DIFF(_name, _ref, _opt, _in_max, _out_max)                                                                                         \
+	TEST(_name)                                                                                                                        \
+	{                                                                                                                                  \
+		START;                                                                                                                     \
+		if (t_diff(_ref, _opt, _in_max, _out_max, #_ref, #_opt, __func__)) {                                                       \
+			_passed = 0;                                                                                                       \
+		}                                                                                                                          \
+		END;                                                                                                                       \
+	}
+
+// Declare table test, a test that runs its body on each row of the array _rows, passing rows are counted on one line
+#define TEST_TABLE(_name, _type, _rows)                                                                                                    \
+	static inline void table_##_name(int _passed, const _type *row);                                                                   \
+	static void table_row_##_name(int _passed, const void *row)                                                                        \
+	{                                                                                                                                  \
+		table_##_name(_passed, (const _type *)row);                                                                                \
+	}                                                                                                                                  \
+	TEST(_name)                                                                                                                        \
+	{                                                                                                                                  \
+		START;                                                                                                                     \
+		if (t_table(table_row_##_name, _rows, sizeof(_rows) / sizeof(*(_rows)), sizeof(*(_rows)), __func__)) {                    \
+			_passed = 0;                                                                                                       \
+		}                                                                                                                          \
+		END;                                                                                                                       \
+	}                                                                                                                                  \
+	static inline void table_##_name(int _passed, const _type *row)
+
 // Subtests end
 #define SEND return t_send(_spassed, _sfailed)
 
@@ -241,6 +464,46 @@ int t_expect_fstr_end(int passed, const char *file, const char *func, int line);
 		_passed = 0;                                                                                                               \
 	}
 
+#define EXPECT_MEM(_actual, _expected, _size)                                                                                              \
+	if (t_memcmp(_actual, _expected, _size)) {                                                                                         \
+		t_expect_mem(_passed, __FILE__, __func__, __LINE__, #_actual, #_expected, _actual, _expected, _size, 1);                   \
+		_passed = 0;                                                                                                               \
+	}
+
+#define EXPECT_ARRAY_EQ(_actual, _expected, _cnt)                                                                                          \
+	if (t_memcmp(_actual, _expected, (_cnt) * sizeof(*(_actual)))) {                                                                   \
+		t_expect_mem(_passed, __FILE__, __func__, __LINE__, #_actual, #_expected, _actual, _expected, _cnt, sizeof(*(_actual)));   \
+		_passed = 0;                                                                                                               \
+	}
+
+// Does not compile unless the elements are floating, an integer element type would truncate 0.5 to 0
+#define T_FLOAT_ELEMS(_arr) (void)sizeof(char[__extension__((__typeof__((_arr)[0]))0.5 > 0) ? 1 : -1])
+
+// Float or double elements are equal if they differ by at most _eps or by at most _ulp units in the last place
+#define EXPECT_ARRAY_NEAR(_actual, _expected, _cnt, _eps, _ulp)                                                                            \
+	if (T_FLOAT_ELEMS(_actual), T_FLOAT_ELEMS(_expected), t_farrcmp(_actual, _expected, _cnt, sizeof(*(_actual)), _eps, _ulp)) {       \
+		t_expect_farr(_passed, __FILE__, __func__, __LINE__, #_actual, #_expected, _actual, _expected, _cnt, sizeof(*(_actual)),   \
+			      _eps, _ulp);                                                                                                 \
+		_passed = 0;                                                                                                               \
+	}
+
+// Starts measuring allocations, peak memory is measured from the latest mark
+#define ALLOC_MARK(_mark) talloc_mark_t _mark = t_alloc_mark()
+
+#define T_EXPECT_ALLOC(_mark, _max, _what, _fn)                                                                                            \
+	do {                                                                                                                               \
+		unsigned long long _t_act = _fn(&(_mark));                                                                                 \
+		unsigned long long _t_max = (_max);                                                                                        \
+		if (!t_alloc_counted() || _t_act > _t_max) {                                                                               \
+			t_expect_alloc(_passed, __FILE__, __func__, __LINE__, _what, #_mark, _t_act, _t_max);                              \
+			_passed = 0;                                                                                                       \
+		}                                                                                                                          \
+	} while (0)
+
+#define EXPECT_ALLOCS_LE(_mark, _max)	T_EXPECT_ALLOC(_mark, _max, "allocations", t_alloc_allocs)
+#define EXPECT_PEAK_MEM_LE(_mark, _max) T_EXPECT_ALLOC(_mark, _max, "peak bytes", t_alloc_peak)
+#define EXPECT_NO_ALLOC(_mark)		EXPECT_ALLOCS_LE(_mark, 0)
+
 #define EXPECT_FAIL(_fmt, ...)                                                                                                             \
 	t_expect_fail(_passed, _fmt, __VA_ARGS__);                                                                                         \
 	_passed = 0;
@@ -252,4 +515,12 @@ int t_expect_fstr_end(int passed, const char *file, const char *func, int line);
 		_passed = 0;                                                                                                               \
 	}
 
+// Compares the output while it is written, t_fprintf returns -1 once it differs
+#define EXPECT_FSTR_STREAM(_print, _expected, _len)                                                                                        \
+	t_expect_fstr_stream_start(_expected, _len);                                                                                       \
+	_print;                                                                                                                            \
+	if (t_expect_fstr_end(_passed, __FILE__, __func__, __LINE__) != 0) {                                                               \
+		_passed = 0;                                                                                                               \
+	}
+
 #endif
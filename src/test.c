@@ -1,22 +1,150 @@
+#if !defined(_GNU_SOURCE)
+	#define _GNU_SOURCE
+#endif
+
 #include "test.h"
 
 #include "mem_stats.h"
 #include "platform.h"
 
 #include <inttypes.h>
+#include <limits.h>
 #include <memory.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <wchar.h>
 
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+#endif
+
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+	#define T_SANITIZE
+#elif defined(__has_feature)
+	#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || __has_feature(memory_sanitizer)
+		#define T_SANITIZE
+	#endif
+#endif
+
+#if defined(__GLIBC__)
+	#define T_BACKTRACE
+	#include <execinfo.h>
+#endif
+
+// Allocations are counted by wrapping the glibc allocator when built with T_ALLOC_HOOK, sanitizers replace it with their own
+#if defined(T_ALLOC_HOOK) && (!defined(__GLIBC__) || defined(T_SANITIZE))
+	#undef T_ALLOC_HOOK
+#endif
+
+#if defined(T_ALLOC_HOOK)
+	#include <errno.h>
+	#include <malloc.h>
+#endif
+
+// The coverage hooks for -fsanitize-coverage are only defined with T_FUZZ_COV, they must not be instrumented themselves
+#if defined(T_FUZZ_COV)
+	#if defined(__clang__)
+		#define T_NO_COV __attribute__((no_sanitize("coverage")))
+	#elif defined(__GNUC__) && __GNUC__ >= 12
+		#define T_NO_COV __attribute__((no_sanitize_coverage))
+	#else
+		#error "T_FUZZ_COV needs clang or gcc 12 to keep the coverage hooks from being instrumented"
+	#endif
+#endif
+
 #if defined(C_WIN)
 	#define vsscanf vsscanf_s
+#else
+	#include <dirent.h>
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <pthread.h>
+	#include <signal.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/wait.h>
+	#include <unistd.h>
 #endif
 
 #define BYTE_TO_BIN_PATTERN "%c%c%c%c%c%c%c%c"
 #define PTR_HEX_WIDTH	    16
 
-#define TEST_PREFIX "test_"
+#define TEST_PREFIX  "test_"
+#define BENCH_PREFIX "bench_"
+
+// Output written while dst.off is T_CAPTURE is collected in s_data.out
+#define T_CAPTURE ((size_t)-1)
+// Output written while dst.off is T_BUFFER is collected in s_data.out and flushed to s_data.sink
+#define T_BUFFER ((size_t)-2)
+
+#define T_FLUSH_SIZE 65536
+
+// Bytes shown per row of a memory diff
+#define T_MEM_ROW 16
+
+// Bytes of diverging output kept by a streaming EXPECT_FSTR
+#define T_STREAM_WINDOW 256
+
+#define T_PATH_MAX  512
+#define T_LEVEL_MAX 32
+
+#define T_SLOWEST 10
+
+// A test that does not respond to its timeout signal is reported by the watchdog after T_WATCH_GRACE ns,
+// the watchdog checks every T_WATCH_POLL ns whether it did
+#define T_WATCH_GRACE  2000000000ULL
+#define T_WATCH_POLL   1000000ULL
+#define T_WATCH_FRAMES 16
+
+// Allocation sizes are counted in power of two classes from 16 B to 64 KiB and one class above
+#define T_ALLOC_CLASSES 14
+
+#define T_LEAK_FRAMES 8
+#define T_LEAK_SITES  10
+
+// Benchmarks take up to T_BENCH_SAMPLES batches of about T_BENCH_TIME / T_BENCH_SAMPLES ns each
+#define T_BENCH_TIME	100000000ULL
+#define T_BENCH_SAMPLES 50
+#define T_BENCH_MIN	5
+
+// One-sided Mann-Whitney z score for a significant slowdown at p < 0.01
+#define T_BENCH_Z     2.326
+#define T_BENCH_MAGIC "CTB1"
+
+#define T_DUR_MAGIC "CTD1"
+// Estimate of a unit without history when no other unit has one either
+#define T_DUR_DEFAULT 1000000ULL
+
+#define T_JOURNAL_MAGIC "CTJ1"
+// Which tests the journal lets run
+#define T_JOURNAL_ALL	 0
+#define T_JOURNAL_FAILED 1
+#define T_JOURNAL_REST	 2
+
+// A property checks T_PROP_CASES cases unless --cases is given, its first failing case is shrunk in at most T_PROP_SHRINKS runs
+#define T_PROP_CASES   100
+#define T_PROP_SHRINKS 10000
+// Choices of a case past T_PROP_DRAWS are not kept, replaying them draws 0
+#define T_PROP_DRAWS 1048576
+
+// Fuzz targets keep their inputs in T_FUZZ_CORPUS/NAME unless --corpus is given
+#define T_FUZZ_CORPUS "corpus"
+// Edge counters of the code under test, a power of two
+#define T_FUZZ_MAP 65536
+// Mutated inputs are at most T_FUZZ_MAX bytes, an input is minimized in at most T_FUZZ_MINIMIZE runs
+#define T_FUZZ_MAX	4096
+#define T_FUZZ_MINIMIZE 1024
+// New coverage an input has to keep while it is minimized
+#define T_FUZZ_NEWS 64
+
+// A differential test runs its corpus and T_DIFF_INPUTS generated inputs, each side runs over T_DIFF_BATCH inputs at a time
+#define T_DIFF_INPUTS 65536
+#define T_DIFF_BATCH  256
+// The first diverging input is minimized in at most T_DIFF_MINIMIZE runs
+#define T_DIFF_MINIMIZE 1024
 
 // clang-format off
 #define BYTE_TO_BIN(byte)  \
@@ -30,6 +158,177 @@
   (byte & 0x01 ? '1' : '0')
 // clang-format on
 
+typedef struct tbuf_s {
+	char *data;
+	size_t len;
+	size_t size;
+} tbuf_t;
+
+// Capture buffer: a list of chunks that grow geometrically and are reused across tests
+typedef struct tchunk_s {
+	struct tchunk_s *next;
+	size_t size;
+	size_t len;
+	char data[];
+} tchunk_t;
+
+typedef struct tarena_s {
+	tchunk_t *head;
+	tchunk_t *tail;
+	size_t len;
+} tarena_t;
+
+typedef struct tstream_s {
+	int on;
+	size_t exp_len;
+	size_t off;
+	size_t diff;
+	size_t win_len;
+	char win[T_STREAM_WINDOW];
+} tstream_t;
+
+typedef struct twork_s {
+	int jobs;
+	int threads;
+	int worker;
+	int level;
+	int unit;
+	int claim;
+} twork_t;
+
+typedef struct tpool_s tpool_t;
+typedef struct tflush_s tflush_t;
+
+typedef struct tnode_s {
+	char ch;
+	int child;
+	int next;
+	int filter;
+} tnode_t;
+
+typedef struct tstamp_s {
+	unsigned long long wall;
+	unsigned long long cpu;
+} tstamp_t;
+
+typedef struct tslow_s tslow_t;
+
+typedef struct tbase_s tbase_t;
+
+typedef struct tdur_s tdur_t;
+
+typedef struct tbench_s {
+	int on;
+	int calibrated;
+	int done;
+	int cnt;
+	size_t iters;
+	unsigned long long start;
+	unsigned long long total;
+	double samples[T_BENCH_SAMPLES];
+	double median;
+	double mean;
+	double stddev;
+	double p99;
+} tbench_t;
+
+typedef struct talloc_s {
+	unsigned long long allocs;
+	unsigned long long frees;
+	long long live;
+	long long peak;
+	unsigned long long sizes[T_ALLOC_CLASSES];
+} talloc_t;
+
+typedef struct tleak_s {
+	void *ptr;
+	size_t size;
+	unsigned gen;
+	int frames_cnt;
+	void *frames[T_LEAK_FRAMES];
+} tleak_t;
+
+// Open addressing table of the blocks allocated by the running test, entries of older tests count as free slots
+typedef struct tleaks_s {
+	int track;
+	unsigned gen;
+	size_t cap;
+	size_t used;
+	size_t live;
+	tleak_t *ents;
+} tleaks_t;
+
+// Tests of other shards end in t_start, suite headers are printed once a test under them runs
+typedef struct tshard_s {
+	int index;
+	int count;
+	int shown;
+	const char *heads[T_LEVEL_MAX];
+} tshard_t;
+
+// Result of each test in the last runs, with first the tests that failed run before the others
+typedef struct tjournal_s {
+	tdur_t *file;
+	int run;
+	int first;
+} tjournal_t;
+
+// Property run: a case draws its values from a xoshiro256** stream and keeps the choices, replaying smaller choices shrinks it
+typedef struct tprop_s {
+	unsigned long long seed;
+	int seeded;
+	int cases;
+	int on;
+	int replay;
+	int quiet;
+	int show;
+	unsigned long long rng[4];
+	unsigned long long *draws;
+	size_t len;
+	size_t cap;
+	const unsigned long long *prefix;
+	size_t prefix_len;
+	size_t pos;
+	tarena_t mem;
+} tprop_t;
+
+// Fuzzing: the coverage hooks count edges in map while a target runs, a crash saves the input next to the crash path prefix
+typedef struct tfuzz_s {
+	const char *corpus;
+	int secs;
+	unsigned char *map;
+	unsigned long long prev;
+	const unsigned char *input;
+	size_t input_len;
+	const char *crash;
+} tfuzz_t;
+
+// Repeated runs of the tree: count runs, or runs until one fails with until_fail, without a limit if count is 0
+// Repeated runs: drawn is set once a property or differential test of the run drew from its seed
+typedef struct trepeat_s {
+	int count;
+	int until_fail;
+	int on;
+	int drawn;
+} trepeat_t;
+
+// Differential test that passed, its PASS line shows how many inputs each side ran per second
+typedef struct tdiff_s {
+	int done;
+	const char *names[2];
+	unsigned long long inputs;
+	unsigned long long ns[2];
+} tdiff_t;
+
+// Table test: name is set while its rows run, a failing row prints as NAME_ROW, done is set once all the rows run passed
+typedef struct ttable_s {
+	const char *name;
+	size_t row;
+	size_t rows;
+	size_t cnt;
+	int done;
+} ttable_t;
+
 typedef struct tdata_s {
 	void *priv;
 	setup_fn setup;
@@ -38,21 +337,65 @@ typedef struct tdata_s {
 	wdst_t wdst;
 	long long passed;
 	long long failed;
+	long long expect_failed;
 	int depth;
-	char *buf;
-	size_t buf_size;
-	size_t buf_len;
+	tarena_t buf;
 	const char *exp;
 	size_t exp_len;
+	tstream_t stream;
 	size_t mem;
 	mem_stats_t mem_stats;
 	int filter_argc;
 	char **filter_argv;
 	char *filter_matched;
 	int filter_run_all;
+	tnode_t *filter_nodes;
+	int *filter_next;
+	int level;
+	tbuf_t out;
+	twork_t work;
+	tpool_t *pool;
+	char path[T_PATH_MAX];
+	size_t path_len;
+	size_t path_lens[T_LEVEL_MAX];
+	int time;
+	int time_slowest;
+	tstamp_t time_start;
+	tstamp_t time_suites[T_LEVEL_MAX];
+	tslow_t *time_slow;
+	tbuf_t *recs;
+	tbench_t bench;
+	tbase_t *base;
+	dst_t sink;
+	tflush_t *flush;
+	int alloc_on;
+	talloc_t alloc;
+	talloc_t alloc_test;
+	talloc_t alloc_suites[T_LEVEL_MAX];
+	// Compilers assume malloc and free read no other memory, volatile keeps the guard set around them
+	volatile int alloc_guard;
+	int leaks;
+	tleaks_t *leak_tab;
+	int timeout;
+	int isolate;
+	int tests;
+	tshard_t shard;
+	tdur_t *dur;
+	tjournal_t journal;
+	tprop_t prop;
+	tfuzz_t fuzz;
+	tdiff_t diff;
+	ttable_t table;
+	trepeat_t repeat;
 } tdata_t;
 
-static tdata_t s_data;
+#if defined(C_WIN)
+	#define T_TLS __declspec(thread)
+#else
+	#define T_TLS __thread
+#endif
+
+static T_TLS tdata_t s_data;
 
 tdata_t t_get_data(void)
 {
@@ -64,843 +407,6431 @@ void t_set_data(tdata_t data)
 	s_data = data;
 }
 
-static size_t t_printv(const char *fmt, va_list args)
+static unsigned long long t_fnv1a(const char *str, size_t len)
 {
-	size_t off = s_data.dst.off;
-	s_data.dst.off += dputv(s_data.dst, fmt, args);
-	return s_data.dst.off - off;
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)str[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
 }
 
-static size_t t_printf(const char *fmt, ...)
+static unsigned long long t_splitmix(unsigned long long *state)
 {
-	va_list args;
-	va_start(args, fmt);
-	size_t ret = t_printv(fmt, args);
-	va_end(args);
-	return ret;
+	unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+	z		     = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z		     = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
 }
 
-static size_t t_wprintv(const wchar_t *fmt, va_list args)
+#if defined(T_ALLOC_HOOK)
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t cnt, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+void *__libc_valloc(size_t size);
+void *__libc_pvalloc(size_t size);
+void __libc_free(void *ptr);
+
+static void t_alloc_add(void *ptr, size_t size)
 {
-	size_t off = s_data.wdst.off;
-	s_data.wdst.off += wdputv(s_data.wdst, fmt, args);
-	return s_data.wdst.off - off;
+	talloc_t *alloc = &s_data.alloc;
+
+	int cls = 0;
+	if (size > 16) {
+		cls = (int)(sizeof(unsigned long long) * CHAR_BIT) - __builtin_clzll((unsigned long long)size - 1) - 4;
+		cls = cls < T_ALLOC_CLASSES ? cls : T_ALLOC_CLASSES - 1;
+	}
+
+	alloc->allocs++;
+	alloc->sizes[cls]++;
+	alloc->live += (long long)malloc_usable_size(ptr);
+	if (alloc->live > alloc->peak) {
+		alloc->peak = alloc->live;
+	}
 }
 
-static size_t t_wprintf(const wchar_t *fmt, ...)
+static void t_alloc_del(size_t usable)
 {
-	va_list args;
-	va_start(args, fmt);
-	size_t ret = t_wprintv(fmt, args);
-	va_end(args);
-	return ret;
+	s_data.alloc.frees++;
+	s_data.alloc.live -= (long long)usable;
 }
 
-void t_set_priv(void *priv)
+static size_t t_leak_slot(const tleaks_t *tab, const void *ptr)
 {
-	s_data.priv = priv;
+	unsigned long long h = (unsigned long long)(uintptr_t)ptr >> 4;
+	h *= 0x9E3779B97F4A7C15ULL;
+	return (size_t)(h ^ (h >> 32)) & (tab->cap - 1);
 }
 
-void t_setup(setup_fn setup)
+// Rebuilds the table without freed entries, growing it when most entries are live
+static int t_leak_rehash(tleaks_t *tab)
 {
-	s_data.setup = setup;
+	size_t cap    = tab->cap == 0 ? 256 : tab->live * 2 >= tab->cap ? tab->cap * 2 : tab->cap;
+	tleak_t *ents = __libc_calloc(cap, sizeof(*ents));
+	if (ents == NULL) {
+		return 1;
+	}
+
+	tleaks_t old = *tab;
+	tab->cap     = cap;
+	tab->used    = 0;
+	tab->ents    = ents;
+
+	for (size_t i = 0; i < old.cap; i++) {
+		if (old.ents[i].ptr == NULL || old.ents[i].gen != tab->gen) {
+			continue;
+		}
+
+		size_t slot = t_leak_slot(tab, old.ents[i].ptr);
+		while (ents[slot].ptr) {
+			slot = (slot + 1) & (cap - 1);
+		}
+		ents[slot] = old.ents[i];
+		tab->used++;
+	}
+
+	__libc_free(old.ents);
+	return 0;
 }
 
-void t_teardown(teardown_fn teardown)
+static void t_leak_add(void *ptr, size_t size, void *caller)
 {
-	s_data.teardown = teardown;
+	tleaks_t *tab = s_data.leak_tab;
+	if ((tab->used + 1) * 4 > tab->cap * 3 && t_leak_rehash(tab)) {
+		return;
+	}
+
+	size_t slot = t_leak_slot(tab, ptr);
+	while (tab->ents[slot].ptr && tab->ents[slot].gen == tab->gen) {
+		slot = (slot + 1) & (tab->cap - 1);
+	}
+
+	tleak_t *ent = &tab->ents[slot];
+	if (ent->ptr == NULL) {
+		tab->used++;
+	}
+
+	ent->ptr	= ptr;
+	ent->size	= size;
+	ent->gen	= tab->gen;
+	ent->frames[0]	= caller;
+	ent->frames_cnt = 1;
+	tab->live++;
+
+	if (s_data.leaks > 1) {
+		// backtrace may allocate on its first call
+		void *frames[T_LEAK_FRAMES + 4];
+		s_data.alloc_guard++;
+		int cnt = backtrace(frames, T_LEAK_FRAMES + 4);
+		s_data.alloc_guard--;
+
+		int first = 0;
+		while (first < cnt && frames[first] != caller) {
+			first++;
+		}
+		first = first < cnt ? first : 0;
+
+		ent->frames_cnt = cnt - first < T_LEAK_FRAMES ? cnt - first : T_LEAK_FRAMES;
+		memcpy(ent->frames, frames + first, (size_t)ent->frames_cnt * sizeof(void *));
+	}
 }
 
-dst_t t_set_dst(dst_t dst)
+static void t_leak_del(void *ptr)
 {
-	dst_t cur  = s_data.dst;
-	s_data.dst = dst;
-	return cur;
+	tleaks_t *tab = s_data.leak_tab;
+	if (tab->cap == 0) {
+		return;
+	}
+
+	for (size_t slot = t_leak_slot(tab, ptr); tab->ents[slot].ptr; slot = (slot + 1) & (tab->cap - 1)) {
+		tleak_t *ent = &tab->ents[slot];
+		if (ent->ptr == ptr && ent->gen == tab->gen) {
+			ent->gen = 0;
+			tab->live--;
+			return;
+		}
+	}
 }
 
-wdst_t t_set_wdst(wdst_t dst)
+static int t_leak_on(void)
 {
-	wdst_t cur  = s_data.wdst;
-	s_data.wdst = dst;
-	return cur;
+	return s_data.leak_tab && s_data.leak_tab->track && !s_data.alloc_guard;
 }
 
-void *t_get_priv(void)
+// Counts a new block, caller is the code that asked for it, the blocks the framework allocates for itself are not counted
+static void *t_alloc_new(void *ptr, size_t size, void *caller)
 {
-	return s_data.priv;
+	if (ptr && !s_data.alloc_guard) {
+		t_alloc_add(ptr, size);
+		if (t_leak_on()) {
+			t_leak_add(ptr, size, caller);
+		}
+	}
+	return ptr;
 }
 
-static inline int pur(void)
+void *malloc(size_t size)
 {
-	t_printf("└─");
-	return 2;
+	return t_alloc_new(__libc_malloc(size), size, __builtin_return_address(0));
 }
 
-static inline int pv(void)
+void *calloc(size_t cnt, size_t size)
 {
-	t_printf("│ ");
-	return 2;
+	return t_alloc_new(__libc_calloc(cnt, size), cnt * size, __builtin_return_address(0));
 }
 
-static inline int pvr(void)
+static void *t_alloc_realloc(void *ptr, size_t size, void *caller)
 {
-	t_printf("├─");
-	return 2;
+	size_t usable = ptr ? malloc_usable_size(ptr) : 0;
+	void *res     = __libc_realloc(ptr, size);
+	if (ptr && (res || size == 0) && !s_data.alloc_guard) {
+		t_alloc_del(usable);
+		if (t_leak_on()) {
+			t_leak_del(ptr);
+		}
+	}
+	return t_alloc_new(res, size, caller);
 }
 
-static int t_arg_eq(const char *arg, const char *str)
+void *realloc(void *ptr, size_t size)
 {
-	if (arg == NULL || str == NULL) {
-		return 0;
-	}
+	return t_alloc_realloc(ptr, size, __builtin_return_address(0));
+}
 
-	while (*arg && *str) {
-		if (*arg++ != *str++) {
-			return 0;
-		}
+// glibc calls its own realloc here, so it is wrapped too
+void *reallocarray(void *ptr, size_t cnt, size_t size)
+{
+	if (size && cnt > (size_t)-1 / size) {
+		errno = ENOMEM;
+		return NULL;
 	}
+	return t_alloc_realloc(ptr, cnt * size, __builtin_return_address(0));
+}
 
-	return *arg == *str;
+// The aligned allocations do not go through malloc in glibc, a block they return would be freed without being counted
+void *memalign(size_t align, size_t size)
+{
+	return t_alloc_new(__libc_memalign(align, size), size, __builtin_return_address(0));
 }
 
-static void t_filter(int argc, char **argv)
+void *aligned_alloc(size_t align, size_t size)
 {
-	if (s_data.filter_matched) {
-		free(s_data.filter_matched);
+	if (align == 0 || (align & (align - 1))) {
+		errno = EINVAL;
+		return NULL;
 	}
+	return t_alloc_new(__libc_memalign(align, size), size, __builtin_return_address(0));
+}
 
-	s_data.filter_argc    = argc;
-	s_data.filter_argv    = argv;
-	s_data.filter_matched = NULL;
-	s_data.filter_run_all = 0;
+int posix_memalign(void **ptr, size_t align, size_t size)
+{
+	if (align % sizeof(void *) || (align & (align - 1))) {
+		return EINVAL;
+	}
 
-	if (argc > 0) {
-		s_data.filter_matched = calloc((size_t)argc, sizeof(*s_data.filter_matched));
+	void *res = t_alloc_new(__libc_memalign(align, size), size, __builtin_return_address(0));
+	if (res == NULL) {
+		return ENOMEM;
 	}
+	*ptr = res;
+	return 0;
 }
 
-static dst_t t_help_dst(void)
+void *valloc(size_t size)
 {
-	return s_data.dst.putv ? s_data.dst : DST_STD();
+	return t_alloc_new(__libc_valloc(size), size, __builtin_return_address(0));
 }
 
-int t_init(int argc, char **argv)
+void *pvalloc(size_t size)
 {
-	for (int i = 1; i < argc; i++) {
-		if (t_arg_eq(argv[i], "-h") || t_arg_eq(argv[i], "--help")) {
-			const char *program = argc > 0 && argv[0] ? argv[0] : "test";
-
-			dputf(t_help_dst(),
-			      "Usage: %s [filter...]\n"
-			      "\n"
-			      "Options:\n"
-			      "  -h, --help  Print this help message.\n"
-			      "\n"
-			      "Filters:\n"
-			      "  Each filter selects tests or suites by name prefix.\n"
-			      "  Selecting a suite runs all tests under that suite.\n",
-			      program);
+	return t_alloc_new(__libc_pvalloc(size), size, __builtin_return_address(0));
+}
 
-			return 1;
+void free(void *ptr)
+{
+	if (ptr && !s_data.alloc_guard) {
+		t_alloc_del(malloc_usable_size(ptr));
+		if (t_leak_on()) {
+			t_leak_del(ptr);
 		}
 	}
+	__libc_free(ptr);
+}
+#endif
 
-	s_data.dst  = DST_STD();
-	s_data.wdst = WDST_STD();
-
-	s_data.passed = 0;
-	s_data.failed = 0;
-	s_data.depth  = -1;
+// Frees a block that was allocated with alloc_guard set, so it is not counted as freed either
+static void t_guard_free(void *ptr)
+{
+	s_data.alloc_guard++;
+	free(ptr);
+	s_data.alloc_guard--;
+}
 
-	s_data.buf_size = 256;
-	s_data.buf_len	= 0;
+static void t_leak_free(void)
+{
+	if (s_data.leak_tab) {
+#if defined(T_ALLOC_HOOK)
+		__libc_free(s_data.leak_tab->ents);
+#endif
+		t_guard_free(s_data.leak_tab);
+		s_data.leak_tab = NULL;
+	}
+}
 
-	s_data.buf = malloc(s_data.buf_size);
+static int t_buf_grow(tbuf_t *buf, size_t len)
+{
+	if (buf->len + len < buf->size) {
+		return 0;
+	}
 
-	mem_stats_set(&s_data.mem_stats);
+	size_t size = buf->size < 256 ? 256 : buf->size;
+	while (size <= buf->len + len) {
+		size *= 2;
+	}
 
-	if (argc > 1) {
-		t_filter(argc - 1, argv + 1);
-	} else if (argc > 0) {
-		t_filter(0, NULL);
+	// Output buffers outlive the test that grows them
+	s_data.alloc_guard++;
+	char *data = realloc(buf->data, size);
+	s_data.alloc_guard--;
+	if (data == NULL) {
+		return 1;
 	}
 
+	buf->data = data;
+	buf->size = size;
 	return 0;
 }
 
-static int t_starts_with(const char *str, const char *prefix)
+static size_t t_buf_add(tbuf_t *buf, const char *str, size_t len)
 {
-	while (*prefix) {
-		if (*str++ != *prefix++) {
+	if (t_buf_grow(buf, len)) {
+		return 0;
+	}
+
+	memcpy(buf->data + buf->len, str, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+	return len;
+}
+
+static size_t t_buf_printv(tbuf_t *buf, const char *fmt, va_list args)
+{
+	va_list copy;
+	va_copy(copy, args);
+	int len = vsnprintf(buf->data == NULL ? NULL : buf->data + buf->len, buf->size - buf->len, fmt, copy);
+	va_end(copy);
+
+	if (len < 0) {
+		return 0;
+	}
+
+	if (buf->len + (size_t)len >= buf->size) {
+		if (t_buf_grow(buf, (size_t)len)) {
 			return 0;
 		}
+		vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, args);
 	}
-	return 1;
+
+	buf->len += (size_t)len;
+	return (size_t)len;
 }
 
-static size_t t_strlen(const char *str)
+#if !defined(C_WIN)
+
+struct tflush_s {
+	pthread_t id;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	dst_t dst;
+	tbuf_t pending;
+	int stop;
+};
+
+#endif
+
+static void t_sink_write(dst_t *dst, const char *data, size_t len)
 {
-	size_t len = 0;
-	while (*str++) {
-		len++;
+	// The first write may allocate the stdio buffer
+	s_data.alloc_guard++;
+	while (len > 0) {
+		int chunk = len > INT_MAX ? INT_MAX : (int)len;
+		dst->off += dputf(*dst, "%.*s", chunk, data);
+		data += chunk;
+		len -= (size_t)chunk;
 	}
-	return len;
+	s_data.alloc_guard--;
 }
 
-static int t_filter_has_child(int index)
+#if !defined(C_WIN)
+
+static void *t_flush_thread(void *arg)
 {
-	const char *filter = s_data.filter_argv[index];
-	size_t len	   = t_strlen(filter);
+	tflush_t *flush = arg;
 
-	for (int i = 0; i < s_data.filter_argc; i++) {
-		if (i == index) {
-			continue;
+	pthread_mutex_lock(&flush->lock);
+	for (;;) {
+		while (flush->pending.len == 0 && !flush->stop) {
+			pthread_cond_wait(&flush->cond, &flush->lock);
 		}
 
-		if (t_starts_with(s_data.filter_argv[i], filter) && s_data.filter_argv[i][len] == '_') {
-			return 1;
+		if (flush->pending.len == 0) {
+			break;
 		}
+
+		// The pending buffer belongs to this thread until its length is reset
+		pthread_mutex_unlock(&flush->lock);
+		t_sink_write(&flush->dst, flush->pending.data, flush->pending.len);
+		pthread_mutex_lock(&flush->lock);
+
+		flush->pending.len = 0;
+		pthread_cond_broadcast(&flush->cond);
 	}
+	pthread_mutex_unlock(&flush->lock);
 
-	return 0;
+	return NULL;
 }
 
-int t_finish(void)
+static void t_flush_start(void)
 {
-	for (int i = 0; i < s_data.filter_argc; i++) {
-		if (!s_data.filter_matched[i]) {
-			t_printf("\033[0;31mFAIL filter '%s' matched no tests\033[0m\n", s_data.filter_argv[i]);
-			s_data.failed++;
-		}
+	tflush_t *flush = calloc(1, sizeof(*flush));
+	if (flush == NULL) {
+		return;
 	}
 
-	if (s_data.failed == 0) {
-		t_printf("\033[0;32mPASS %llu %s\033[0m\n", s_data.passed, s_data.passed == 1 ? "TEST" : "TESTS");
-	} else {
-		t_printf("\033[0;31mFAIL %llu/%llu %s\033[0m\n",
-			 s_data.failed,
-			 s_data.failed + s_data.passed,
-			 s_data.failed == 1 ? "TEST" : "TESTS");
-	}
+	pthread_mutex_init(&flush->lock, NULL);
+	pthread_cond_init(&flush->cond, NULL);
 
-	free(s_data.buf);
-	t_filter(0, NULL);
+	s_data.alloc_guard++;
+	int err = pthread_create(&flush->id, NULL, t_flush_thread, flush);
+	s_data.alloc_guard--;
+	if (err) {
+		pthread_cond_destroy(&flush->cond);
+		pthread_mutex_destroy(&flush->lock);
+		free(flush);
+		return;
+	}
 
-	return (int)s_data.failed;
+	s_data.flush = flush;
 }
 
-static int t_should_run(const char *name)
+#endif
+
+// Writes buffered output to the sink, handing it to the flush thread unless sync is set
+static void t_flush(int sync)
 {
-	if (s_data.filter_argc == 0 || name == NULL) {
-		return 1;
+	if (s_data.dst.off != T_BUFFER) {
+		return;
 	}
 
-	int run = s_data.filter_run_all;
-
-	for (int i = 0; i < s_data.filter_argc; i++) {
-		const char *filter = s_data.filter_argv[i];
-
-		if (t_starts_with(name, filter)) {
-			s_data.filter_matched[i] = 1;
-			if (!t_filter_has_child(i) || name[t_strlen(filter)] == '\0') {
-				run = 1;
-			}
+#if !defined(C_WIN)
+	tflush_t *flush = s_data.flush;
+	if (flush) {
+		pthread_mutex_lock(&flush->lock);
+		while (flush->pending.len > 0) {
+			pthread_cond_wait(&flush->cond, &flush->lock);
 		}
 
-		if (t_starts_with(filter, name) && filter[t_strlen(name)] == '_') {
-			run = 1;
+		// The flush thread advances its copy of the sink
+		if (flush->dst.putv) {
+			s_data.sink.off = flush->dst.off;
 		}
-	}
 
-	return run;
-}
+		if (s_data.out.len > 0) {
+			tbuf_t out     = flush->pending;
+			flush->pending = s_data.out;
+			flush->dst     = s_data.sink;
+			s_data.out     = out;
+			pthread_cond_broadcast(&flush->cond);
+		}
 
-int t_enter(const char *name)
-{
-	if (!t_should_run(name)) {
-		return -1;
-	}
+		while (sync && flush->pending.len > 0) {
+			pthread_cond_wait(&flush->cond, &flush->lock);
+		}
 
-	int filter_run_all = s_data.filter_run_all;
-	if (name != NULL) {
-		for (int i = 0; i < s_data.filter_argc; i++) {
-			if (t_starts_with(name, s_data.filter_argv[i]) && !t_filter_has_child(i)) {
-				s_data.filter_run_all = 1;
-				break;
-			}
+		if (sync && flush->dst.putv) {
+			s_data.sink.off = flush->dst.off;
 		}
+		pthread_mutex_unlock(&flush->lock);
+	} else
+#endif
+	{
+		t_sink_write(&s_data.sink, s_data.out.data, s_data.out.len);
+		s_data.out.len = 0;
 	}
 
-	return filter_run_all;
+	if (sync) {
+		fflush(stdout);
+	}
 }
 
-void t_leave(int state)
+static void t_flush_stop(void)
 {
-	if (state >= 0) {
-		s_data.filter_run_all = state;
+	t_flush(1);
+
+#if !defined(C_WIN)
+	tflush_t *flush = s_data.flush;
+	if (flush) {
+		pthread_mutex_lock(&flush->lock);
+		flush->stop = 1;
+		pthread_cond_broadcast(&flush->cond);
+		pthread_mutex_unlock(&flush->lock);
+
+		pthread_join(flush->id, NULL);
+		pthread_cond_destroy(&flush->cond);
+		pthread_mutex_destroy(&flush->lock);
+		t_guard_free(flush->pending.data);
+		free(flush);
+		s_data.flush = NULL;
 	}
+#endif
 }
 
-int t_run_named(test_fn fn, const char *name, int print)
-{
-	dst_t dst   = {0};
-	wdst_t wdst = {0};
+#if !defined(C_WIN)
 
-	int state = t_enter(name);
-	if (state < 0) {
-		return -1;
-	}
-
-	if (print == 0) {
-		dst  = t_set_dst(DST_NONE());
-		wdst = t_set_wdst(WDST_NONE());
-	}
+// A child running one isolated node, the state belongs to the process rather than to the test data
+typedef struct tiso_s {
+	int on;
+	int fd;
+	int level;
+	tbuf_t recs;
+} tiso_t;
 
-	int ret = fn();
+static tiso_t s_iso;
 
-	t_leave(state);
+typedef struct tmsg_s {
+	int start;
+	int partial;
+	int unit;
+	long long passed;
+	long long failed;
+	int drawn;
+	size_t out_len;
+	size_t recs_len;
+} tmsg_t;
 
-	if (print == 0) {
-		t_set_dst(dst);
-		t_set_wdst(wdst);
+static int t_write_all(int fd, const void *data, size_t size)
+{
+	const char *ptr = data;
+	while (size > 0) {
+		ssize_t len = write(fd, ptr, size);
+		if (len <= 0) {
+			return 1;
+		}
+		ptr += len;
+		size -= (size_t)len;
 	}
-
-	return ret;
+	return 0;
 }
 
-int t_run(test_fn fn, int print)
+static int t_read_all(int fd, void *data, size_t size)
 {
-	return t_run_named(fn, NULL, print);
+	char *ptr = data;
+	while (size > 0) {
+		ssize_t len = read(fd, ptr, size);
+		if (len <= 0) {
+			return 1;
+		}
+		ptr += len;
+		size -= (size_t)len;
+	}
+	return 0;
 }
 
-void t_start(void)
+// Sends the results of a unit: counts, captured output, queued records and matched filters
+static void t_unit_send(int fd, int unit, int partial)
 {
-	s_data.mem = s_data.mem_stats.mem;
+	tmsg_t msg = {
+		.partial  = partial,
+		.unit	 = unit,
+		.passed	 = s_data.passed,
+		.failed	 = s_data.failed,
+		.drawn	 = s_data.repeat.drawn,
+		.out_len  = s_data.out.len,
+		.recs_len = s_data.recs ? s_data.recs->len : 0,
+	};
+
+	int err = t_write_all(fd, &msg, sizeof(msg));
+	if (!err && s_data.out.len > 0) {
+		err = t_write_all(fd, s_data.out.data, s_data.out.len);
+	}
+	if (!err && msg.recs_len > 0) {
+		err = t_write_all(fd, s_data.recs->data, msg.recs_len);
+	}
+	if (!err && s_data.filter_argc > 0) {
+		t_write_all(fd, s_data.filter_matched, (size_t)s_data.filter_argc);
+	}
+}
 
-	if (s_data.setup) {
-		s_data.setup(s_data.priv);
+static void t_crash_write(const char *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t ret = write(STDOUT_FILENO, data, len);
+		if (ret <= 0) {
+			return;
+		}
+		data += ret;
+		len -= (size_t)ret;
 	}
 }
 
-int t_end(int passed, const char *file, const char *func, int line)
+// Saves the input a fuzz target crashed on in its corpus, only with async-signal-safe calls
+static void t_fuzz_crash(void)
 {
-	if (s_data.teardown) {
-		s_data.teardown(s_data.priv);
+	static const char hex[] = "0123456789abcdef";
+
+	char path[T_PATH_MAX];
+	size_t len = 0;
+	while (s_data.fuzz.crash[len]) {
+		len++;
+	}
+	if (len + 17 > sizeof(path)) {
+		return;
 	}
+	memcpy(path, s_data.fuzz.crash, len);
 
-	if (!passed) {
-		s_data.failed++;
-		return 1;
+	unsigned long long hash = t_fnv1a((const char *)s_data.fuzz.input, s_data.fuzz.input_len);
+	for (int i = 15; i >= 0; i--) {
+		path[len + (size_t)i] = hex[hash & 0xf];
+		hash >>= 4;
 	}
+	path[len + 16] = '\0';
 
-	for (int i = 0; i < s_data.depth; i++) {
-		pv();
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return;
 	}
-	pvr();
+	t_write_all(fd, s_data.fuzz.input, s_data.fuzz.input_len);
+	close(fd);
 
-	if (s_data.mem != s_data.mem_stats.mem) {
-		t_printf("\033[0;31mLEAK %s\033[0m\n", func + sizeof(TEST_PREFIX) - 1);
+	t_crash_write("crashing input saved to ", 24);
+	t_crash_write(path, len + 16);
+	t_crash_write("\n", 1);
+}
 
-		for (int i = 0; i < s_data.depth; i++) {
-			pv();
+// Writes out what is still buffered before a crashing signal terminates the process
+static void t_crash(int sig)
+{
+	if (s_iso.on) {
+		// The parent reports the crash after the output of the node so far
+		t_unit_send(s_iso.fd, 0, 1);
+	} else if (s_data.dst.off == T_BUFFER) {
+		if (ftrylockfile(stdout) == 0) {
+			fflush(stdout);
+			funlockfile(stdout);
 		}
-		pv();
-
-		t_printf("\033[0;31m%s:%d: %d B\033[0m\n", file, line, s_data.mem_stats.mem - s_data.mem);
 
-		s_data.failed++;
-		return 1;
+		if (s_data.flush) {
+			t_crash_write(s_data.flush->pending.data, s_data.flush->pending.len);
+		}
+		t_crash_write(s_data.out.data, s_data.out.len);
 	}
 
-	t_printf("\033[0;32mPASS %s\033[0m\n", func + sizeof(TEST_PREFIX) - 1);
+	if (s_data.fuzz.crash && s_data.fuzz.input) {
+		t_fuzz_crash();
+	}
 
-	s_data.passed++;
-	return 0;
+	raise(sig);
 }
 
-void t_cstart(void)
+static void t_crash_init(void)
 {
+	static const int sigs[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = t_crash;
+	sa.sa_flags   = SA_RESETHAND;
+	sigemptyset(&sa.sa_mask);
+
+	for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+		sigaction(sigs[i], &sa, NULL);
+	}
 }
 
-int t_cend(int passed, const char *func)
-{
-	(void)func;
+#endif
 
-	if (!passed) {
-		s_data.failed++;
-		return 1;
+static void t_arena_free(tarena_t *arena)
+{
+	tchunk_t *chunk = arena->head;
+	while (chunk) {
+		tchunk_t *next = chunk->next;
+		t_guard_free(chunk);
+		chunk = next;
 	}
 
-	s_data.passed++;
-	return 0;
+	*arena = (tarena_t){0};
 }
 
-void t_sstart(const char *func)
+static void t_arena_reset(tarena_t *arena)
 {
-	for (int i = 0; i < s_data.depth; i++) {
-		pv();
+	arena->tail = arena->head;
+	arena->len  = 0;
+	if (arena->head) {
+		arena->head->len = 0;
 	}
-	if (s_data.depth >= 0) {
-		pvr();
+}
+
+// Makes room for len bytes in one chunk, existing chunks are never moved
+static tchunk_t *t_arena_reserve(tarena_t *arena, size_t len)
+{
+	tchunk_t *tail = arena->tail;
+	if (tail && tail->size - tail->len >= len) {
+		return tail;
 	}
 
-	t_printf("%s\n", func + sizeof(TEST_PREFIX) - 1);
-	s_data.depth++;
+	tchunk_t *next = tail ? tail->next : arena->head;
+	if (next == NULL || next->size < len) {
+		size_t size = tail ? tail->size * 2 : 256;
+		while (size < len) {
+			size *= 2;
+		}
+
+		s_data.alloc_guard++;
+		tchunk_t *chunk = malloc(sizeof(tchunk_t) + size);
+		s_data.alloc_guard--;
+		if (chunk == NULL) {
+			return NULL;
+		}
+
+		chunk->next = next;
+		chunk->size = size;
+		if (tail) {
+			tail->next = chunk;
+		} else {
+			arena->head = chunk;
+		}
+		next = chunk;
+	}
+
+	next->len   = 0;
+	arena->tail = next;
+	return next;
 }
 
-int t_send(int passed, int failed)
+// Cases run while a property is searched and shrunk print nothing
+static size_t t_printv(const char *fmt, va_list args)
 {
-	for (int i = 0; i < s_data.depth; i++) {
-		pv();
+	if (s_data.prop.quiet) {
+		return 0;
 	}
-	pur();
-	if (failed == 0) {
-		t_printf("\033[0;32mPASS %d %s\033[0m\n", passed, passed == 1 ? "TEST" : "TESTS");
-	} else {
-		t_printf("\033[0;31mFAIL %d/%d %s\033[0m\n", failed, failed + passed, failed == 1 ? "TEST" : "TESTS");
+
+	if (s_data.dst.off == T_CAPTURE || s_data.dst.off == T_BUFFER) {
+		size_t len = t_buf_printv(&s_data.out, fmt, args);
+		if (s_data.dst.off == T_BUFFER && s_data.out.len >= T_FLUSH_SIZE) {
+			t_flush(0);
+		}
+		return len;
 	}
-	s_data.depth--;
-	return failed > 0;
+
+	size_t off = s_data.dst.off;
+	s_data.dst.off += dputv(s_data.dst, fmt, args);
+	return s_data.dst.off - off;
 }
 
-int t_scan(const char *str, const char *fmt, ...)
+static size_t t_printf(const char *fmt, ...)
 {
 	va_list args;
 	va_start(args, fmt);
-	const int ret = vsscanf(str, fmt, args);
+	size_t ret = t_printv(fmt, args);
 	va_end(args);
 	return ret;
 }
 
-int t_strcmp(const char *act, const char *exp)
+// Writes str without formatting
+static size_t t_puts(const char *str, size_t len)
 {
-	if (act == NULL && exp == NULL) {
+	if (s_data.prop.quiet) {
 		return 0;
 	}
-	if (act == NULL || exp == NULL) {
-		return 1;
-	}
-
-	size_t act_len = t_strlen(act);
-	size_t exp_len = t_strlen(exp);
 
-	if (act_len != exp_len) {
-		return 1;
+	if (s_data.dst.off == T_CAPTURE || s_data.dst.off == T_BUFFER) {
+		t_buf_add(&s_data.out, str, len);
+		if (s_data.dst.off == T_BUFFER && s_data.out.len >= T_FLUSH_SIZE) {
+			t_flush(0);
+		}
+		return len;
 	}
 
-	return memcmp(act, exp, exp_len) == 0 ? 0 : 1;
+	return t_printf("%.*s", (int)len, str);
 }
 
-int t_strncmp(const char *act, const char *exp, size_t len)
+static size_t t_wprintv(const wchar_t *fmt, va_list args)
 {
-	if (act == NULL && exp == NULL && len == 0) {
+	if (s_data.prop.quiet) {
 		return 0;
 	}
-	if (act == NULL || exp == NULL || t_strlen(exp) != len) {
-		return 1;
+
+	// Wide output bypasses the buffer, keep it in order
+	t_flush(1);
+
+	if (s_data.dst.off == T_CAPTURE) {
+		wchar_t wbuf[256];
+		int len = vswprintf(wbuf, sizeof(wbuf) / sizeof(wbuf[0]), fmt, args);
+		for (int i = 0; i < len; i++) {
+			char mb[MB_LEN_MAX];
+			mbstate_t state;
+			memset(&state, 0, sizeof(state));
+			size_t mb_len = wcrtomb(mb, wbuf[i], &state);
+			if (mb_len == (size_t)-1) {
+				mb[0]  = '?';
+				mb_len = 1;
+			}
+			t_buf_add(&s_data.out, mb, mb_len);
+		}
+		return len < 0 ? 0 : (size_t)len;
 	}
 
-	return memcmp(act, exp, len) == 0 ? 0 : 1;
+	size_t off = s_data.wdst.off;
+	s_data.wdst.off += wdputv(s_data.wdst, fmt, args);
+	return s_data.wdst.off - off;
 }
 
-int t_wstrcmp(const wchar_t *act, const wchar_t *exp)
+static size_t t_wprintf(const wchar_t *fmt, ...)
 {
-	if (act == NULL && exp == NULL) {
-		return 0;
-	}
-	if (act == NULL || exp == NULL) {
-		return 1;
-	}
+	va_list args;
+	va_start(args, fmt);
+	size_t ret = t_wprintv(fmt, args);
+	va_end(args);
+	return ret;
+}
 
-	size_t act_len = wcslen(act);
-	size_t exp_len = wcslen(exp);
+void t_set_priv(void *priv)
+{
+	s_data.priv = priv;
+}
 
-	if (act_len != exp_len) {
-		return 1;
-	}
+void t_setup(setup_fn setup)
+{
+	s_data.setup = setup;
+}
 
-	return memcmp(act, exp, exp_len) == 0 ? 0 : 1;
+void t_teardown(teardown_fn teardown)
+{
+	s_data.teardown = teardown;
 }
 
-int t_wstrncmp(const wchar_t *act, const wchar_t *exp, size_t len)
+dst_t t_set_dst(dst_t dst)
 {
-	if (act == NULL && exp == NULL && len == 0) {
-		return 0;
-	}
-	if (act == NULL || exp == NULL || wcslen(exp) != len) {
-		return 1;
-	}
-	return memcmp(act, exp, len) == 0 ? 0 : 1;
+	dst_t cur  = s_data.dst;
+	s_data.dst = dst;
+	return cur;
 }
 
-static void print_header(int passed, const char *file, const char *func, int line)
+wdst_t t_set_wdst(wdst_t dst)
 {
-	if (passed && func) {
-		for (int i = 0; i < s_data.depth; i++) {
-			pv();
-		}
-		pvr();
-		t_printf("\033[0;31mFAIL %s\033[0m\n", func + sizeof(TEST_PREFIX) - 1);
-	}
+	wdst_t cur  = s_data.wdst;
+	s_data.wdst = dst;
+	return cur;
+}
 
-	for (int i = 0; i < s_data.depth; i++) {
-		pv();
-	}
-	pv();
+void *t_get_priv(void)
+{
+	return s_data.priv;
+}
 
-	t_printf("\033[0;31m");
+#define T_PUTS(_str) t_puts(_str, sizeof(_str) - 1)
 
-	if (file == NULL) {
-		return;
-	}
+#define T_INDENT_8 "│ │ │ │ │ │ │ │ "
 
-	t_printf("%s:%d: ", file, line);
-}
+static const char s_indent[] = T_INDENT_8 T_INDENT_8 T_INDENT_8 T_INDENT_8;
 
-// clang-format off
-#define get_char(_size, _args) \
-	(char)va_arg(_args, int)
+static inline int pur(void)
+{
+	T_PUTS("└─");
+	return 2;
+}
 
-#define get_short(_size, _args)                  \
-	_size == 1 ? (short)va_arg(_args, int) : \
-	_size == 2 ? (short)va_arg(_args, int) : \
-		     0
+static inline int pv(void)
+{
+	T_PUTS("│ ");
+	return 2;
+}
 
-#define get_int(_size, _args)                  \
-	_size == 1 ? (int)va_arg(_args, int) : \
-	_size == 2 ? (int)va_arg(_args, int) : \
-	_size == 4 ? (int)va_arg(_args, int) : \
-		     0
-// clang-format on
+static inline int pvr(void)
+{
+	T_PUTS("├─");
+	return 2;
+}
 
-#define get_long(_size, _args)                                                                                                             \
-	_size == 1   ? (long long)va_arg(_args, int)                                                                                       \
-	: _size == 2 ? (long long)va_arg(_args, int)                                                                                       \
-	: _size == 4 ? (long long)va_arg(_args, int)                                                                                       \
-	: _size == 8 ? (long long)va_arg(_args, long long)                                                                                 \
-		     : 0
+// Prints the tree prefix for the current depth, depth "│ " columns written at once
+static void t_indent(void)
+{
+	const size_t col = sizeof("│ ") - 1;
+	const int max	 = (int)((sizeof(s_indent) - 1) / col);
 
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
+	int depth = s_data.depth;
+	for (; depth > max; depth -= max) {
+		t_puts(s_indent, sizeof(s_indent) - 1);
+	}
+	if (depth > 0) {
+		t_puts(s_indent, (size_t)depth * col);
+	}
+}
 
-static void print_values(int passed, const char *file, const char *func, int line, const char *act, size_t act_size, const char *exp,
-			 size_t exp_size, const char *cond, va_list args)
+static int t_starts_with(const char *str, const char *prefix)
 {
-	print_header(passed, file, func, line);
-	t_printf("%s %s %s (", act, cond, exp);
-
-	int max_size = MAX((int)act_size, (int)exp_size);
+	while (*prefix) {
+		if (*str++ != *prefix++) {
+			return 0;
+		}
+	}
+	return 1;
+}
 
-	switch (max_size) {
-	case 0: {
-		const unsigned char a = get_char(act_size, args);
-		const unsigned char b = get_char(exp_size, args);
+#if defined(__AVX2__)
+typedef __m256i tvec_t;
+	#define T_VEC_SIZE	   32
+	#define t_vec_load(_p)	   _mm256_loadu_si256((const tvec_t *)(_p))
+	#define t_vec_set8(_c)	   _mm256_set1_epi8(_c)
+	#define t_vec_set16(_c)	   _mm256_set1_epi16(_c)
+	#define t_vec_set32(_c)	   _mm256_set1_epi32(_c)
+	#define t_vec_eq8(_a, _b)  (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_a, _b))
+	#define t_vec_eq16(_a, _b) (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(_a, _b))
+	#define t_vec_eq32(_a, _b) (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi32(_a, _b))
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+typedef __m128i tvec_t;
+	#define T_VEC_SIZE	   16
+	#define t_vec_load(_p)	   _mm_loadu_si128((const tvec_t *)(_p))
+	#define t_vec_set8(_c)	   _mm_set1_epi8(_c)
+	#define t_vec_set16(_c)	   _mm_set1_epi16(_c)
+	#define t_vec_set32(_c)	   _mm_set1_epi32(_c)
+	#define t_vec_eq8(_a, _b)  (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_a, _b))
+	#define t_vec_eq16(_a, _b) (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(_a, _b))
+	#define t_vec_eq32(_a, _b) (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi32(_a, _b))
+#endif
 
-		t_printf("%c %s %c", a ? '1' : '0', cond, b ? '1' : '0');
-		break;
+#if defined(T_VEC_SIZE)
+	#define T_VEC_ALL ((unsigned)((1ULL << T_VEC_SIZE) - 1))
+
+	#if defined(__SANITIZE_ADDRESS__)
+		#define T_NO_ASAN __attribute__((no_sanitize_address))
+	#elif defined(__has_feature)
+		#if __has_feature(address_sanitizer)
+			#define T_NO_ASAN __attribute__((no_sanitize_address))
+		#endif
+	#endif
+	#if !defined(T_NO_ASAN)
+		#define T_NO_ASAN
+	#endif
+
+static int t_ctz(unsigned mask)
+{
+	#if defined(__GNUC__)
+	return __builtin_ctz(mask);
+	#else
+	int n = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		n++;
 	}
-	case 1: {
-		const unsigned char a = get_char(act_size, args);
-		const unsigned char b = get_char(exp_size, args);
+	return n;
+	#endif
+}
+
+static int t_msb(unsigned mask)
+{
+	#if defined(__GNUC__)
+	return (int)(sizeof(unsigned) * CHAR_BIT) - 1 - __builtin_clz(mask);
+	#else
+	int n = -1;
+	while (mask) {
+		mask >>= 1;
+		n++;
+	}
+	return n;
+	#endif
+}
+
+static int t_popcnt(unsigned mask)
+{
+	#if defined(__GNUC__)
+	return __builtin_popcount(mask);
+	#else
+	int n = 0;
+	for (; mask; mask &= mask - 1) {
+		n++;
+	}
+	return n;
+	#endif
+}
+
+// Returns a mask with esize bits set for each element of the vector at p equal to c
+T_NO_ASAN static unsigned t_vec_eq(const void *p, tvec_t c, size_t esize)
+{
+	tvec_t v = t_vec_load(p);
+	switch (esize) {
+	case 1: return t_vec_eq8(v, c);
+	case 2: return t_vec_eq16(v, c);
+	default: return t_vec_eq32(v, c);
+	}
+}
+
+static tvec_t t_vec_set(int c, size_t esize)
+{
+	switch (esize) {
+	case 1: return t_vec_set8((char)c);
+	case 2: return t_vec_set16((short)c);
+	default: return t_vec_set32(c);
+	}
+}
+#endif
+
+// Returns the number of elements of esize bytes before the terminating zero
+#if defined(T_VEC_SIZE)
+T_NO_ASAN
+#endif
+static size_t t_len(const void *str, size_t esize)
+{
+#if defined(T_VEC_SIZE)
+	// Aligned loads never cross into the next page, so reading past the terminator is safe
+	const char *p	= str;
+	size_t mis	= (uintptr_t)p % T_VEC_SIZE;
+	const char *cur = p - mis;
+	tvec_t zero	= t_vec_set(0, esize);
+
+	unsigned mask = t_vec_eq(cur, zero, esize) >> mis;
+	if (mask) {
+		return (size_t)t_ctz(mask) / esize;
+	}
+
+	do {
+		cur += T_VEC_SIZE;
+		mask = t_vec_eq(cur, zero, esize);
+	} while (mask == 0);
+
+	return ((size_t)(cur - p) + (size_t)t_ctz(mask)) / esize;
+#else
+	size_t len = 0;
+	if (esize == 1) {
+		for (const char *p = str; *p; p++) {
+			len++;
+		}
+	} else {
+		for (const wchar_t *p = str; *p; p++) {
+			len++;
+		}
+	}
+	return len;
+#endif
+}
+
+static size_t t_strlen(const char *str)
+{
+	return t_len(str, sizeof(char));
+}
+
+static size_t t_wcslen(const wchar_t *str)
+{
+	return t_len(str, sizeof(wchar_t));
+}
+
+// Returns the index of the first byte that differs, or size if there is none
+static size_t t_mismatch(const void *a, const void *b, size_t size)
+{
+	const unsigned char *x = a;
+	const unsigned char *y = b;
+
+	size_t i = 0;
+#if defined(T_VEC_SIZE)
+	for (; i + T_VEC_SIZE <= size; i += T_VEC_SIZE) {
+		unsigned mask = t_vec_eq8(t_vec_load(x + i), t_vec_load(y + i)) ^ T_VEC_ALL;
+		if (mask) {
+			return i + (size_t)t_ctz(mask);
+		}
+	}
+#endif
+	while (i < size && x[i] == y[i]) {
+		i++;
+	}
+
+	return i;
+}
+
+// Counts the newlines in the first len elements of str, *line_start is set to the element after the last one
+static size_t t_count_nl(const void *str, size_t len, size_t esize, size_t *line_start)
+{
+	const char *p = str;
+	size_t size   = len * esize;
+	size_t cnt    = 0;
+
+	size_t i = 0;
+#if defined(T_VEC_SIZE)
+	tvec_t nl = t_vec_set('\n', esize);
+	for (; i + T_VEC_SIZE <= size; i += T_VEC_SIZE) {
+		unsigned mask = t_vec_eq(p + i, nl, esize);
+		if (mask) {
+			cnt += (size_t)t_popcnt(mask) / esize;
+			*line_start = (i + (size_t)t_msb(mask)) / esize + 1;
+		}
+	}
+#endif
+	for (; i < size; i += esize) {
+		if (esize == 1 ? p[i] == '\n' : *(const wchar_t *)(p + i) == L'\n') {
+			cnt++;
+			*line_start = i / esize + 1;
+		}
+	}
+
+	return cnt;
+}
+
+typedef struct tslow_ent_s {
+	tstamp_t took;
+	char path[T_PATH_MAX];
+} tslow_ent_t;
+
+struct tslow_s {
+	int cnt;
+	int size;
+	tslow_ent_t ents[];
+};
+
+// Per-test record, followed by path_len bytes of the test path and samples benchmark samples.
+// A nested test ran inside another test, a partial record is of a node that crashed or timed out and only has a result
+typedef struct trec_s {
+	tstamp_t took;
+	int failed;
+	int nested;
+	int partial;
+	int path_len;
+	int samples;
+} trec_t;
+
+typedef struct tbase_ent_s {
+	const char *path;
+	size_t path_len;
+	int cnt;
+	double *samples;
+} tbase_ent_t;
+
+// Benchmark baselines: results to save and the loaded baseline to compare against
+struct tbase_s {
+	const char *save;
+	tbuf_t out;
+	unsigned int out_cnt;
+	char *data;
+	tbase_ent_t *ents;
+	int ents_cnt;
+	double max_regress;
+};
+
+static unsigned long long t_wall(void)
+{
+	struct timespec ts;
+#if defined(C_WIN)
+	timespec_get(&ts, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static tstamp_t t_stamp(void)
+{
+#if defined(C_WIN)
+	return (tstamp_t){
+		.wall = t_wall(),
+		.cpu  = (unsigned long long)clock() * (1000000000ULL / CLOCKS_PER_SEC),
+	};
+#else
+	struct timespec cpu;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	return (tstamp_t){
+		.wall = t_wall(),
+		.cpu  = (unsigned long long)cpu.tv_sec * 1000000000ULL + (unsigned long long)cpu.tv_nsec,
+	};
+#endif
+}
+
+static tstamp_t t_took(tstamp_t start)
+{
+	tstamp_t now = t_stamp();
+	return (tstamp_t){.wall = now.wall - start.wall, .cpu = now.cpu - start.cpu};
+}
+
+static const char *t_fmt_ns(char *buf, size_t size, double ns)
+{
+	if (ns < 1e3) {
+		snprintf(buf, size, "%.1f ns", ns);
+	} else if (ns < 1e6) {
+		snprintf(buf, size, "%.1f us", ns / 1e3);
+	} else if (ns < 1e9) {
+		snprintf(buf, size, "%.1f ms", ns / 1e6);
+	} else {
+		snprintf(buf, size, "%.2f s", ns / 1e9);
+	}
+	return buf;
+}
+
+// Formats a byte count with a binary unit
+static const char *t_fmt_bytes(char *buf, size_t size, long long bytes)
+{
+	if (bytes < 1024) {
+		snprintf(buf, size, "%lld B", bytes);
+	} else if (bytes < 1024 * 1024) {
+		snprintf(buf, size, "%.1f KiB", (double)bytes / 1024);
+	} else if (bytes < 1024 * 1024 * 1024) {
+		snprintf(buf, size, "%.1f MiB", (double)bytes / (1024 * 1024));
+	} else {
+		snprintf(buf, size, "%.1f GiB", (double)bytes / (1024 * 1024 * 1024));
+	}
+	return buf;
+}
+
+// Formats the allocations made since start, peak is the most memory in use on top of what was in use at start
+static const char *t_fmt_allocs(char *buf, size_t size, const talloc_t *start, long long peak)
+{
+	const talloc_t *alloc = &s_data.alloc;
+
+	char bytes[32];
+	int len = snprintf(buf,
+			   size,
+			   "allocs %llu, frees %llu, peak %s",
+			   alloc->allocs - start->allocs,
+			   alloc->frees - start->frees,
+			   t_fmt_bytes(bytes, sizeof(bytes), peak > 0 ? peak : 0));
+
+	const char *sep = ", sizes ";
+	for (int i = 0; i < T_ALLOC_CLASSES && len > 0 && (size_t)len < size; i++) {
+		unsigned long long cnt = alloc->sizes[i] - start->sizes[i];
+		if (cnt == 0) {
+			continue;
+		}
+
+		unsigned long max = 16UL << i;
+		if (i == T_ALLOC_CLASSES - 1) {
+			len += snprintf(buf + len, size - (size_t)len, "%s>%luK: %llu", sep, (max >> 1) / 1024, cnt);
+		} else if (max < 1024) {
+			len += snprintf(buf + len, size - (size_t)len, "%s%lu: %llu", sep, max, cnt);
+		} else {
+			len += snprintf(buf + len, size - (size_t)len, "%s%luK: %llu", sep, max / 1024, cnt);
+		}
+		sep = ", ";
+	}
+
+	return buf;
+}
+
+// Folds the peak since the last reset into the suite at depth
+static void t_alloc_fold(int depth)
+{
+	if (depth >= 0 && depth < T_LEVEL_MAX && s_data.alloc.peak > s_data.alloc_suites[depth].peak) {
+		s_data.alloc_suites[depth].peak = s_data.alloc.peak;
+	}
+}
+
+// Formats " (<wall>)" for a PASS/FAIL line, or nothing when timing is off
+static const char *t_fmt_took(char *buf, size_t size, tstamp_t took)
+{
+	buf[0] = '\0';
+	if (s_data.time) {
+		char ns[32];
+		snprintf(buf, size, " (%s)", t_fmt_ns(ns, sizeof(ns), (double)took.wall));
+	}
+	return buf;
+}
+
+static void t_slow_add(tstamp_t took, const char *path, size_t path_len)
+{
+	tslow_t *slow = s_data.time_slow;
+	if (slow == NULL || slow->size == 0 || (slow->cnt == slow->size && took.wall <= slow->ents[slow->cnt - 1].took.wall)) {
+		return;
+	}
+
+	int i = slow->cnt < slow->size ? slow->cnt++ : slow->cnt - 1;
+	for (; i > 0 && slow->ents[i - 1].took.wall < took.wall; i--) {
+		slow->ents[i] = slow->ents[i - 1];
+	}
+
+	if (path_len >= T_PATH_MAX) {
+		path_len = T_PATH_MAX - 1;
+	}
+
+	slow->ents[i].took = took;
+	memcpy(slow->ents[i].path, path, path_len);
+	slow->ents[i].path[path_len] = '\0';
+}
+
+static void t_base_add(tbase_t *base, const char *path, size_t path_len, const char *samples, int cnt)
+{
+	unsigned int len = (unsigned int)path_len;
+	unsigned int num = (unsigned int)cnt;
+
+	t_buf_add(&base->out, (const char *)&len, sizeof(len));
+	t_buf_add(&base->out, path, path_len);
+	t_buf_add(&base->out, (const char *)&num, sizeof(num));
+	t_buf_add(&base->out, samples, (size_t)cnt * sizeof(double));
+	base->out_cnt++;
+}
+
+typedef struct tdur_ent_s {
+	unsigned int off;
+	unsigned int len;
+	unsigned long long val;
+} tdur_ent_t;
+
+// A value per test path, the durations or the journal: a header, entries sorted by path and the paths they point into,
+// searched in place. Results of this run are queued in out and merged into the file at t_finish
+struct tdur_s {
+	const char *file;
+	const char *magic;
+	int latest;
+	char *data;
+	const tdur_ent_t *ents;
+	const char *strs;
+	unsigned int cnt;
+	int *shards;
+	tbuf_t out;
+};
+
+static void t_dur_add(tdur_t *dur, const char *path, size_t path_len, unsigned long long val)
+{
+	unsigned int len = (unsigned int)path_len;
+	t_buf_add(&dur->out, (const char *)&len, sizeof(len));
+	t_buf_add(&dur->out, path, path_len);
+	t_buf_add(&dur->out, (const char *)&val, sizeof(val));
+}
+
+static int t_dur_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int ret = memcmp(a, b, a_len < b_len ? a_len : b_len);
+	return ret ? ret : (a_len > b_len) - (a_len < b_len);
+}
+
+// Index of the first entry not before path
+static unsigned int t_dur_lower(const tdur_t *dur, const char *path, size_t path_len)
+{
+	unsigned int l = 0;
+	unsigned int r = dur->cnt;
+	while (l < r) {
+		unsigned int m = l + (r - l) / 2;
+		if (t_dur_cmp(dur->strs + dur->ents[m].off, dur->ents[m].len, path, path_len) < 0) {
+			l = m + 1;
+		} else {
+			r = m;
+		}
+	}
+	return l;
+}
+
+static int t_dur_find(const tdur_t *dur, const char *path, size_t path_len)
+{
+	unsigned int i = t_dur_lower(dur, path, path_len);
+	return i < dur->cnt && t_dur_cmp(dur->strs + dur->ents[i].off, dur->ents[i].len, path, path_len) == 0 ? (int)i : -1;
+}
+
+// Total duration of the test at path and the tests under it, 0 without history
+static unsigned long long t_dur_sum(const tdur_t *dur, const char *path, size_t path_len)
+{
+	unsigned long long sum = 0;
+	for (unsigned int i = t_dur_lower(dur, path, path_len); i < dur->cnt; i++) {
+		const tdur_ent_t *ent = &dur->ents[i];
+		const char *str	      = dur->strs + ent->off;
+		if (ent->len < path_len || memcmp(str, path, path_len)) {
+			break;
+		}
+		if (ent->len == path_len || str[path_len] == '/') {
+			sum += ent->val;
+		}
+	}
+	return sum;
+}
+
+static void t_dur_free(tdur_t *dur)
+{
+	if (dur == NULL) {
+		return;
+	}
+
+	free(dur->data);
+	free(dur->shards);
+	t_guard_free(dur->out.data);
+	free(dur);
+}
+
+// A missing or unreadable file starts an empty history, with latest a new value replaces the old one instead of being averaged
+static tdur_t *t_dur_load(const char *path, const char *magic, int latest)
+{
+	tdur_t *dur = calloc(1, sizeof(*dur));
+	if (dur == NULL) {
+		return NULL;
+	}
+	dur->file   = path;
+	dur->magic  = magic;
+	dur->latest = latest;
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return dur;
+	}
+
+	long size = fseek(file, 0, SEEK_END) ? -1 : ftell(file);
+	if (size < 0 || fseek(file, 0, SEEK_SET)) {
+		fclose(file);
+		return dur;
+	}
+
+	char *data = malloc((size_t)size + 1);
+	size_t len = data ? fread(data, 1, (size_t)size, file) : 0;
+	fclose(file);
+
+	unsigned int cnt = 0;
+	size_t magic_len = t_strlen(magic);
+	size_t off	 = magic_len + sizeof(cnt);
+	if (data == NULL || len != (size_t)size || len < off || memcmp(data, magic, magic_len)) {
+		free(data);
+		return dur;
+	}
+
+	memcpy(&cnt, data + magic_len, sizeof(cnt));
+	if (cnt > (len - off) / sizeof(tdur_ent_t)) {
+		free(data);
+		return dur;
+	}
+
+	const tdur_ent_t *ents = (const tdur_ent_t *)(data + off);
+	const char *strs       = data + off + cnt * sizeof(tdur_ent_t);
+	size_t strs_len	       = len - off - cnt * sizeof(tdur_ent_t);
+	for (unsigned int i = 0; i < cnt; i++) {
+		if (ents[i].off > strs_len || ents[i].len > strs_len - ents[i].off ||
+		    (i > 0 && t_dur_cmp(strs + ents[i - 1].off, ents[i - 1].len, strs + ents[i].off, ents[i].len) >= 0)) {
+			free(data);
+			return dur;
+		}
+	}
+
+	dur->data = data;
+	dur->ents = ents;
+	dur->strs = strs;
+	dur->cnt  = cnt;
+	return dur;
+}
+
+typedef struct tdur_rec_s {
+	const char *path;
+	unsigned int len;
+	unsigned int seq;
+	unsigned long long val;
+} tdur_rec_t;
+
+static int t_dur_rec_cmp(const void *a, const void *b)
+{
+	const tdur_rec_t *x = a;
+	const tdur_rec_t *y = b;
+
+	int ret = t_dur_cmp(x->path, x->len, y->path, y->len);
+	return ret ? ret : (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+// Merges the results of this run into the history, each new result is averaged with what was known before or replaces it.
+// The file is written next to the old one and renamed over it, so a reader never sees a partial file
+static int t_dur_save(tdur_t *dur)
+{
+	size_t cnt = dur->cnt;
+	for (size_t off = 0; off + sizeof(unsigned int) <= dur->out.len; cnt++) {
+		unsigned int len;
+		memcpy(&len, dur->out.data + off, sizeof(len));
+		off += sizeof(len) + len + sizeof(unsigned long long);
+	}
+
+	tdur_rec_t *recs = malloc((cnt > 0 ? cnt : 1) * sizeof(*recs));
+	if (recs == NULL) {
+		return 1;
+	}
+
+	size_t num = 0;
+	for (; num < dur->cnt; num++) {
+		recs[num] = (tdur_rec_t){dur->strs + dur->ents[num].off, dur->ents[num].len, (unsigned int)num, dur->ents[num].val};
+	}
+	for (size_t off = 0; num < cnt; num++) {
+		tdur_rec_t *rec = &recs[num];
+		memcpy(&rec->len, dur->out.data + off, sizeof(rec->len));
+		off += sizeof(rec->len);
+		rec->path = dur->out.data + off;
+		off += rec->len;
+		memcpy(&rec->val, dur->out.data + off, sizeof(rec->val));
+		off += sizeof(rec->val);
+		rec->seq = (unsigned int)num;
+	}
+
+	qsort(recs, cnt, sizeof(*recs), t_dur_rec_cmp);
+
+	// Entries of one path are next to each other, oldest first
+	size_t uniq = 0;
+	for (size_t i = 0; i < cnt; i++) {
+		if (uniq > 0 && t_dur_cmp(recs[uniq - 1].path, recs[uniq - 1].len, recs[i].path, recs[i].len) == 0) {
+			recs[uniq - 1].val = dur->latest ? recs[i].val : (recs[uniq - 1].val + recs[i].val) / 2;
+			recs[uniq - 1].seq = recs[i].seq;
+			continue;
+		}
+		recs[uniq++] = recs[i];
+	}
+
+	// An old entry with results of this run under it, e.g. of a unit that crashed last time, is replaced by them
+	if (dur->latest) {
+		size_t kept = 0;
+		for (size_t i = 0; i < uniq; i++) {
+			int newer = 0;
+			for (size_t j = i + 1; recs[i].seq < dur->cnt && j < uniq && !newer; j++) {
+				if (recs[j].len < recs[i].len || memcmp(recs[j].path, recs[i].path, recs[i].len)) {
+					break;
+				}
+				newer = recs[j].len > recs[i].len && recs[j].path[recs[i].len] == '/' && recs[j].seq >= dur->cnt;
+			}
+			if (!newer) {
+				recs[kept++] = recs[i];
+			}
+		}
+		uniq = kept;
+	}
+
+	size_t file_len = t_strlen(dur->file);
+	char *tmp	= malloc(file_len + sizeof(".tmp"));
+	if (tmp == NULL) {
+		free(recs);
+		return 1;
+	}
+	memcpy(tmp, dur->file, file_len);
+	memcpy(tmp + file_len, ".tmp", sizeof(".tmp"));
+
+	FILE *file = fopen(tmp, "wb");
+	int err	   = file == NULL;
+
+	unsigned int num_ents = (unsigned int)uniq;
+	if (file) {
+		err |= fwrite(dur->magic, 1, t_strlen(dur->magic), file) != t_strlen(dur->magic);
+		err |= fwrite(&num_ents, sizeof(num_ents), 1, file) != 1;
+
+		unsigned int off = 0;
+		for (size_t i = 0; i < uniq && !err; i++) {
+			tdur_ent_t ent = {.off = off, .len = recs[i].len, .val = recs[i].val};
+			err |= fwrite(&ent, sizeof(ent), 1, file) != 1;
+			off += recs[i].len;
+		}
+		for (size_t i = 0; i < uniq && !err; i++) {
+			err |= recs[i].len > 0 && fwrite(recs[i].path, 1, recs[i].len, file) != recs[i].len;
+		}
+
+		err |= fclose(file) != 0;
+	}
+
+#if defined(C_WIN)
+	// Windows does not rename over an existing file
+	if (!err) {
+		remove(dur->file);
+	}
+#endif
+	if (!err && rename(tmp, dur->file)) {
+		err = 1;
+	}
+	if (err && file) {
+		remove(tmp);
+	}
+
+	free(tmp);
+	free(recs);
+	return err;
+}
+
+typedef struct tdur_bin_s {
+	unsigned long long ns;
+	unsigned int index;
+} tdur_bin_t;
+
+static int t_dur_bin_cmp(const void *a, const void *b)
+{
+	const tdur_bin_t *x = a;
+	const tdur_bin_t *y = b;
+
+	if (x->ns != y->ns) {
+		return x->ns < y->ns ? 1 : -1;
+	}
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+// Assigns the tests with history to shards longest first, each to the shard with the least work so far.
+// Every machine computes the same split from the same file
+static void t_dur_shards(tdur_t *dur, int count)
+{
+	tdur_bin_t *bins	  = malloc((dur->cnt > 0 ? dur->cnt : 1) * sizeof(*bins));
+	unsigned long long *loads = calloc((size_t)count, sizeof(*loads));
+	dur->shards		  = malloc((dur->cnt > 0 ? dur->cnt : 1) * sizeof(*dur->shards));
+	if (bins == NULL || loads == NULL || dur->shards == NULL) {
+		free(bins);
+		free(loads);
+		free(dur->shards);
+		dur->shards = NULL;
+		return;
+	}
+
+	for (unsigned int i = 0; i < dur->cnt; i++) {
+		bins[i] = (tdur_bin_t){.ns = dur->ents[i].val, .index = i};
+	}
+	qsort(bins, dur->cnt, sizeof(*bins), t_dur_bin_cmp);
+
+	for (unsigned int i = 0; i < dur->cnt; i++) {
+		int min = 0;
+		for (int j = 1; j < count; j++) {
+			if (loads[j] < loads[min]) {
+				min = j;
+			}
+		}
+		loads[min] += bins[i].ns;
+		dur->shards[bins[i].index] = min;
+	}
+
+	free(bins);
+	free(loads);
+}
+
+static void t_rec(const trec_t *rec, const char *path, const char *samples)
+{
+	if (s_data.journal.file && !rec->nested) {
+		t_dur_add(s_data.journal.file, path, (size_t)rec->path_len, rec->failed != 0);
+	}
+
+	if (rec->partial) {
+		return;
+	}
+
+	t_slow_add(rec->took, path, (size_t)rec->path_len);
+
+	if (s_data.dur) {
+		t_dur_add(s_data.dur, path, (size_t)rec->path_len, rec->took.wall);
+	}
+
+	if (rec->samples > 0 && s_data.base && s_data.base->save) {
+		t_base_add(s_data.base, path, (size_t)rec->path_len, samples, rec->samples);
+	}
+}
+
+// Whether t_end produces records: for the slowest table, for saving benchmark results, for the durations file and the journal
+static int t_rec_on(void)
+{
+	return s_data.time || (s_data.base && s_data.base->save) || s_data.dur || s_data.journal.file;
+}
+
+// Workers queue records for the parent, everyone else applies them directly
+static void t_rec_add(trec_t rec, const char *path, const double *samples)
+{
+	rec.path_len = (int)t_strlen(path);
+
+	if (s_data.recs == NULL) {
+		t_rec(&rec, path, (const char *)samples);
+		return;
+	}
+
+	t_buf_add(s_data.recs, (const char *)&rec, sizeof(rec));
+	t_buf_add(s_data.recs, path, (size_t)rec.path_len);
+	if (rec.samples > 0) {
+		t_buf_add(s_data.recs, (const char *)samples, (size_t)rec.samples * sizeof(double));
+	}
+}
+
+static void t_rec_parse(const char *data, size_t len)
+{
+	size_t off = 0;
+	while (off + sizeof(trec_t) <= len) {
+		trec_t rec;
+		memcpy(&rec, data + off, sizeof(rec));
+		off += sizeof(rec);
+
+		size_t size = (size_t)rec.samples * sizeof(double);
+		if (rec.path_len < 0 || rec.samples < 0 || off + (size_t)rec.path_len + size > len) {
+			break;
+		}
+
+		t_rec(&rec, data + off, data + off + rec.path_len);
+		off += (size_t)rec.path_len + size;
+	}
+}
+
+static int t_cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static double t_sqrt(double x)
+{
+	if (x <= 0) {
+		return 0;
+	}
+
+	double r = x < 1 ? 1 : x;
+	for (int i = 0; i < 64; i++) {
+		double n = (r + x / r) / 2;
+		if (n >= r) {
+			break;
+		}
+		r = n;
+	}
+	return r;
+}
+
+static double t_median(const double *sorted, int cnt)
+{
+	return cnt % 2 ? sorted[cnt / 2] : (sorted[cnt / 2 - 1] + sorted[cnt / 2]) / 2;
+}
+
+static int t_base_cmp(const void *a, const void *b)
+{
+	const tbase_ent_t *x = a;
+	const tbase_ent_t *y = b;
+
+	size_t len = x->path_len < y->path_len ? x->path_len : y->path_len;
+	int ret	   = memcmp(x->path, y->path, len);
+	return ret ? ret : (x->path_len > y->path_len) - (x->path_len < y->path_len);
+}
+
+static void t_base_free(tbase_t *base)
+{
+	if (base == NULL) {
+		return;
+	}
+
+	for (int i = 0; i < base->ents_cnt; i++) {
+		free(base->ents[i].samples);
+	}
+
+	free(base->ents);
+	free(base->data);
+	t_guard_free(base->out.data);
+	free(base);
+}
+
+static int t_base_load(tbase_t *base, const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return 1;
+	}
+
+	long size = fseek(file, 0, SEEK_END) ? -1 : ftell(file);
+	if (size < 0 || fseek(file, 0, SEEK_SET)) {
+		fclose(file);
+		return 1;
+	}
+
+	char *data = malloc((size_t)size + 1);
+	size_t len = data ? fread(data, 1, (size_t)size, file) : 0;
+	fclose(file);
+
+	unsigned int cnt = 0;
+	size_t off	 = sizeof(T_BENCH_MAGIC) - 1 + sizeof(cnt);
+	if (data == NULL || len != (size_t)size || len < off || memcmp(data, T_BENCH_MAGIC, sizeof(T_BENCH_MAGIC) - 1)) {
+		free(data);
+		return 1;
+	}
+
+	memcpy(&cnt, data + sizeof(T_BENCH_MAGIC) - 1, sizeof(cnt));
+
+	base->data = data;
+	base->ents = cnt > 0 && cnt <= len ? calloc(cnt, sizeof(*base->ents)) : NULL;
+
+	for (unsigned int i = 0; base->ents && i < cnt; i++) {
+		unsigned int path_len, num;
+		if (off + sizeof(path_len) > len) {
+			return 1;
+		}
+		memcpy(&path_len, data + off, sizeof(path_len));
+		off += sizeof(path_len);
+
+		if (path_len > len - off) {
+			return 1;
+		}
+
+		const char *ent_path = data + off;
+		off += path_len;
+
+		if (off + sizeof(num) > len) {
+			return 1;
+		}
+		memcpy(&num, data + off, sizeof(num));
+		off += sizeof(num);
+
+		if (num == 0 || num > (len - off) / sizeof(double)) {
+			return 1;
+		}
+
+		tbase_ent_t *ent = &base->ents[base->ents_cnt];
+		ent->samples	 = malloc(num * sizeof(double));
+		if (ent->samples == NULL) {
+			return 1;
+		}
+
+		memcpy(ent->samples, data + off, num * sizeof(double));
+		off += num * sizeof(double);
+
+		ent->path     = ent_path;
+		ent->path_len = path_len;
+		ent->cnt      = (int)num;
+		qsort(ent->samples, num, sizeof(double), t_cmp_double);
+		base->ents_cnt++;
+	}
+
+	qsort(base->ents, (size_t)base->ents_cnt, sizeof(*base->ents), t_base_cmp);
+	return cnt > 0 && base->ents == NULL;
+}
+
+static int t_base_save(tbase_t *base)
+{
+	FILE *file = fopen(base->save, "wb");
+	if (file == NULL) {
+		return 1;
+	}
+
+	int err = fwrite(T_BENCH_MAGIC, 1, sizeof(T_BENCH_MAGIC) - 1, file) != sizeof(T_BENCH_MAGIC) - 1 ||
+		  fwrite(&base->out_cnt, sizeof(base->out_cnt), 1, file) != 1 ||
+		  (base->out.len > 0 && fwrite(base->out.data, 1, base->out.len, file) != base->out.len);
+
+	return fclose(file) || err;
+}
+
+static const tbase_ent_t *t_base_find(const tbase_t *base, const char *path, size_t path_len)
+{
+	if (base == NULL || base->ents_cnt == 0) {
+		return NULL;
+	}
+
+	tbase_ent_t key = {.path = path, .path_len = path_len};
+	return bsearch(&key, base->ents, (size_t)base->ents_cnt, sizeof(*base->ents), t_base_cmp);
+}
+
+// One-sided Mann-Whitney U test on sorted samples, a positive z means cur tends to be larger than base
+static double t_mann_whitney(const double *cur, int n1, const double *base, int n2)
+{
+	double ranks = 0;
+	double rank  = 1;
+
+	for (int i = 0, j = 0; i < n1 || j < n2;) {
+		double val = j >= n2 || (i < n1 && cur[i] < base[j]) ? cur[i] : base[j];
+
+		int a = 0, b = 0;
+		for (; i < n1 && cur[i] == val; i++) {
+			a++;
+		}
+		for (; j < n2 && base[j] == val; j++) {
+			b++;
+		}
+
+		ranks += a * (rank + (double)(a + b - 1) / 2);
+		rank += a + b;
+	}
+
+	double u     = ranks - (double)n1 * (n1 + 1) / 2;
+	double mu    = (double)n1 * n2 / 2;
+	double sigma = t_sqrt((double)n1 * n2 * (n1 + n2 + 1) / 12);
+	return sigma > 0 ? (u - mu) / sigma : 0;
+}
+
+static const char *t_func_name(const char *func)
+{
+	if (t_starts_with(func, TEST_PREFIX)) {
+		return func + sizeof(TEST_PREFIX) - 1;
+	}
+	if (t_starts_with(func, BENCH_PREFIX)) {
+		return func + sizeof(BENCH_PREFIX) - 1;
+	}
+	return func;
+}
+
+static int t_arg_eq(const char *arg, const char *str)
+{
+	if (arg == NULL || str == NULL) {
+		return 0;
+	}
+
+	while (*arg && *str) {
+		if (*arg++ != *str++) {
+			return 0;
+		}
+	}
+
+	return *arg == *str;
+}
+
+static int t_node_child(const tnode_t *nodes, int node, char ch)
+{
+	for (int i = nodes[node].child; i >= 0; i = nodes[i].next) {
+		if (nodes[i].ch == ch) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void t_filter_compile(void)
+{
+	size_t size = 1;
+	for (int i = 0; i < s_data.filter_argc; i++) {
+		size += s_data.filter_argv[i] ? t_strlen(s_data.filter_argv[i]) : 0;
+	}
+
+	tnode_t *nodes = malloc(size * sizeof(*nodes));
+	int *next      = malloc((size_t)s_data.filter_argc * sizeof(*next));
+	if (nodes == NULL || next == NULL) {
+		free(nodes);
+		free(next);
+		return;
+	}
+
+	nodes[0] = (tnode_t){.child = -1, .next = -1, .filter = -1};
+	int cnt	 = 1;
+
+	for (int i = 0; i < s_data.filter_argc; i++) {
+		const char *filter = s_data.filter_argv[i];
+
+		next[i] = -1;
+		if (filter == NULL) {
+			continue;
+		}
+
+		int node = 0;
+		for (; *filter; filter++) {
+			int child = t_node_child(nodes, node, *filter);
+			if (child < 0) {
+				child	     = cnt++;
+				nodes[child] = (tnode_t){.ch = *filter, .child = -1, .next = nodes[node].child, .filter = -1};
+				nodes[node].child = child;
+			}
+			node = child;
+		}
+
+		next[i]		   = nodes[node].filter;
+		nodes[node].filter = i;
+	}
+
+	s_data.filter_nodes = nodes;
+	s_data.filter_next  = next;
+}
+
+// Takes over the filter array, it is freed by the next call
+static void t_filter(int argc, char **argv)
+{
+	if (s_data.filter_matched) {
+		free(s_data.filter_matched);
+	}
+
+	free(s_data.filter_argv);
+	free(s_data.filter_nodes);
+	free(s_data.filter_next);
+
+	s_data.filter_argc    = argc;
+	s_data.filter_argv    = argv;
+	s_data.filter_matched = NULL;
+	s_data.filter_run_all = 0;
+	s_data.filter_nodes   = NULL;
+	s_data.filter_next    = NULL;
+
+	if (argc > 0) {
+		s_data.filter_matched = calloc((size_t)argc, sizeof(*s_data.filter_matched));
+		t_filter_compile();
+	}
+}
+
+#if defined(T_REG_SECTION)
+	#if defined(_MSC_VER)
+		#pragma section("t_tests$a", read, write)
+		#pragma section("t_tests$c", read, write)
+__declspec(allocate("t_tests$a")) static const ttest_t *s_reg_begin[1];
+__declspec(allocate("t_tests$c")) static const ttest_t *s_reg_end[1];
+		#define T_REG_BEGIN (s_reg_begin + 1)
+		#define T_REG_END   s_reg_end
+	#else
+// Keeps the section defined when the program declares no tests
+T_REG_SECTION T_REG_USED static const ttest_t *s_reg_none;
+		#if defined(__APPLE__)
+extern const ttest_t *s_reg_begin[] __asm("section$start$__DATA$t_tests");
+extern const ttest_t *s_reg_end[] __asm("section$end$__DATA$t_tests");
+			#define T_REG_BEGIN s_reg_begin
+			#define T_REG_END   s_reg_end
+		#else
+extern const ttest_t *__start_t_tests[];
+extern const ttest_t *__stop_t_tests[];
+			#define T_REG_BEGIN __start_t_tests
+			#define T_REG_END   __stop_t_tests
+		#endif
+	#endif
+#endif
+
+typedef struct treg_s {
+	int sorted;
+	size_t cnt;
+	const ttest_t **ents;
+} treg_t;
+
+static treg_t s_reg;
+
+static int t_reg_name_cmp(const char *l, const char *r)
+{
+	while (*l && *l == *r) {
+		l++;
+		r++;
+	}
+	return (unsigned char)*l - (unsigned char)*r;
+}
+
+static int t_reg_cmp(const void *a, const void *b)
+{
+	const ttest_t *l = *(const ttest_t *const *)a;
+	const ttest_t *r = *(const ttest_t *const *)b;
+	if (l == NULL || r == NULL) {
+		return (l == NULL) - (r == NULL);
+	}
+	return t_reg_name_cmp(l->name, r->name);
+}
+
+// Sorts the section in place once, padding sorts last and subtests declared in several files are kept once
+static void t_reg_init(void)
+{
+	if (s_reg.sorted) {
+		return;
+	}
+	s_reg.sorted = 1;
+
+#if defined(T_REG_SECTION)
+	const ttest_t **ents = T_REG_BEGIN;
+	size_t size	     = (size_t)(T_REG_END - T_REG_BEGIN);
+	qsort((void *)ents, size, sizeof(*ents), t_reg_cmp);
+
+	size_t cnt = 0;
+	for (size_t i = 0; i < size && ents[i]; i++) {
+		size_t j = cnt;
+		while (j > 0 && t_reg_name_cmp(ents[j - 1]->name, ents[i]->name) == 0 && ents[j - 1]->fn != ents[i]->fn) {
+			j--;
+		}
+		if (j == 0 || t_reg_name_cmp(ents[j - 1]->name, ents[i]->name) != 0) {
+			ents[cnt++] = ents[i];
+		}
+	}
+	for (size_t i = cnt; i < size; i++) {
+		ents[i] = NULL;
+	}
+
+	s_reg.ents = ents;
+	s_reg.cnt  = cnt;
+#endif
+}
+
+size_t t_test_count(void)
+{
+	t_reg_init();
+	return s_reg.cnt;
+}
+
+const ttest_t *t_test_get(size_t index)
+{
+	t_reg_init();
+	return index < s_reg.cnt ? s_reg.ents[index] : NULL;
+}
+
+const ttest_t *t_test_find(const char *name)
+{
+	if (name == NULL) {
+		return NULL;
+	}
+
+	t_reg_init();
+	size_t l = 0;
+	size_t r = s_reg.cnt;
+	while (l < r) {
+		size_t m = l + (r - l) / 2;
+		if (t_reg_name_cmp(s_reg.ents[m]->name, name) < 0) {
+			l = m + 1;
+		} else {
+			r = m;
+		}
+	}
+
+	return l < s_reg.cnt && t_reg_name_cmp(s_reg.ents[l]->name, name) == 0 ? s_reg.ents[l] : NULL;
+}
+
+static dst_t t_help_dst(void)
+{
+	if (s_data.dst.off == T_BUFFER) {
+		return s_data.sink;
+	}
+	return s_data.dst.putv ? s_data.dst : DST_STD();
+}
+
+static const char *t_arg_val(int argc, char **argv, int *i, const char *opt)
+{
+	const char *arg = argv[*i];
+	if (arg == NULL || !t_starts_with(arg, opt)) {
+		return NULL;
+	}
+
+	const char *val = arg + t_strlen(opt);
+	if (*val == '\0') {
+		if (*i + 1 >= argc || argv[*i + 1] == NULL) {
+			return "";
+		}
+		return argv[++*i];
+	}
+
+	if (*val == '=') {
+		return val + 1;
+	}
+
+	return opt[1] == '-' ? NULL : val;
+}
+
+static int t_arg_pct(const char *val, double *pct)
+{
+	char *end;
+	double res = strtod(val, &end);
+	if (end == val || res < 0 || (*end != '\0' && !(end[0] == '%' && end[1] == '\0'))) {
+		return 1;
+	}
+
+	*pct = res;
+	return 0;
+}
+
+static int t_arg_num(const char *val, int *num)
+{
+	if (*val == '\0') {
+		return 1;
+	}
+
+	int res = 0;
+	for (; *val; val++) {
+		if (*val < '0' || *val > '9' || res > (INT_MAX - 9) / 10) {
+			return 1;
+		}
+		res = res * 10 + (*val - '0');
+	}
+
+	*num = res;
+	return 0;
+}
+
+static int t_arg_u64(const char *val, unsigned long long *num)
+{
+	if (*val == '\0') {
+		return 1;
+	}
+
+	unsigned long long res = 0;
+	for (; *val; val++) {
+		if (*val < '0' || *val > '9' || res > (ULLONG_MAX - 9) / 10) {
+			return 1;
+		}
+		res = res * 10 + (unsigned long long)(*val - '0');
+	}
+
+	*num = res;
+	return 0;
+}
+
+static int t_arg_shard(const char *val, int *index, int *count)
+{
+	char buf[16];
+	size_t len = 0;
+	for (; val[len] && val[len] != '/' && len + 1 < sizeof(buf); len++) {
+		buf[len] = val[len];
+	}
+	buf[len] = '\0';
+
+	if (val[len] != '/' || t_arg_num(buf, index) || t_arg_num(val + len + 1, count) || *index < 1 || *index > *count) {
+		return 1;
+	}
+
+	return 0;
+}
+
+int t_init(int argc, char **argv)
+{
+	const char *program = argc > 0 && argv[0] ? argv[0] : "test";
+
+	for (int i = 1; i < argc; i++) {
+		if (t_arg_eq(argv[i], "-h") || t_arg_eq(argv[i], "--help")) {
+			dputf(t_help_dst(),
+			      "Usage: %s [options] [filter...]\n"
+			      "\n"
+			      "Options:\n"
+			      "  -h, --help            Print this help message.\n"
+			      "  -j, --jobs N          Run top-level tests in N worker processes.\n"
+			      "  --threads N           Run top-level tests on N worker threads.\n"
+			      "  -t, --time            Print test durations and the slowest tests.\n"
+			      "  --slowest N           List the N slowest tests (default 10).\n"
+			      "  --bench               Measure benchmarks, otherwise they run once.\n"
+			      "  --bench-save FILE     Save benchmark results to FILE.\n"
+			      "  --bench-compare FILE  Fail benchmarks that are slower than in FILE.\n"
+			      "  --max-regress N%%      Allowed median slowdown (default 5%%).\n"
+			      "  --async-output        Write output from a background thread.\n"
+#if defined(T_ALLOC_HOOK)
+			      "  --allocs              Print allocation counts of each test and suite.\n"
+			      "  --leaks               Show where memory leaked by a test was allocated.\n"
+			      "  --leak-trace          Like --leaks, with a short backtrace of each site.\n"
+#endif
+			      "  --timeout N           Fail a test that runs longer than N seconds.\n"
+			      "  --isolate             Run each test in its own process, crashes fail only that test.\n"
+			      "  --list                Print the names of the declared tests without running them.\n"
+			      "  --shard I/N           Run only shard I of N, tests are assigned by a hash of their path.\n"
+			      "  --durations FILE      Keep test durations in FILE to run long tests first and balance shards.\n"
+			      "  --journal FILE        Keep the result of each test in FILE.\n"
+			      "  --failed-first        Run the tests that failed last time first, stop if one still fails.\n"
+			      "  --failed-only         Run only the tests that failed last time.\n"
+			      "  --seed N              Draw the values of the first case of each property from seed N.\n"
+			      "  --cases N             Check N cases of each property (default 100).\n"
+			      "  --corpus DIR          Keep the inputs of each fuzz target in DIR/NAME (default corpus).\n"
+			      "  --fuzz N              Fuzz each selected target for N seconds instead of replaying its corpus.\n"
+			      "  --repeat N            Run the selected tests N times in this process, print only the first failing run.\n"
+			      "  --until-fail          Repeat the selected tests until a run fails, at most N times with --repeat.\n"
+			      "\n"
+			      "Filters:\n"
+			      "  Each filter selects tests or suites by name prefix.\n"
+			      "  Selecting a suite runs all tests under that suite.\n",
+			      program);
+
+			return 1;
+		}
+	}
+
+	int jobs	= 1;
+	int threads	= 0;
+	int time	= 0;
+	int slowest	= T_SLOWEST;
+	int bench	= 0;
+	double regress	= 5;
+	const char *save    = NULL;
+	const char *compare = NULL;
+	int async	    = 0;
+	int allocs	    = 0;
+	int leaks	    = 0;
+	int timeout	    = 0;
+	int isolate	    = 0;
+	int list	    = 0;
+	int shard	    = 1;
+	int shards	    = 1;
+	const char *durs    = NULL;
+	const char *journal = NULL;
+	int journal_run	    = T_JOURNAL_ALL;
+	int first	    = 0;
+	unsigned long long seed = 0;
+	int seeded		= 0;
+	int cases		= T_PROP_CASES;
+	const char *corpus	= T_FUZZ_CORPUS;
+	int fuzz		= 0;
+	int repeat		= 0;
+	int until_fail		= 0;
+	// The filters are collected apart from argv, which stays as the caller passed it
+	char **filters	= argc > 1 ? malloc((size_t)(argc - 1) * sizeof(*filters)) : NULL;
+	int filter_argc = 0;
+	int err		= argc > 1 && filters == NULL;
+
+	for (int i = 1; i < argc && !err; i++) {
+		const char *arg = argv[i];
+		const char *val;
+
+		if ((val = t_arg_val(argc, argv, &i, "-j")) || (val = t_arg_val(argc, argv, &i, "--jobs"))) {
+			if (t_arg_num(val, &jobs) || jobs < 1) {
+				dputf(t_help_dst(), "%s: invalid value '%s' for '%s'\n", program, val, arg);
+				err = 1;
+			}
+			threads = 0;
+		} else if ((val = t_arg_val(argc, argv, &i, "--threads"))) {
+			if (t_arg_num(val, &jobs) || jobs < 1) {
+				dputf(t_help_dst(), "%s: invalid value '%s' for '%s'\n", program, val, arg);
+				err = 1;
+			}
+			threads = 1;
+		} else if (t_arg_eq(arg, "-t") || t_arg_eq(arg, "--time")) {
+			time = 1;
+		} else if ((val = t_arg_val(argc, argv, &i, "--slowest"))) {
+			if (t_arg_num(val, &slowest)) {
+				dputf(t_help_dst(), "%s: invalid value '%s' for '%s'\n", program, val, arg);
+				err = 1;
+			}
+			time = 1;
+		} else if (t_arg_eq(arg, "--bench")) {
+			bench = 1;
+		} else if ((val = t_arg_val(argc, argv, &i, "--bench-save"))) {
+			save  = val;
+			bench = 1;
+		} else if ((val = t_arg_val(argc, argv, &i, "--bench-compare"))) {
+			compare = val;
+			bench	= 1;
+		} else if ((val = t_arg_val(argc, argv, &i, "--max-regress"))) {
+			if (t_arg_pct(val, &regress)) {
+				dputf(t_help_dst(), "%s: invalid value '%s' for '%s'\n", program, val, arg);
+				err = 1;
+			}
+		} else if (t_arg_eq(arg, "--async-output")) {
+			async = 1;
+		} else if (t_arg_eq(arg, "--allocs")) {
+#if !defined(T_ALLOC_HOOK)
+			dputf(t_help_dst(), "%s: '%s' needs a glibc build with T_ALLOC_HOOK and no sanitizer\n", program, arg);
+			err = 1;
+#endif
+			allocs = 1;
+		} else if (t_arg_eq(arg, "--leaks") || t_arg_eq(arg, "--leak-trace")) {
+#if !defined(T_ALLOC_HOOK)
+			dputf(t_help_dst(), "%s: '%s' needs a glibc build with T_ALLOC_HOOK and no sanitizer\n", program, arg);
+			err = 1;
+#endif
+			leaks = t_arg_eq(arg, "--leaks") && leaks != 2 ? 1 : 2;
+		} else if (t_arg_eq(arg, "--isolate")) {
+#if defined(C_WIN)
+			dputf(t_help_dst(), "%s: '%s' is not supported on this platform\n", program, arg);
+			err = 1;
+#endif
+			isolate = 1;
+		} else if (t_arg_eq(arg, "--list")) {
+			list = 1;
+		} else if ((val = t_arg_val(argc, argv, &i, "--durations"))) {
+			durs = val;
+		} else if ((val = t_arg_val(argc, argv, &i, "--journal"))) {
+			journal = val;
+		} else if (t_arg_eq(arg, "--failed-first")) {
+			journal_run = T_JOURNAL_ALL;
+			first	    = 1;
+		} else if (t_arg_eq(arg, "--failed-only")) {
+			journal_run = T_JOURNAL_FAILED;
+			first	    = 0;
+		} else if ((val = t_arg_val(argc, argv, &i, "--shard"))) {
+			if (t_arg_shard(val, &shard, &shards)) {
+				dputf(t_help_dst(), "%s: invalid value '%s' for '%s'\n", program, val, arg);
+				err = 1;
+			}
+		} else if ((val = t_arg_val(argc, argv, &i, "--seed"))) {
+			if (t_arg_u64(val, &seed)) {
+				dputf(t_help_dst(), "%s: invalid value '%s' for '%s'\n", program, val, arg);
+				err = 1;
+			}
+			seeded = 1;
+		} else if ((val = t_arg_val(argc, argv, &i, "--cases"))) {
+			if (t_arg_num(val, &cases) || cases < 1) {
+				dputf(t_help_dst(), "%s: invalid value '%s' for '%s'\n", program, val, arg);
+				err = 1;
+			}
+		} else if ((val = t_arg_val(argc, argv, &i, "--corpus"))) {
+			corpus = val;
+		} else if ((val = t_arg_val(argc, argv, &i, "--fuzz"))) {
+#if defined(C_WIN)
+			dputf(t_help_dst(), "%s: '%s' is not supported on this platform\n", program, arg);
+			err = 1;
+#else
+			if (t_arg_num(val, &fuzz) || fuzz < 1) {
+				dputf(t_help_dst(), "%s: invalid value '%s' for '%s'\n", program, val, arg);
+				err = 1;
+			}
+#endif
+		} else if ((val = t_arg_val(argc, argv, &i, "--repeat"))) {
+			if (t_arg_num(val, &repeat) || repeat < 1) {
+				dputf(t_help_dst(), "%s: invalid value '%s' for '%s'\n", program, val, arg);
+				err = 1;
+			}
+		} else if (t_arg_eq(arg, "--until-fail")) {
+			until_fail = 1;
+		} else if ((val = t_arg_val(argc, argv, &i, "--timeout"))) {
+#if defined(C_WIN)
+			dputf(t_help_dst(), "%s: '%s' is not supported on this platform\n", program, arg);
+			err = 1;
+#else
+			if (t_arg_num(val, &timeout) || timeout > INT_MAX / 1000) {
+				dputf(t_help_dst(), "%s: invalid value '%s' for '%s'\n", program, val, arg);
+				err = 1;
+			}
+#endif
+		} else if (arg != NULL && arg[0] == '-') {
+			dputf(t_help_dst(), "%s: unknown option '%s'\n", program, arg);
+			err = 1;
+		} else {
+			filters[filter_argc++] = argv[i];
+		}
+	}
+
+	if (err) {
+		free(filters);
+		return -1;
+	}
+
+	if (filter_argc == 0) {
+		free(filters);
+		filters = NULL;
+	}
+
+	// Each run would start its own workers, repeating is only supported in one process
+	if ((repeat || until_fail) && jobs > 1) {
+		dputf(t_help_dst(),
+		      "%s: '%s' cannot be combined with '%s'\n",
+		      program,
+		      repeat ? "--repeat" : "--until-fail",
+		      threads ? "--threads" : "-j");
+		free(filters);
+		return -1;
+	}
+
+	if ((journal_run != T_JOURNAL_ALL || first) && journal == NULL) {
+		dputf(t_help_dst(), "%s: '%s' needs '--journal FILE'\n", program, first ? "--failed-first" : "--failed-only");
+		free(filters);
+		return -1;
+	}
+
+	if (threads && !leaks) {
+		// mem_stats counts the memory of all threads together, only the leak tables of --leaks are per thread
+#if defined(T_ALLOC_HOOK)
+		dputf(t_help_dst(),
+		      "%s: warning: leaks are not checked on worker threads without '--leaks', use '-j' to check them\n",
+		      program);
+#else
+		dputf(t_help_dst(),
+		      "%s: warning: leak checking is off on worker threads in this build, use '-j' to check leaks\n",
+		      program);
+#endif
+	}
+
+	if (list) {
+		dst_t dst = t_help_dst();
+		for (size_t i = 0; i < t_test_count(); i++) {
+			const char *name = t_test_get(i)->name;
+			int match	 = filter_argc == 0;
+			for (int j = 0; j < filter_argc && !match; j++) {
+				match = t_starts_with(name, filters[j]);
+			}
+			if (match) {
+				dst.off += dputf(dst, "%s\n", name);
+			}
+		}
+		free(filters);
+		return 1;
+	}
+
+	tbase_t *base = NULL;
+	if (save || compare) {
+		base = calloc(1, sizeof(*base));
+		if (base == NULL || (compare && t_base_load(base, compare))) {
+			dputf(t_help_dst(), "%s: cannot read baseline '%s'\n", program, compare);
+			t_base_free(base);
+			free(filters);
+			return -1;
+		}
+
+		base->save	  = save;
+		base->max_regress = regress / 100;
+	}
+
+	tdur_t *dur = durs ? t_dur_load(durs, T_DUR_MAGIC, 0) : NULL;
+	if (dur && shards > 1) {
+		t_dur_shards(dur, shards);
+	}
+
+	tdur_t *results = journal ? t_dur_load(journal, T_JOURNAL_MAGIC, 1) : NULL;
+
+	s_data.sink    = DST_STD();
+	s_data.dst     = DST_NONE();
+	s_data.dst.off = T_BUFFER;
+	s_data.wdst    = WDST_STD();
+	s_data.flush   = NULL;
+
+#if !defined(C_WIN)
+	if (async) {
+		t_flush_start();
+	}
+#else
+	(void)async;
+#endif
+
+	s_data.passed = 0;
+	s_data.failed = 0;
+	s_data.depth  = -1;
+
+	s_data.buf = (tarena_t){0};
+
+	s_data.work.jobs    = jobs;
+	s_data.work.threads = threads;
+
+	s_data.path[0]	    = '\0';
+	s_data.path_len	    = 0;
+	s_data.time	    = time;
+	s_data.time_slowest = slowest;
+	s_data.time_slow    = NULL;
+	s_data.bench.on	    = bench;
+	s_data.base	    = base;
+	s_data.alloc_on	    = allocs;
+	s_data.leaks	    = leaks;
+	s_data.leak_tab	    = NULL;
+	s_data.timeout	    = timeout * 1000;
+	s_data.isolate	    = isolate;
+	s_data.shard	    = (tshard_t){.index = shard - 1, .count = shards};
+	s_data.dur	    = dur;
+	s_data.journal	    = (tjournal_t){.file = results, .run = results ? journal_run : T_JOURNAL_ALL, .first = results && first};
+	s_data.prop	    = (tprop_t){.seed = seed, .seeded = seeded, .cases = cases};
+	s_data.fuzz	    = (tfuzz_t){.corpus = corpus, .secs = fuzz};
+	s_data.repeat	    = (trepeat_t){.count = repeat, .until_fail = until_fail};
+
+	if (time && slowest > 0) {
+		s_data.time_slow = calloc(1, sizeof(tslow_t) + (size_t)slowest * sizeof(tslow_ent_t));
+		if (s_data.time_slow) {
+			s_data.time_slow->size = slowest;
+		}
+	}
+
+	t_reg_init();
+
+	if (s_data.work.worker == 0) {
+		mem_stats_set(&s_data.mem_stats);
+#if !defined(C_WIN)
+		t_crash_init();
+#endif
+	}
+
+	if (argc > 0) {
+		t_filter(filter_argc, filters);
+	}
+
+	return 0;
+}
+
+int t_finish(void)
+{
+	for (int i = 0; i < s_data.filter_argc; i++) {
+		if (!s_data.filter_matched[i]) {
+			t_printf("\033[0;31mFAIL filter '%s' matched no tests\033[0m\n", s_data.filter_argv[i]);
+			s_data.failed++;
+		}
+	}
+
+	if (s_data.base && s_data.base->save && t_base_save(s_data.base)) {
+		t_printf("\033[0;31mFAIL cannot write baseline '%s'\033[0m\n", s_data.base->save);
+		s_data.failed++;
+	}
+
+	if (s_data.dur && t_dur_save(s_data.dur)) {
+		t_printf("\033[0;31mFAIL cannot write durations '%s'\033[0m\n", s_data.dur->file);
+		s_data.failed++;
+	}
+
+	if (s_data.journal.file && t_dur_save(s_data.journal.file)) {
+		t_printf("\033[0;31mFAIL cannot write journal '%s'\033[0m\n", s_data.journal.file->file);
+		s_data.failed++;
+	}
+
+	tslow_t *slow = s_data.time_slow;
+	if (slow && slow->cnt > 0) {
+		t_printf("SLOWEST %d %s\n", slow->cnt, slow->cnt == 1 ? "TEST" : "TESTS");
+		for (int i = 0; i < slow->cnt; i++) {
+			char wall[32], cpu[32];
+			i + 1 < slow->cnt ? pvr() : pur();
+			t_printf("%9s wall %9s cpu  %s\n",
+				 t_fmt_ns(wall, sizeof(wall), (double)slow->ents[i].took.wall),
+				 t_fmt_ns(cpu, sizeof(cpu), (double)slow->ents[i].took.cpu),
+				 slow->ents[i].path);
+		}
+	}
+
+	if (s_data.failed == 0) {
+		t_printf("\033[0;32mPASS %llu %s\033[0m\n", s_data.passed, s_data.passed == 1 ? "TEST" : "TESTS");
+	} else {
+		t_printf("\033[0;31mFAIL %llu/%llu %s\033[0m\n",
+			 s_data.failed,
+			 s_data.failed + s_data.passed,
+			 s_data.failed == 1 ? "TEST" : "TESTS");
+	}
+
+	free(s_data.time_slow);
+	s_data.time_slow = NULL;
+
+	t_base_free(s_data.base);
+	s_data.base = NULL;
+
+	t_dur_free(s_data.dur);
+	s_data.dur = NULL;
+
+	t_dur_free(s_data.journal.file);
+	s_data.journal = (tjournal_t){0};
+
+	if (s_data.dst.off == T_BUFFER) {
+		t_flush_stop();
+		t_guard_free(s_data.out.data);
+		s_data.out = (tbuf_t){0};
+	}
+
+	t_arena_free(&s_data.buf);
+	t_leak_free();
+	t_filter(0, NULL);
+
+	return (int)s_data.failed;
+}
+
+static void t_path_push(const char *name)
+{
+	if (name == NULL) {
+		return;
+	}
+
+	size_t len = s_data.path_len;
+	if (len > 0 && len + 1 < T_PATH_MAX) {
+		s_data.path[len++] = '/';
+	}
+
+	while (*name && len + 1 < T_PATH_MAX) {
+		s_data.path[len++] = *name++;
+	}
+
+	s_data.path[len] = '\0';
+	s_data.path_len	 = len;
+}
+
+// Whether the journal holds a failure of the test at path or of a test it is part of, with under also of a test under it
+static int t_journal_failed(const tdur_t *journal, const char *path, size_t len, int under)
+{
+	for (size_t i = 1; i <= len; i++) {
+		int ent = i == len || path[i] == '/' ? t_dur_find(journal, path, i) : -1;
+		if (ent >= 0 && journal->ents[ent].val) {
+			return 1;
+		}
+	}
+
+	for (unsigned int i = under ? t_dur_lower(journal, path, len) : journal->cnt; i < journal->cnt; i++) {
+		const tdur_ent_t *ent = &journal->ents[i];
+		const char *str	      = journal->strs + ent->off;
+		if (ent->len < len || memcmp(str, path, len)) {
+			break;
+		}
+		if (ent->val && ent->len > len && (len == 0 || str[len] == '/')) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Tests run from inside another test are not in the journal and always run
+static int t_journal_run(const char *name)
+{
+	if (s_data.journal.run == T_JOURNAL_ALL || s_data.tests > 0 || name == NULL) {
+		return 1;
+	}
+
+	size_t len = s_data.path_len;
+	t_path_push(name);
+	int failed = t_journal_failed(s_data.journal.file, s_data.path, s_data.path_len, s_data.journal.run == T_JOURNAL_FAILED);
+	s_data.path_len	 = len;
+	s_data.path[len] = '\0';
+
+	return s_data.journal.run == T_JOURNAL_FAILED ? failed : !failed;
+}
+
+// Whether tests can be left out of the suites they are in, by sharding or by the journal
+static int t_skip_on(void)
+{
+	return s_data.shard.count > 1 || s_data.journal.run != T_JOURNAL_ALL;
+}
+
+// Whether the filters select the test or a test under it, run_all is set when they select everything under it
+static int t_filter_match(const char *name, int *run_all)
+{
+	if (s_data.filter_argc == 0 || name == NULL) {
+		return 1;
+	}
+
+	if (s_data.filter_nodes == NULL) {
+		t_filter_compile();
+		if (s_data.filter_nodes == NULL) {
+			return 1;
+		}
+	}
+
+	const tnode_t *nodes = s_data.filter_nodes;
+
+	int run	 = s_data.filter_run_all;
+	int node = 0;
+
+	for (const char *ch = name;; ch++) {
+		if (nodes[node].filter >= 0) {
+			for (int i = nodes[node].filter; i >= 0; i = s_data.filter_next[i]) {
+				s_data.filter_matched[i] = 1;
+			}
+
+			if (t_node_child(nodes, node, '_') < 0) {
+				run	 = 1;
+				*run_all = 1;
+			} else if (*ch == '\0') {
+				run = 1;
+			}
+		}
+
+		if (*ch == '\0') {
+			run |= t_node_child(nodes, node, '_') >= 0;
+			break;
+		}
+
+		node = t_node_child(nodes, node, *ch);
+		if (node < 0) {
+			break;
+		}
+	}
+
+	return run;
+}
+
+static int t_should_run(const char *name, int *run_all)
+{
+	return t_filter_match(name, run_all) && t_journal_run(name);
+}
+
+#if !defined(C_WIN)
+
+typedef struct tunit_s {
+	int done;
+	int ret;
+	int status;
+	long long passed;
+	long long failed;
+	int drawn;
+	char *out;
+	size_t out_len;
+	char *recs;
+	size_t recs_len;
+	char *matched;
+} tunit_t;
+
+typedef struct tthread_s {
+	pthread_t id;
+	test_fn fn;
+	tdata_t data;
+} tthread_t;
+
+struct tpool_s {
+	tdata_t *main;
+	pthread_t main_id;
+	long long *next;
+	long long next_local;
+	int threads;
+	int fd;
+	int workers;
+	int live;
+	int *fds;
+	pid_t *pids;
+	int *running;
+	struct pollfd *pfds;
+	int *pidx;
+	tthread_t *thrds;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	tunit_t *units;
+	int units_size;
+	int discover;
+	tdur_bin_t *bins;
+	int *order;
+	int order_cnt;
+	int order_size;
+};
+
+static tunit_t *t_pool_unit(tpool_t *pool, int unit)
+{
+	if (unit >= pool->units_size) {
+		int size = pool->units_size == 0 ? 64 : pool->units_size;
+		while (size <= unit) {
+			size *= 2;
+		}
+
+		tunit_t *units = realloc(pool->units, (size_t)size * sizeof(*units));
+		if (units == NULL) {
+			return NULL;
+		}
+
+		memset(units + pool->units_size, 0, (size_t)(size - pool->units_size) * sizeof(*units));
+		pool->units	 = units;
+		pool->units_size = size;
+	}
+
+	return &pool->units[unit];
+}
+
+static void t_unit_claim(void)
+{
+	tpool_t *pool	  = s_data.pool;
+	long long next	  = __atomic_fetch_add(pool->next, 1, __ATOMIC_RELAXED);
+	s_data.work.claim = next < pool->order_cnt ? pool->order[next] : (int)next;
+}
+
+static void t_unit_start(int unit)
+{
+	if (!s_data.pool->threads) {
+		tmsg_t msg = {.start = 1, .unit = unit};
+		t_write_all(s_data.pool->fd, &msg, sizeof(msg));
+	}
+
+	s_data.passed  = 0;
+	s_data.failed  = 0;
+	s_data.out.len = 0;
+	s_data.dst     = DST_NONE();
+	s_data.dst.off = T_CAPTURE;
+
+	if (s_data.recs) {
+		s_data.recs->len = 0;
+	}
+}
+
+static void t_unit_post(tpool_t *pool)
+{
+	char *matched = s_data.filter_argc > 0 ? malloc((size_t)s_data.filter_argc) : NULL;
+	if (matched) {
+		memcpy(matched, s_data.filter_matched, (size_t)s_data.filter_argc);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+
+	tunit_t *unit = t_pool_unit(pool, s_data.work.claim);
+	if (unit != NULL) {
+		unit->done    = 1;
+		unit->ret     = s_data.failed > 0;
+		unit->passed  = s_data.passed;
+		unit->failed  = s_data.failed;
+		unit->out     = s_data.out.data;
+		unit->out_len = s_data.out.len;
+		unit->matched = matched;
+		s_data.out    = (tbuf_t){0};
+		if (s_data.recs) {
+			unit->recs     = s_data.recs->data;
+			unit->recs_len = s_data.recs->len;
+			*s_data.recs   = (tbuf_t){0};
+		}
+	} else {
+		free(matched);
+	}
+
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void t_unit_end(void)
+{
+	if (s_data.pool->threads) {
+		t_unit_post(s_data.pool);
+	} else {
+		t_unit_send(s_data.pool->fd, s_data.work.claim, 0);
+	}
+
+	s_data.dst = DST_NONE();
+	t_unit_claim();
+}
+
+// Reads what follows msg into unit
+static int t_unit_recv(int fd, const tmsg_t *msg, tunit_t *unit)
+{
+	char *out     = msg->out_len > 0 ? malloc(msg->out_len) : NULL;
+	char *recs    = msg->recs_len > 0 ? malloc(msg->recs_len) : NULL;
+	char *matched = s_data.filter_argc > 0 ? malloc((size_t)s_data.filter_argc) : NULL;
+
+	if ((msg->out_len > 0 && out == NULL) || (msg->recs_len > 0 && recs == NULL) || (s_data.filter_argc > 0 && matched == NULL) ||
+	    (out && t_read_all(fd, out, msg->out_len)) || (recs && t_read_all(fd, recs, msg->recs_len)) ||
+	    (matched && t_read_all(fd, matched, (size_t)s_data.filter_argc))) {
+		free(out);
+		free(recs);
+		free(matched);
+		return 1;
+	}
+
+	unit->done     = 1;
+	unit->ret      = msg->failed > 0;
+	unit->passed   = msg->passed;
+	unit->failed   = msg->failed;
+	unit->drawn    = msg->drawn;
+	unit->out      = out;
+	unit->out_len  = msg->out_len;
+	unit->recs     = recs;
+	unit->recs_len = msg->recs_len;
+	unit->matched  = matched;
+	return 0;
+}
+
+static void t_pool_recv(tpool_t *pool, int worker)
+{
+	int fd	   = pool->fds[worker];
+	tmsg_t msg = {0};
+
+	if (t_read_all(fd, &msg, sizeof(msg))) {
+		int status = 0;
+		close(fd);
+		waitpid(pool->pids[worker], &status, 0);
+		pool->fds[worker] = -1;
+		pool->live--;
+
+		tunit_t *unit = pool->running[worker] < 0 ? NULL : t_pool_unit(pool, pool->running[worker]);
+		if (unit != NULL && !unit->done) {
+			unit->done   = 1;
+			unit->ret    = 1;
+			unit->status = status == 0 ? -1 : status;
+			unit->passed = 0;
+			unit->failed = 1;
+		}
+		return;
+	}
+
+	if (msg.start) {
+		pool->running[worker] = msg.unit;
+		return;
+	}
+
+	pool->running[worker] = -1;
+
+	tunit_t *unit = t_pool_unit(pool, msg.unit);
+	if (unit != NULL) {
+		t_unit_recv(fd, &msg, unit);
+	}
+}
+
+static int t_pool_poll(tpool_t *pool)
+{
+	nfds_t cnt = 0;
+
+	for (int i = 0; i < pool->workers; i++) {
+		if (pool->fds[i] < 0) {
+			continue;
+		}
+		pool->pfds[cnt].fd	= pool->fds[i];
+		pool->pfds[cnt].events	= POLLIN;
+		pool->pfds[cnt].revents = 0;
+		pool->pidx[cnt++]	= i;
+	}
+
+	if (cnt == 0) {
+		return 1;
+	}
+
+	if (poll(pool->pfds, cnt, -1) < 0) {
+		return 0;
+	}
+
+	for (nfds_t i = 0; i < cnt; i++) {
+		if (pool->pfds[i].revents) {
+			t_pool_recv(pool, pool->pidx[i]);
+		}
+	}
+
+	return 0;
+}
+
+static int t_pool_take(tpool_t *pool, int index, tunit_t *res)
+{
+	tunit_t *unit;
+
+	if (pool->threads) {
+		pthread_mutex_lock(&pool->lock);
+		while ((unit = t_pool_unit(pool, index)) != NULL && !unit->done && pool->live > 0) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+	} else {
+		while ((unit = t_pool_unit(pool, index)) != NULL && !unit->done && !t_pool_poll(pool)) {
+		}
+	}
+
+	int done = unit != NULL && unit->done;
+	if (done) {
+		*res	      = *unit;
+		unit->out     = NULL;
+		unit->recs    = NULL;
+		unit->matched = NULL;
+	}
+
+	if (pool->threads) {
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return done;
+}
+
+static const char *t_sig_name(int sig)
+{
+	// clang-format off
+	switch (sig) {
+	case SIGSEGV: return "SIGSEGV";
+	case SIGBUS: return "SIGBUS";
+	case SIGFPE: return "SIGFPE";
+	case SIGILL: return "SIGILL";
+	case SIGABRT: return "SIGABRT";
+	case SIGKILL: return "SIGKILL";
+	case SIGTERM: return "SIGTERM";
+	case SIGPIPE: return "SIGPIPE";
+	case SIGALRM: return "SIGALRM";
+	default: return NULL;
+	}
+	// clang-format on
+}
+
+// Prints a unit collected from a worker or an isolated child and adds its results, returns the state for t_enter
+static int t_unit_show(tunit_t *unit, const char *name, const char *who)
+{
+	if (unit->out_len > 0) {
+		t_puts(unit->out, unit->out_len);
+	}
+
+	if (unit->status != 0) {
+		t_indent();
+		pvr();
+		t_printf("\033[0;31mFAIL %s\033[0m\n", name);
+
+		t_indent();
+		pv();
+		if (unit->status > 0 && WIFSIGNALED(unit->status)) {
+			const char *sig = t_sig_name(WTERMSIG(unit->status));
+			if (sig) {
+				t_printf("\033[0;31m%s terminated by %s\033[0m\n", who, sig);
+			} else {
+				t_printf("\033[0;31m%s terminated by signal %d\033[0m\n", who, WTERMSIG(unit->status));
+			}
+		} else {
+			t_printf("\033[0;31m%s exited with status %d\033[0m\n", who, unit->status > 0 ? WEXITSTATUS(unit->status) : -1);
+		}
+
+		if (s_data.journal.file) {
+			size_t len = s_data.path_len;
+			t_path_push(name);
+			t_rec_add((trec_t){.failed = 1, .nested = s_data.tests > 0, .partial = 1}, s_data.path, NULL);
+			s_data.path_len	 = len;
+			s_data.path[len] = '\0';
+		}
+	}
+
+	s_data.passed += unit->passed;
+	s_data.failed += unit->failed;
+	s_data.repeat.drawn |= unit->drawn;
+
+	for (int i = 0; unit->matched && i < s_data.filter_argc; i++) {
+		s_data.filter_matched[i] |= unit->matched[i];
+	}
+
+	// A worker running isolated nodes passes their records on to its parent
+	if (s_data.recs) {
+		t_buf_add(s_data.recs, unit->recs, unit->recs_len);
+	} else {
+		t_rec_parse(unit->recs, unit->recs_len);
+	}
+
+	free(unit->out);
+	free(unit->recs);
+	free(unit->matched);
+
+	// All tests of the unit were left out, otherwise it printed the headers of the suites it is in
+	if (t_skip_on() && unit->status == 0 && unit->out_len == 0 && unit->passed + unit->failed == 0) {
+		return -1;
+	}
+	if (s_data.shard.shown < s_data.depth + 1) {
+		s_data.shard.shown = s_data.depth + 1;
+	}
+
+	return unit->ret ? -3 : -2;
+}
+
+static int t_pool_wait(int index, const char *name)
+{
+	tunit_t unit;
+	if (!t_pool_take(s_data.pool, index, &unit)) {
+		return 0;
+	}
+
+	return t_unit_show(&unit, name, "worker");
+}
+
+// Per-thread watch of the running test, deadline is 0 while the thread is not in a test with a timeout
+typedef struct twatch_slot_s {
+	pthread_t id;
+	unsigned long long deadline;
+	unsigned long long limit;
+	int depth;
+	int fired;
+	int caught;
+	int linked;
+	unsigned gen;
+	const char *path;
+	tdata_t *data;
+	void *frames[T_WATCH_FRAMES + 2];
+	int frames_cnt;
+	struct twatch_slot_s *next;
+} twatch_slot_t;
+
+typedef struct twatch_s {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int on;
+	int stop;
+	int parked;
+	unsigned gen;
+	twatch_slot_t *slots;
+} twatch_t;
+
+static twatch_t s_watch = {.lock = PTHREAD_MUTEX_INITIALIZER};
+static T_TLS twatch_slot_t s_watch_slot;
+
+// Last resort for a test that is stuck where it cannot print, e.g. inside the allocator, only with async-signal-safe calls
+static void t_watch_lost(const twatch_slot_t *slot)
+{
+	t_crash_write("\033[0;31mFAIL ", sizeof("\033[0;31mFAIL ") - 1);
+	t_crash_write(slot->path, t_strlen(slot->path));
+	t_crash_write(" timed out\033[0m\n", sizeof(" timed out\033[0m\n") - 1);
+	_exit(1);
+}
+
+static void t_watch_abort(const twatch_slot_t *slot)
+{
+	fflush(stdout);
+	t_watch_lost(slot);
+}
+
+// Runs on the thread of the test that timed out, so the backtrace is of the stuck test. The thread then waits with its state
+// untouched while the watchdog thread reports, so only async-signal-safe calls are made here.
+static void t_watch_fire(int sig)
+{
+	(void)sig;
+
+	twatch_slot_t *slot = &s_watch_slot;
+	if (!__atomic_load_n(&slot->fired, __ATOMIC_ACQUIRE)) {
+		if (__atomic_load_n(&s_watch.stop, __ATOMIC_ACQUIRE)) {
+			// The main thread of a thread pool is held here while the watchdog thread reads its output
+			__atomic_store_n(&s_watch.parked, 1, __ATOMIC_RELEASE);
+			for (;;) {
+				pause();
+			}
+		}
+		return;
+	}
+
+#if defined(T_BACKTRACE)
+	slot->frames_cnt = backtrace(slot->frames, T_WATCH_FRAMES + 2);
+#endif
+	__atomic_store_n(&slot->caught, 1, __ATOMIC_RELEASE);
+
+	// The watchdog thread ends the process, this thread only does when the report gets stuck as well
+	struct timespec ts = {.tv_sec = 0, .tv_nsec = (long)T_WATCH_POLL};
+	for (unsigned long long end = t_wall() + T_WATCH_GRACE; t_wall() < end;) {
+		nanosleep(&ts, NULL);
+	}
+	t_watch_lost(slot);
+}
+
+// Holds the main thread of a thread pool in t_watch_fire, returns 1 if it did not get there in time
+static int t_watch_park(const tpool_t *pool)
+{
+	__atomic_store_n(&s_watch.stop, 1, __ATOMIC_RELEASE);
+	pthread_kill(pool->main_id, SIGALRM);
+
+	struct timespec ts     = {.tv_sec = 0, .tv_nsec = (long)T_WATCH_POLL};
+	unsigned long long end = t_wall() + T_WATCH_GRACE;
+	while (!__atomic_load_n(&s_watch.parked, __ATOMIC_ACQUIRE)) {
+		if (t_wall() >= end) {
+			return 1;
+		}
+		nanosleep(&ts, NULL);
+	}
+	return 0;
+}
+
+// Reports the test that timed out on a copy of the state of its thread, which waits in t_watch_fire, and ends the process.
+// Runs on the watchdog thread with s_watch.lock held, so no other test starts or ends meanwhile.
+static void t_watch_report(const twatch_slot_t *slot)
+{
+	s_data = *slot->data;
+
+	const char *name = strrchr(s_data.path, '/');
+	name		 = name ? name + 1 : s_data.path;
+
+	char limit[32];
+	t_indent();
+	pvr();
+	t_printf("\033[0;31mFAIL %s\033[0m\n", name);
+	t_indent();
+	pv();
+	t_printf("\033[0;31mtimed out after %s\033[0m\n", t_fmt_ns(limit, sizeof(limit), (double)slot->limit));
+
+#if defined(T_BACKTRACE)
+	// The first two frames are the signal handler and the signal trampoline
+	char **syms = backtrace_symbols(slot->frames, slot->frames_cnt);
+	for (int i = 2; syms && i < slot->frames_cnt; i++) {
+		const char *dir = strrchr(syms[i], '/');
+		t_indent();
+		pv();
+		t_printf("\033[0;31m  %s\033[0m\n", dir ? dir + 1 : syms[i]);
+	}
+	free(syms);
+#endif
+
+	s_data.failed++;
+
+	if (s_data.journal.file) {
+		t_rec_add((trec_t){.failed = 1, .nested = s_data.tests > 1, .partial = 1}, s_data.path, NULL);
+	}
+
+	if (s_iso.on) {
+		t_unit_send(s_iso.fd, 0, 0);
+		_exit(0);
+	}
+
+	tpool_t *pool = s_data.pool;
+	if (pool && s_data.work.worker && !pool->threads) {
+		// The parent collects the unit and goes on with the remaining tests
+		t_unit_send(pool->fd, s_data.work.claim, 0);
+		_exit(1);
+	}
+
+	if (pool && s_data.work.worker) {
+		// Output of the tests the parent already collected goes before this unit's, the main thread is held still while it is read
+		tdata_t *main = pool->main;
+		if (t_watch_park(pool) == 0) {
+			fflush(stdout);
+			if (main->flush) {
+				t_crash_write(main->flush->pending.data, main->flush->pending.len);
+			}
+			t_crash_write(main->out.data, main->out.len);
+
+			s_data.passed += main->passed;
+			s_data.failed += main->failed;
+		}
+		s_data.dst   = main->dst;
+		s_data.flush = NULL;
+
+		tbuf_t *recs = s_data.recs;
+		s_data.recs  = NULL;
+		if (recs) {
+			t_rec_parse(recs->data, recs->len);
+		}
+	}
+
+	// A partial run neither reports unmatched filters nor saves a baseline or durations, the journal keeps what is known
+	s_data.filter_argc = 0;
+	if (s_data.base) {
+		s_data.base->save = NULL;
+	}
+	s_data.dur = NULL;
+
+	t_finish();
+	_exit(1);
+}
+
+static void *t_watch_thread(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&s_watch.lock);
+	for (;;) {
+		unsigned long long now	= t_wall();
+		unsigned long long next = 0;
+
+		for (twatch_slot_t *slot = s_watch.slots; slot; slot = slot->next) {
+			if (__atomic_load_n(&slot->caught, __ATOMIC_ACQUIRE)) {
+				t_watch_report(slot);
+			}
+
+			if (slot->deadline == 0) {
+				continue;
+			}
+
+			if (now >= slot->deadline) {
+				if (slot->fired) {
+					t_watch_abort(slot);
+				}
+				__atomic_store_n(&slot->fired, 1, __ATOMIC_RELEASE);
+				slot->deadline = now + T_WATCH_GRACE;
+				pthread_kill(slot->id, SIGALRM);
+			}
+
+			// A fired slot is checked often, its thread waits in t_watch_fire for the report
+			unsigned long long at = slot->fired && now + T_WATCH_POLL < slot->deadline ? now + T_WATCH_POLL : slot->deadline;
+			if (next == 0 || at < next) {
+				next = at;
+			}
+		}
+
+		if (next == 0) {
+			pthread_cond_wait(&s_watch.cond, &s_watch.lock);
+		} else {
+			struct timespec ts = {.tv_sec = (time_t)(next / 1000000000ULL), .tv_nsec = (long)(next % 1000000000ULL)};
+			pthread_cond_timedwait(&s_watch.cond, &s_watch.lock, &ts);
+		}
+	}
+
+	return NULL;
+}
+
+// Starts the watchdog on first use, called with s_watch.lock held
+static int t_watch_start(void)
+{
+	if (s_watch.on) {
+		return 0;
+	}
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&s_watch.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = t_watch_fire;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGALRM, &sa, NULL);
+
+#if defined(T_BACKTRACE)
+	// backtrace loads the unwinder on its first call, which is not safe in the signal handler
+	void *frame;
+	backtrace(&frame, 1);
+#endif
+
+	pthread_attr_t thrd_attr;
+	pthread_attr_init(&thrd_attr);
+	pthread_attr_setdetachstate(&thrd_attr, PTHREAD_CREATE_DETACHED);
+
+	pthread_t id;
+	s_data.alloc_guard++;
+	int err = pthread_create(&id, &thrd_attr, t_watch_thread, NULL);
+	s_data.alloc_guard--;
+	pthread_attr_destroy(&thrd_attr);
+
+	s_watch.on = err == 0;
+	return err;
+}
+
+static void t_watch_arm(unsigned long long ns)
+{
+	twatch_slot_t *slot = &s_watch_slot;
+
+	pthread_mutex_lock(&s_watch.lock);
+	if (t_watch_start() == 0) {
+		if (!slot->linked || slot->gen != s_watch.gen) {
+			slot->id      = pthread_self();
+			slot->gen     = s_watch.gen;
+			slot->linked  = 1;
+			slot->next    = s_watch.slots;
+			s_watch.slots = slot;
+		}
+
+		slot->path     = s_data.path;
+		slot->data     = &s_data;
+		slot->limit    = ns;
+		slot->deadline = t_wall() + ns;
+		slot->fired    = 0;
+		slot->caught   = 0;
+		pthread_cond_signal(&s_watch.cond);
+	}
+	pthread_mutex_unlock(&s_watch.lock);
+}
+
+static void t_watch_disarm(void)
+{
+	twatch_slot_t *slot = &s_watch_slot;
+	if (slot->deadline == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&s_watch.lock);
+	slot->deadline = 0;
+	__atomic_store_n(&slot->fired, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&s_watch.lock);
+}
+
+// Removes the calling thread's slot before its thread-local storage goes away
+static void t_watch_unlink(void)
+{
+	twatch_slot_t *slot = &s_watch_slot;
+	if (!slot->linked) {
+		return;
+	}
+
+	pthread_mutex_lock(&s_watch.lock);
+	if (slot->gen == s_watch.gen) {
+		twatch_slot_t **link = &s_watch.slots;
+		while (*link && *link != slot) {
+			link = &(*link)->next;
+		}
+		if (*link) {
+			*link = slot->next;
+		}
+	}
+	slot->linked   = 0;
+	slot->deadline = 0;
+	pthread_mutex_unlock(&s_watch.lock);
+}
+
+static pid_t t_fork(void)
+{
+	// Keep other threads from buffering output the child would flush again
+	pthread_mutex_lock(&s_watch.lock);
+	flockfile(stdout);
+	fflush(stdout);
+	pid_t pid = fork();
+	funlockfile(stdout);
+	pthread_mutex_unlock(&s_watch.lock);
+
+	if (pid == 0) {
+		// The watchdog thread is not forked, the child starts its own
+		s_watch.on    = 0;
+		s_watch.slots = NULL;
+		s_watch.gen++;
+
+		// Only the process that was forked for a node reports to its parent
+		if (s_iso.on) {
+			close(s_iso.fd);
+			s_iso.on = 0;
+		}
+	}
+
+	return pid;
+}
+
+// Units are claimed longest first, a unit before the current one needs another pass over the suite
+static void t_pool_work(test_fn fn)
+{
+	do {
+		s_data.work.unit = 0;
+		fn();
+	} while (s_data.work.claim < s_data.pool->order_cnt && s_data.work.claim < s_data.work.unit);
+}
+
+static void t_pool_fork(tpool_t *pool, test_fn fn)
+{
+	pool->fds     = malloc((size_t)s_data.work.jobs * sizeof(*pool->fds));
+	pool->pids    = malloc((size_t)s_data.work.jobs * sizeof(*pool->pids));
+	pool->running = malloc((size_t)s_data.work.jobs * sizeof(*pool->running));
+	pool->pfds    = malloc((size_t)s_data.work.jobs * sizeof(*pool->pfds));
+	pool->pidx    = malloc((size_t)s_data.work.jobs * sizeof(*pool->pidx));
+	pool->next    = mmap(NULL, sizeof(*pool->next), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (pool->next == MAP_FAILED) {
+		pool->next = NULL;
+	}
+
+	if (pool->fds == NULL || pool->pids == NULL || pool->running == NULL || pool->pfds == NULL || pool->pidx == NULL ||
+	    pool->next == NULL) {
+		return;
+	}
+
+	for (int i = 0; i < s_data.work.jobs; i++) {
+		int fds[2];
+		if (pipe(fds)) {
+			break;
+		}
+
+		pid_t pid = t_fork();
+		if (pid == 0) {
+
+			close(fds[0]);
+			for (int j = 0; j < pool->workers; j++) {
+				close(pool->fds[j]);
+			}
+
+			pool->fd	   = fds[1];
+			s_data.pool	   = pool;
+			s_data.work.worker = i + 1;
+			s_data.work.level  = s_data.level;
+			s_data.work.unit   = 0;
+			s_data.dst	   = DST_NONE();
+			s_data.wdst	   = WDST_NONE();
+			t_unit_claim();
+
+			tbuf_t recs = {0};
+			s_data.recs = t_rec_on() ? &recs : NULL;
+
+			t_pool_work(fn);
+
+			fflush(NULL);
+			_exit(0);
+		}
+
+		close(fds[1]);
+		if (pid < 0) {
+			close(fds[0]);
+			break;
+		}
+
+		pool->fds[pool->workers]     = fds[0];
+		pool->pids[pool->workers]    = pid;
+		pool->running[pool->workers] = -1;
+		pool->workers++;
+		pool->live++;
+	}
+}
+
+static void *t_pool_thread(void *arg)
+{
+	tthread_t *thrd = arg;
+
+	s_data		      = thrd->data;
+	s_data.dst	      = DST_NONE();
+	s_data.wdst	      = WDST_NONE();
+	s_data.buf	      = (tarena_t){0};
+	s_data.filter_matched = s_data.filter_argc > 0 ? calloc((size_t)s_data.filter_argc, sizeof(*s_data.filter_matched)) : NULL;
+	s_data.out	      = (tbuf_t){0};
+	s_data.leak_tab	      = NULL;
+	t_unit_claim();
+
+	tbuf_t recs = {0};
+	s_data.recs = t_rec_on() ? &recs : NULL;
+
+	t_pool_work(thrd->fn);
+
+	t_guard_free(recs.data);
+	t_guard_free(s_data.out.data);
+	free(s_data.filter_matched);
+	t_arena_free(&s_data.buf);
+	t_leak_free();
+	t_watch_unlink();
+
+	tpool_t *pool = s_data.pool;
+	pthread_mutex_lock(&pool->lock);
+	pool->live--;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void t_pool_spawn(tpool_t *pool, test_fn fn)
+{
+	pool->threads = 1;
+	pool->next    = &pool->next_local;
+	pool->thrds   = malloc((size_t)s_data.work.jobs * sizeof(*pool->thrds));
+
+	if (pool->thrds == NULL) {
+		return;
+	}
+
+	tdata_t data	 = s_data;
+	data.pool	 = pool;
+	data.work.level	 = s_data.level;
+	data.work.unit	 = 0;
+
+	// Thread stacks and their TLS are cached by libc past the end of the test
+	s_data.alloc_guard++;
+	pthread_mutex_lock(&pool->lock);
+	for (int i = 0; i < s_data.work.jobs; i++) {
+		tthread_t *thrd	       = &pool->thrds[pool->workers];
+		thrd->fn	       = fn;
+		thrd->data	       = data;
+		thrd->data.work.worker = i + 1;
+
+		if (pthread_create(&thrd->id, NULL, t_pool_thread, thrd)) {
+			break;
+		}
+
+		pool->workers++;
+		pool->live++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	s_data.alloc_guard--;
+}
+
+// Estimates the unit entered next from the durations of the tests under it
+static void t_pool_note(tpool_t *pool, const char *name)
+{
+	if (pool->order_cnt == pool->order_size) {
+		int size	 = pool->order_size == 0 ? 64 : pool->order_size * 2;
+		tdur_bin_t *bins = realloc(pool->bins, (size_t)size * sizeof(*bins));
+		if (bins == NULL) {
+			return;
+		}
+		pool->bins	 = bins;
+		pool->order_size = size;
+	}
+
+	char path[T_PATH_MAX];
+	size_t len = s_data.path_len;
+	memcpy(path, s_data.path, len);
+	if (len > 0 && len + 1 < T_PATH_MAX) {
+		path[len++] = '/';
+	}
+	for (; name && *name && len + 1 < T_PATH_MAX; name++) {
+		path[len++] = *name;
+	}
+
+	pool->bins[pool->order_cnt] = (tdur_bin_t){.ns = t_dur_sum(s_data.dur, path, len), .index = (unsigned int)pool->order_cnt};
+	pool->order_cnt++;
+}
+
+// Lists the units by running the suite with each of them skipped, then orders them longest first.
+// A unit without history is expected to take as long as the average unit with history
+static void t_pool_order(tpool_t *pool, test_fn fn)
+{
+	dst_t dst	  = s_data.dst;
+	wdst_t wdst	  = s_data.wdst;
+	twork_t work	  = s_data.work;
+	tshard_t shard	  = s_data.shard;
+	s_data.dst	  = DST_NONE();
+	s_data.wdst	  = WDST_NONE();
+	s_data.pool	  = pool;
+	s_data.work.level = s_data.level;
+	s_data.work.unit  = 0;
+
+	pool->discover = 1;
+	fn();
+	pool->discover = 0;
+
+	s_data.dst   = dst;
+	s_data.wdst  = wdst;
+	s_data.pool  = NULL;
+	s_data.work  = work;
+	s_data.shard = shard;
+
+	pool->order = pool->order_cnt > 0 ? malloc((size_t)pool->order_cnt * sizeof(*pool->order)) : NULL;
+	if (pool->order == NULL) {
+		pool->order_cnt = 0;
+		return;
+	}
+
+	unsigned long long sum = 0;
+	int known	       = 0;
+	for (int i = 0; i < pool->order_cnt; i++) {
+		sum += pool->bins[i].ns;
+		known += pool->bins[i].ns > 0;
+	}
+
+	unsigned long long def = known > 0 ? sum / (unsigned long long)known : T_DUR_DEFAULT;
+	for (int i = 0; i < pool->order_cnt; i++) {
+		if (pool->bins[i].ns == 0) {
+			pool->bins[i].ns = def;
+		}
+	}
+
+	qsort(pool->bins, (size_t)pool->order_cnt, sizeof(*pool->bins), t_dur_bin_cmp);
+	for (int i = 0; i < pool->order_cnt; i++) {
+		pool->order[i] = (int)pool->bins[i].index;
+	}
+}
+
+static int t_pool_run(test_fn fn)
+{
+	tpool_t *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL) {
+		return fn();
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pool->main    = &s_data;
+	pool->main_id = pthread_self();
+
+	if (s_data.dur) {
+		t_pool_order(pool, fn);
+	}
+
+	t_flush(1);
+
+	if (s_data.work.threads) {
+		t_pool_spawn(pool, fn);
+	} else {
+		t_pool_fork(pool, fn);
+	}
+
+	s_data.pool	  = pool;
+	s_data.work.level = s_data.level;
+	s_data.work.unit  = 0;
+
+	int ret = fn();
+
+	s_data.pool	  = NULL;
+	s_data.work.level = 0;
+
+	for (int i = 0; i < pool->workers; i++) {
+		if (pool->threads) {
+			pthread_join(pool->thrds[i].id, NULL);
+		} else if (pool->fds[i] >= 0) {
+			close(pool->fds[i]);
+			waitpid(pool->pids[i], NULL, 0);
+		}
+	}
+
+	for (int i = 0; i < pool->units_size; i++) {
+		free(pool->units[i].out);
+		free(pool->units[i].recs);
+		free(pool->units[i].matched);
+	}
+
+	if (pool->next && !pool->threads) {
+		munmap(pool->next, sizeof(*pool->next));
+	}
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+
+	free(pool->units);
+	free(pool->order);
+	free(pool->bins);
+	free(pool->thrds);
+	free(pool->pidx);
+	free(pool->pfds);
+	free(pool->running);
+	free(pool->pids);
+	free(pool->fds);
+	free(pool);
+
+	return ret;
+}
+
+// Whether the node entered next runs in its own process
+static int t_iso_on(void)
+{
+	// Parents of workers only wait for units, tests run from inside another test stay in its process
+	return s_data.isolate && !(s_data.work.jobs > 1 && s_data.work.worker == 0) && s_watch_slot.depth == 0;
+}
+
+// Runs the node entered next in a child forked from this already initialized process,
+// returns 0 in the child and the state of the node in the parent
+static int t_iso_fork(const char *name)
+{
+	int fds[2];
+	if (pipe(fds)) {
+		return 0;
+	}
+
+	pid_t pid = t_fork();
+	if (pid == 0) {
+		close(fds[0]);
+		s_iso.on	= 1;
+		s_iso.fd	= fds[1];
+		s_iso.level	= s_data.level;
+		s_iso.recs.len	= 0;
+		s_data.recs	= t_rec_on() ? &s_iso.recs : NULL;
+		s_data.passed	= 0;
+		s_data.failed	= 0;
+		s_data.out.len	= 0;
+		s_data.dst	= DST_NONE();
+		s_data.dst.off	= T_CAPTURE;
+		return 0;
+	}
+
+	close(fds[1]);
+	if (pid < 0) {
+		close(fds[0]);
+		return 0;
+	}
+
+	tunit_t unit = {0};
+	tmsg_t msg   = {0};
+	int sent     = !t_read_all(fds[0], &msg, sizeof(msg)) && !t_unit_recv(fds[0], &msg, &unit);
+	close(fds[0]);
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+
+	// A crashed child still sends what it printed and the results it had so far
+	if (!sent || msg.partial) {
+		unit.status = status == 0 ? -1 : status;
+		unit.ret    = 1;
+		unit.failed++;
+	}
+
+	return t_unit_show(&unit, name, "test");
+}
+
+#endif
+
+int t_enter(const char *name)
+{
+	int run_all = 0;
+	if (!t_should_run(name, &run_all)) {
+		return -1;
+	}
+
+#if !defined(C_WIN)
+	if (s_data.pool && s_data.level == s_data.work.level) {
+		int unit = s_data.work.unit++;
+		if (s_data.pool->discover) {
+			t_pool_note(s_data.pool, name);
+			return -1;
+		} else if (s_data.work.worker == 0) {
+			int state = t_pool_wait(unit, name);
+			if (state < 0) {
+				return state;
+			}
+		} else if (unit != s_data.work.claim) {
+			return -1;
+		} else {
+			t_unit_start(unit);
+		}
+	}
+
+	if (t_iso_on()) {
+		int state = t_iso_fork(name);
+		if (state < 0) {
+			// The child ran the whole node, end the unit it belonged to here
+			if (s_data.pool && s_data.work.worker && s_data.level == s_data.work.level) {
+				t_unit_end();
+			}
+			return state;
+		}
+	}
+#endif
+
+	int filter_run_all = s_data.filter_run_all;
+	if (run_all) {
+		s_data.filter_run_all = 1;
+	}
+
+	if (s_data.level < T_LEVEL_MAX) {
+		s_data.path_lens[s_data.level] = s_data.path_len;
+		t_path_push(name);
+	}
+
+	s_data.level++;
+	return filter_run_all;
+}
+
+void t_leave(int state)
+{
+	if (state < 0) {
+		return;
+	}
+
+	s_data.level--;
+	s_data.filter_run_all = state;
+
+	if (s_data.level < T_LEVEL_MAX) {
+		s_data.path_len		      = s_data.path_lens[s_data.level];
+		s_data.path[s_data.path_len] = '\0';
+	}
+
+#if !defined(C_WIN)
+	if (s_iso.on && s_data.level == s_iso.level && s_watch_slot.depth == 0) {
+		fflush(NULL);
+		t_unit_send(s_iso.fd, 0, 0);
+		_exit(0);
+	}
+
+	if (s_data.pool && s_data.work.worker && s_data.level == s_data.work.level && s_data.work.unit == s_data.work.claim + 1) {
+		t_unit_end();
+	}
+#endif
+}
+
+int t_result(int state)
+{
+	// clang-format off
+	switch (state) {
+	case -2: return 0;
+	case -3: return 1;
+	default: return -1;
+	}
+	// clang-format on
+}
+
+// Runs the tree until it ran repeat.count times or failed with until_fail, each run with its own seed and counters
+static int t_repeat(test_fn fn, const char *name, int print)
+{
+	trepeat_t *repeat = &s_data.repeat;
+
+	dst_t dst		= s_data.dst;
+	const long long passed	= s_data.passed;
+	const long long failed	= s_data.failed;
+	const int seeded	= s_data.prop.seeded;
+	unsigned long long seed = s_data.prop.seed;
+	unsigned long long rng	= t_wall();
+
+	// The output of a run is kept in s_data.out until it is known whether the run failed
+	t_flush(1);
+	repeat->on = 1;
+
+	long long runs	     = 0;
+	long long fails	     = 0;
+	int res		     = -1;
+	long long res_passed = 0;
+	long long res_failed = 0;
+	while ((repeat->count == 0 || runs < repeat->count) && !(repeat->until_fail && fails > 0)) {
+		if (!seeded) {
+			s_data.prop.seed   = t_splitmix(&rng);
+			s_data.prop.seeded = 1;
+		}
+
+		dst	       = s_data.dst;
+		s_data.passed  = 0;
+		s_data.failed  = 0;
+		s_data.dst.off = T_CAPTURE;
+		s_data.out.len = 0;
+		repeat->drawn  = 0;
+
+		int ret = t_run_named(fn, name, print);
+
+		s_data.dst = dst;
+		if (ret < 0) {
+			// Nothing was selected, another run would not select anything either
+			break;
+		}
+		runs++;
+
+		// The counts are of the last run, or of the first failing one
+		if (fails == 0) {
+			res	   = ret;
+			res_passed = s_data.passed;
+			res_failed = s_data.failed;
+		}
+
+		if ((ret > 0 || s_data.failed > 0) && fails++ == 0) {
+			if (dst.off == T_BUFFER) {
+				t_flush(1);
+			} else {
+				t_puts(s_data.out.data, s_data.out.len);
+			}
+			// The seed only drives the values of properties and differential tests
+			if (repeat->drawn) {
+				t_printf("\033[0;31mrun %lld failed, reproduce with --seed %llu\033[0m\n", runs, s_data.prop.seed);
+			} else {
+				t_printf("\033[0;31mrun %lld failed\033[0m\n", runs);
+			}
+			t_flush(1);
+		}
+	}
+
+	s_data.out.len = 0;
+	if (dst.off != T_BUFFER) {
+		t_guard_free(s_data.out.data);
+		s_data.out = (tbuf_t){0};
+	}
+
+	repeat->on	   = 0;
+	s_data.prop.seed   = seed;
+	s_data.prop.seeded = seeded;
+	s_data.passed	   = passed + res_passed;
+	s_data.failed	   = failed + res_failed;
+
+	if (fails > 0) {
+		t_printf("\033[0;31mFAIL %lld/%lld RUNS (%.4g%%)\033[0m\n", fails, runs, (double)fails * 100 / (double)runs);
+	} else if (runs > 0) {
+		t_printf("\033[0;32mPASS %lld %s\033[0m\n", runs, runs == 1 ? "RUN" : "RUNS");
+	}
+
+	return res;
+}
+
+int t_run_named(test_fn fn, const char *name, int print)
+{
+	if ((s_data.repeat.count > 0 || s_data.repeat.until_fail) && !s_data.repeat.on && s_data.level == 0 && s_data.tests == 0) {
+		return t_repeat(fn, name, print);
+	}
+
+	// The tests that failed last time run first, the others only once all of them pass
+	if (s_data.journal.first && s_data.level == 0 && s_data.tests == 0) {
+		long long failed = s_data.failed;
+		int ret		 = -1;
+
+		s_data.journal.first = 0;
+		if (t_journal_failed(s_data.journal.file, "", 0, 1)) {
+			s_data.journal.run = T_JOURNAL_FAILED;
+			ret		   = t_run_named(fn, name, print);
+		}
+		if (s_data.failed == failed) {
+			s_data.journal.run = T_JOURNAL_REST;
+			int rest	   = t_run_named(fn, name, print);
+			ret		   = rest >= 0 ? rest : ret;
+		}
+		s_data.journal.run   = T_JOURNAL_ALL;
+		s_data.journal.first = 1;
+
+		return ret;
+	}
+
+	dst_t dst   = {0};
+	wdst_t wdst = {0};
+
+	int state = t_enter(name);
+	if (state < 0) {
+		return t_result(state);
+	}
+
+	if (print == 0) {
+		dst  = t_set_dst(DST_NONE());
+		wdst = t_set_wdst(WDST_NONE());
+	}
+
+#if !defined(C_WIN)
+	int ret = s_data.work.jobs > 1 && s_data.pool == NULL && s_data.work.worker == 0 && s_data.level == 1 ? t_pool_run(fn) : fn();
+#else
+	int ret = fn();
+#endif
+
+	t_leave(state);
+
+	if (print == 0) {
+		t_set_dst(dst);
+		t_set_wdst(wdst);
+	}
+
+	return ret;
+}
+
+int t_run(test_fn fn, int print)
+{
+	return t_run_named(fn, NULL, print);
+}
+
+// Whether suite headers wait for a test under them to run, tests started inside another test always run
+static int t_defer_on(void)
+{
+	return t_skip_on() && s_data.tests == 0;
+}
+
+static void t_shard_show(void)
+{
+	int depth = s_data.depth;
+	for (int i = s_data.shard.shown; i <= depth && i < T_LEVEL_MAX; i++) {
+		s_data.depth = i - 1;
+		t_indent();
+		pvr();
+		t_printf("%s\n", s_data.shard.heads[i]);
+	}
+	s_data.depth = depth;
+
+	if (s_data.shard.shown < depth + 1) {
+		s_data.shard.shown = depth + 1;
+	}
+}
+
+// Tests with history are balanced by their durations, the others are spread by a hash of their path
+static int t_shard_of(void)
+{
+	const tdur_t *dur = s_data.dur;
+	if (dur && dur->shards) {
+		int i = t_dur_find(dur, s_data.path, s_data.path_len);
+		if (i >= 0) {
+			return dur->shards[i];
+		}
+	}
+
+	return (int)(t_fnv1a(s_data.path, s_data.path_len) % (unsigned long long)s_data.shard.count);
+}
+
+int t_start(void)
+{
+#if !defined(C_WIN)
+	// A suite that is the unit itself is listed, not run
+	if (s_data.pool && s_data.pool->discover) {
+		return 1;
+	}
+#endif
+
+	if (t_defer_on()) {
+		if (s_data.shard.count > 1 && t_shard_of() != s_data.shard.index) {
+			return 1;
+		}
+		t_shard_show();
+	}
+
+	s_data.tests++;
+
+	if (s_data.time || s_data.dur) {
+		s_data.time_start = t_stamp();
+	}
+
+	s_data.mem	  = s_data.mem_stats.mem;
+	s_data.bench.done = 0;
+	s_data.diff.done  = 0;
+	s_data.table.done = 0;
+
+	t_alloc_fold(s_data.depth);
+	s_data.alloc.peak = s_data.alloc.live;
+	s_data.alloc_test = s_data.alloc;
+
+	if (s_data.leaks && s_data.leak_tab == NULL) {
+		s_data.alloc_guard++;
+		s_data.leak_tab = calloc(1, sizeof(*s_data.leak_tab));
+		s_data.alloc_guard--;
+	}
+	// A test started inside another test keeps the outer test's blocks
+	if (s_data.leak_tab && s_data.leak_tab->track++ == 0) {
+		s_data.leak_tab->gen++;
+		s_data.leak_tab->live = 0;
+	}
+
+#if !defined(C_WIN)
+	// Like leak tracking, a test started inside another test is covered by the outer test's timeout
+	if (s_watch_slot.depth++ == 0 && s_data.timeout > 0) {
+		t_watch_arm((unsigned long long)s_data.timeout * 1000000ULL);
+	}
+#endif
+
+	if (s_data.setup) {
+		s_data.setup(s_data.priv);
+	}
+
+	return 0;
+}
+
+void t_timeout(unsigned ms)
+{
+#if !defined(C_WIN)
+	if (s_watch_slot.depth == 0) {
+		return;
+	}
+
+	if (ms > 0) {
+		t_watch_arm((unsigned long long)ms * 1000000ULL);
+	} else {
+		t_watch_disarm();
+	}
+#else
+	(void)ms;
+#endif
+}
+
+// Formats benchmark statistics and compares them with the baseline, returns 1 on a significant slowdown
+static int t_bench_report(char *buf, size_t size, const char *path, size_t path_len)
+{
+	const tbench_t *bench = &s_data.bench;
+
+	char median[32], mean[32], stddev[32], p99[32];
+	int len = snprintf(buf,
+			   size,
+			   " (median %s, mean %s, stddev %s, p99 %s",
+			   t_fmt_ns(median, sizeof(median), bench->median),
+			   t_fmt_ns(mean, sizeof(mean), bench->mean),
+			   t_fmt_ns(stddev, sizeof(stddev), bench->stddev),
+			   t_fmt_ns(p99, sizeof(p99), bench->p99));
+
+	int regress		 = 0;
+	const tbase_ent_t *ent = t_base_find(s_data.base, path, path_len);
+	if (ent && len > 0 && (size_t)len < size) {
+		double base   = t_median(ent->samples, ent->cnt);
+		double change = base > 0 ? bench->median / base - 1 : 0;
+		double z      = t_mann_whitney(bench->samples, bench->cnt, ent->samples, ent->cnt);
+
+		regress = z > T_BENCH_Z && change > s_data.base->max_regress;
+		t_fmt_ns(median, sizeof(median), base);
+		len += snprintf(buf + len, size - (size_t)len, ", baseline %s, %+.1f%%", median, change * 100);
+	}
+
+	if (len > 0 && (size_t)len < size) {
+		snprintf(buf + len, size - (size_t)len, ")");
+	}
+
+	return regress;
+}
+
+static const char *t_fmt_rate(char *buf, size_t size, double rate)
+{
+	if (rate < 1e3) {
+		snprintf(buf, size, "%.1f", rate);
+	} else if (rate < 1e6) {
+		snprintf(buf, size, "%.1fk", rate / 1e3);
+	} else if (rate < 1e9) {
+		snprintf(buf, size, "%.1fM", rate / 1e6);
+	} else {
+		snprintf(buf, size, "%.1fG", rate / 1e9);
+	}
+	return buf;
+}
+
+static void t_diff_report(char *buf, size_t size)
+{
+	const tdiff_t *diff = &s_data.diff;
+
+	double rate[2];
+	char fmt[2][32];
+	for (int i = 0; i < 2; i++) {
+		rate[i] = (double)diff->inputs * 1e9 / (double)(diff->ns[i] > 0 ? diff->ns[i] : 1);
+		t_fmt_rate(fmt[i], sizeof(fmt[i]), rate[i]);
+	}
+
+	snprintf(buf,
+		 size,
+		 " (%llu inputs, %s %s/s, %s %s/s, %.2fx)",
+		 diff->inputs,
+		 diff->names[0],
+		 fmt[0],
+		 diff->names[1],
+		 fmt[1],
+		 rate[1] / rate[0]);
+}
+
+#if defined(T_ALLOC_HOOK)
+static int t_leak_cmp(const void *a, const void *b)
+{
+	const tleak_t *x = *(const tleak_t *const *)a;
+	const tleak_t *y = *(const tleak_t *const *)b;
+	if (x->frames_cnt != y->frames_cnt) {
+		return x->frames_cnt < y->frames_cnt ? -1 : 1;
+	}
+	return memcmp(x->frames, y->frames, (size_t)x->frames_cnt * sizeof(void *));
+}
+
+// Prints the blocks the test did not free, grouped by the call site that allocated them
+static void t_leak_report(void)
+{
+	tleaks_t *tab = s_data.leak_tab;
+	s_data.alloc_guard++;
+
+	tleak_t **list = __libc_malloc(tab->live * sizeof(*list));
+	size_t cnt     = 0;
+	for (size_t i = 0; list && i < tab->cap; i++) {
+		if (tab->ents[i].ptr && tab->ents[i].gen == tab->gen && cnt < tab->live) {
+			list[cnt++] = &tab->ents[i];
+		}
+	}
+	qsort(list, cnt, sizeof(*list), t_leak_cmp);
+
+	size_t sites = 0;
+	for (size_t i = 0; i < cnt;) {
+		size_t blocks = 0;
+		size_t size   = 0;
+		size_t j      = i;
+		for (; j < cnt && t_leak_cmp(&list[i], &list[j]) == 0; j++) {
+			blocks++;
+			size += list[j]->size;
+		}
+
+		if (sites++ < T_LEAK_SITES) {
+			char bytes[32];
+			t_indent();
+			pv();
+			t_printf("\033[0;31m%zu %s, %s allocated at:\033[0m\n",
+				 blocks,
+				 blocks == 1 ? "block" : "blocks",
+				 t_fmt_bytes(bytes, sizeof(bytes), (long long)size));
+
+			// Symbols are only looked up for the sites that are printed
+			char **syms = backtrace_symbols(list[i]->frames, list[i]->frames_cnt);
+			for (int k = 0; k < list[i]->frames_cnt; k++) {
+				const char *sym = syms ? syms[k] : NULL;
+				const char *dir = sym ? strrchr(sym, '/') : NULL;
+				t_indent();
+				pv();
+				if (sym) {
+					t_printf("\033[0;31m  %s\033[0m\n", dir ? dir + 1 : sym);
+				} else {
+					t_printf("\033[0;31m  [%p]\033[0m\n", list[i]->frames[k]);
+				}
+			}
+			free(syms);
+		}
+		i = j;
+	}
+
+	if (sites > T_LEAK_SITES) {
+		t_indent();
+		pv();
+		t_printf("\033[0;31m%zu more sites\033[0m\n", sites - T_LEAK_SITES);
+	}
+
+	__libc_free(list);
+	s_data.alloc_guard--;
+}
+#endif
+
+static void t_end_allocs(const char *allocs)
+{
+	if (allocs[0] == '\0') {
+		return;
+	}
+
+	t_indent();
+	pv();
+	t_printf("%s\n", allocs);
+}
+
+int t_end(int passed, const char *file, const char *func, int line)
+{
+	if (s_data.teardown) {
+		s_data.teardown(s_data.priv);
+	}
+
+	if (s_data.tests > 0) {
+		s_data.tests--;
+	}
+
+#if !defined(C_WIN)
+	if (s_watch_slot.depth > 0 && --s_watch_slot.depth == 0) {
+		t_watch_disarm();
+	}
+#endif
+
+	const char *path   = s_data.path_len > 0 ? s_data.path : func;
+	tstamp_t time	   = s_data.time || s_data.dur ? t_took(s_data.time_start) : (tstamp_t){0};
+	// mem_stats counts the memory of all threads together, in a thread pool only the leak tables tell the tests apart
+	const int shared   = s_data.pool && s_data.pool->threads;
+	const int leak_tab = s_data.leak_tab && --s_data.leak_tab->track == 0 && s_data.leak_tab->live > 0;
+	const int leak	   = (!shared && s_data.mem != s_data.mem_stats.mem) || leak_tab;
+	const int bench	   = passed && !leak && s_data.bench.done;
+
+	char stats[256] = "";
+	int regress	= bench && t_bench_report(stats, sizeof(stats), path, t_strlen(path));
+	if (passed && !leak && s_data.diff.done) {
+		t_diff_report(stats, sizeof(stats));
+	} else if (passed && !leak && s_data.table.done && s_data.table.rows < s_data.table.cnt) {
+		snprintf(stats, sizeof(stats), " (%zu of %zu rows)", s_data.table.rows, s_data.table.cnt);
+	} else if (passed && !leak && s_data.table.done) {
+		snprintf(stats, sizeof(stats), " (%zu rows)", s_data.table.rows);
+	}
+
+	if (t_rec_on()) {
+		trec_t rec = {
+			.took	 = time,
+			.failed	 = !passed || leak || regress,
+			.nested	 = s_data.tests > 0,
+			.samples = bench ? s_data.bench.cnt : 0,
+		};
+		t_rec_add(rec, path, s_data.bench.samples);
+	}
+
+	char took[40];
+	t_fmt_took(took, sizeof(took), time);
+
+	// Marks restart the peak, the test's peak before the latest mark is kept in alloc_test
+	if (s_data.alloc_test.peak > s_data.alloc.peak) {
+		s_data.alloc.peak = s_data.alloc_test.peak;
+	}
+
+	char allocs[256] = "";
+	if (s_data.alloc_on) {
+		t_fmt_allocs(allocs, sizeof(allocs), &s_data.alloc_test, s_data.alloc.peak - s_data.alloc_test.live);
+	}
+	t_alloc_fold(s_data.depth);
+
+	if (!passed) {
+		if (s_data.time) {
+			char ns[32];
+			t_indent();
+			pv();
+			t_printf("\033[0;31mtook %s\033[0m\n", t_fmt_ns(ns, sizeof(ns), (double)time.wall));
+		}
+		t_end_allocs(allocs);
+		s_data.failed++;
+		t_flush(1);
+		return 1;
+	}
+
+	t_indent();
+	pvr();
+
+	if (leak) {
+		t_printf("\033[0;31mLEAK %s%s\033[0m\n", t_func_name(func), took);
+
+		t_indent();
+		pv();
+
+		t_printf("\033[0;31m%s:%d: %d B\033[0m\n", file, line, s_data.mem_stats.mem - s_data.mem);
+#if defined(T_ALLOC_HOOK)
+		if (leak_tab) {
+			t_leak_report();
+		}
+#endif
+		t_end_allocs(allocs);
+
+		s_data.failed++;
+		t_flush(1);
+		return 1;
+	}
+
+	if (regress) {
+		t_printf("\033[0;31mFAIL %s%s%s\033[0m\n", t_func_name(func), took, stats);
+		t_end_allocs(allocs);
+		s_data.failed++;
+		t_flush(1);
+		return 1;
+	}
+
+	t_printf("\033[0;32mPASS %s%s%s\033[0m\n", t_func_name(func), took, stats);
+	t_end_allocs(allocs);
+
+	s_data.passed++;
+	return 0;
+}
+
+int t_alloc_counted(void)
+{
+#if defined(T_ALLOC_HOOK)
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+talloc_mark_t t_alloc_mark(void)
+{
+	talloc_t *alloc = &s_data.alloc;
+	if (alloc->peak > s_data.alloc_test.peak) {
+		s_data.alloc_test.peak = alloc->peak;
+	}
+	alloc->peak = alloc->live;
+
+	talloc_mark_t mark = {
+		.allocs = alloc->allocs,
+		.live	= alloc->live,
+	};
+	return mark;
+}
+
+unsigned long long t_alloc_allocs(const talloc_mark_t *mark)
+{
+	return s_data.alloc.allocs - mark->allocs;
+}
+
+unsigned long long t_alloc_peak(const talloc_mark_t *mark)
+{
+	long long peak = s_data.alloc.peak - mark->live;
+	return peak > 0 ? (unsigned long long)peak : 0;
+}
+
+static void t_bench_stats(tbench_t *bench)
+{
+	int cnt = bench->cnt;
+	qsort(bench->samples, (size_t)cnt, sizeof(bench->samples[0]), t_cmp_double);
+
+	double sum = 0;
+	for (int i = 0; i < cnt; i++) {
+		sum += bench->samples[i];
+	}
+
+	double var = 0;
+	bench->mean = sum / cnt;
+	for (int i = 0; i < cnt; i++) {
+		var += (bench->samples[i] - bench->mean) * (bench->samples[i] - bench->mean);
+	}
+
+	bench->median = t_median(bench->samples, cnt);
+	bench->stddev = cnt > 1 ? t_sqrt(var / (cnt - 1)) : 0;
+	bench->p99    = bench->samples[(cnt * 99 + 99) / 100 - 1];
+	bench->done   = 1;
+}
+
+size_t t_bench_begin(void)
+{
+	tbench_t *bench = &s_data.bench;
+
+	bench->calibrated = 0;
+	bench->done	  = 0;
+	bench->cnt	  = 0;
+	bench->iters	  = 1;
+	bench->total	  = 0;
+	bench->start	  = t_wall();
+	return 1;
+}
+
+size_t t_bench_next(void)
+{
+	unsigned long long now = t_wall();
+	tbench_t *bench	       = &s_data.bench;
+
+	if (!bench->on) {
+		return 0;
+	}
+
+	const unsigned long long batch = T_BENCH_TIME / T_BENCH_SAMPLES;
+	unsigned long long took	       = now - bench->start;
+
+	if (!bench->calibrated) {
+		// Calibration batches double as warm-up and are not sampled
+		if (took >= batch || bench->iters >= SIZE_MAX / 128) {
+			bench->calibrated = 1;
+		} else {
+			double scale = took > 0 ? (double)batch * 1.2 / (double)took : 100;
+			scale	     = scale < 2 ? 2 : scale > 100 ? 100 : scale;
+			bench->iters = (size_t)((double)bench->iters * scale);
+		}
+	} else {
+		bench->samples[bench->cnt++] = (double)took / (double)bench->iters;
+		bench->total += took;
+
+		if (bench->cnt == T_BENCH_SAMPLES || (bench->cnt >= T_BENCH_MIN && bench->total >= T_BENCH_TIME)) {
+			t_bench_stats(bench);
+			return 0;
+		}
+	}
+
+	bench->start = t_wall();
+	return bench->iters;
+}
+
+void t_cstart(void)
+{
+}
+
+int t_cend(int passed, const char *func)
+{
+	(void)func;
+
+	if (!passed) {
+		s_data.failed++;
+		return 1;
+	}
+
+	s_data.passed++;
+	return 0;
+}
+
+void t_sstart(const char *func)
+{
+	if (t_defer_on() && s_data.depth >= 0) {
+		if (s_data.depth + 1 < T_LEVEL_MAX) {
+			s_data.shard.heads[s_data.depth + 1] = t_func_name(func);
+		}
+	} else {
+		t_indent();
+		if (s_data.depth >= 0) {
+			pvr();
+		}
+
+		t_printf("%s\n", t_func_name(func));
+		s_data.shard.shown = s_data.depth + 2;
+	}
+
+	t_alloc_fold(s_data.depth);
+	s_data.depth++;
+
+	if (s_data.alloc_on && s_data.depth < T_LEVEL_MAX) {
+		// The snapshot keeps the suite's own peak, which starts at the memory in use now
+		s_data.alloc.peak			= s_data.alloc.live;
+		s_data.alloc_suites[s_data.depth]	= s_data.alloc;
+	}
+
+	if (s_data.time && s_data.depth < T_LEVEL_MAX) {
+		s_data.time_suites[s_data.depth] = t_stamp();
+	}
+}
+
+int t_send(int passed, int failed)
+{
+	// No test of the suite was in this shard or let run by the journal, its header was never printed
+	if (t_defer_on() && s_data.depth >= s_data.shard.shown) {
+		s_data.depth--;
+		return -1;
+	}
+
+	t_indent();
+	pur();
+
+	char took[40] = "";
+	if (s_data.time && s_data.depth >= 0 && s_data.depth < T_LEVEL_MAX) {
+		t_fmt_took(took, sizeof(took), t_took(s_data.time_suites[s_data.depth]));
+	}
+
+	// Tests run by workers are not counted here
+	char allocs[256] = "";
+	int depth	 = s_data.depth;
+	if (s_data.alloc_on && depth >= 0 && depth < T_LEVEL_MAX && !(s_data.pool && s_data.level == s_data.work.level)) {
+		t_alloc_fold(depth);
+		const talloc_t *suite = &s_data.alloc_suites[depth];
+
+		char buf[240];
+		snprintf(allocs, sizeof(allocs), " (%s)", t_fmt_allocs(buf, sizeof(buf), suite, suite->peak - suite->live));
+
+		if (depth > 0 && suite->peak > s_data.alloc_suites[depth - 1].peak) {
+			s_data.alloc_suites[depth - 1].peak = suite->peak;
+		}
+	}
+
+	if (failed == 0) {
+		t_printf("\033[0;32mPASS %d %s%s%s\033[0m\n", passed, passed == 1 ? "TEST" : "TESTS", took, allocs);
+	} else {
+		t_printf("\033[0;31mFAIL %d/%d %s%s%s\033[0m\n", failed, failed + passed, failed == 1 ? "TEST" : "TESTS", took, allocs);
+	}
+	s_data.depth--;
+
+	if (s_data.shard.shown > s_data.depth + 1) {
+		s_data.shard.shown = s_data.depth + 1;
+	}
+
+	t_flush(0);
+	return failed > 0;
+}
+
+int t_scan(const char *str, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	const int ret = vsscanf(str, fmt, args);
+	va_end(args);
+	return ret;
+}
+
+int t_strcmp(const char *act, const char *exp)
+{
+	if (act == NULL && exp == NULL) {
+		return 0;
+	}
+	if (act == NULL || exp == NULL) {
+		return 1;
+	}
+
+	size_t act_len = t_strlen(act);
+	size_t exp_len = t_strlen(exp);
+
+	if (act_len != exp_len) {
+		return 1;
+	}
+
+	return t_mismatch(act, exp, exp_len) == exp_len ? 0 : 1;
+}
+
+int t_strncmp(const char *act, const char *exp, size_t len)
+{
+	if (act == NULL && exp == NULL && len == 0) {
+		return 0;
+	}
+	if (act == NULL || exp == NULL || t_strlen(exp) != len) {
+		return 1;
+	}
+
+	return t_mismatch(act, exp, len) == len ? 0 : 1;
+}
+
+int t_wstrcmp(const wchar_t *act, const wchar_t *exp)
+{
+	if (act == NULL && exp == NULL) {
+		return 0;
+	}
+	if (act == NULL || exp == NULL) {
+		return 1;
+	}
+
+	size_t act_len = t_wcslen(act);
+	size_t exp_len = t_wcslen(exp);
+
+	if (act_len != exp_len) {
+		return 1;
+	}
+
+	return t_mismatch(act, exp, exp_len * sizeof(wchar_t)) == exp_len * sizeof(wchar_t) ? 0 : 1;
+}
+
+int t_wstrncmp(const wchar_t *act, const wchar_t *exp, size_t len)
+{
+	if (act == NULL && exp == NULL && len == 0) {
+		return 0;
+	}
+	if (act == NULL || exp == NULL || t_wcslen(exp) != len) {
+		return 1;
+	}
+
+	return t_mismatch(act, exp, len * sizeof(wchar_t)) == len * sizeof(wchar_t) ? 0 : 1;
+}
+
+int t_memcmp(const void *act, const void *exp, size_t size)
+{
+	if (act == exp) {
+		return 0;
+	}
+	if (act == NULL || exp == NULL) {
+		return 1;
+	}
+
+	return t_mismatch(act, exp, size) == size ? 0 : 1;
+}
+
+// Returns 1 if the floats or doubles at a and b are within eps or ulp units in the last place
+static int t_fnear(const void *a, const void *b, size_t esize, double eps, unsigned long long ulp)
+{
+	double x;
+	double y;
+	long long ix;
+	long long iy;
+
+	if (esize == sizeof(float)) {
+		float fx;
+		float fy;
+		int32_t bx;
+		int32_t by;
+		memcpy(&fx, a, sizeof(fx));
+		memcpy(&fy, b, sizeof(fy));
+		memcpy(&bx, a, sizeof(bx));
+		memcpy(&by, b, sizeof(by));
+		x  = fx;
+		y  = fy;
+		ix = bx < 0 ? (long long)INT32_MIN - bx : bx;
+		iy = by < 0 ? (long long)INT32_MIN - by : by;
+	} else {
+		memcpy(&x, a, sizeof(x));
+		memcpy(&y, b, sizeof(y));
+		memcpy(&ix, a, sizeof(ix));
+		memcpy(&iy, b, sizeof(iy));
+		// Orders negative values below positive ones, so the distance counts representable values
+		ix = ix < 0 ? LLONG_MIN - ix : ix;
+		iy = iy < 0 ? LLONG_MIN - iy : iy;
+	}
+
+	if (x != x || y != y) {
+		return 0;
+	}
+
+	if ((x > y ? x - y : y - x) <= eps) {
+		return 1;
+	}
+
+	unsigned long long ux = (unsigned long long)ix;
+	unsigned long long uy = (unsigned long long)iy;
+	return (ix > iy ? ux - uy : uy - ux) <= ulp;
+}
+
+// Returns the index of the first element that is not near, or cnt if all are
+static size_t t_farr_mismatch(const void *act, const void *exp, size_t cnt, size_t esize, double eps, unsigned long long ulp)
+{
+	const char *a = act;
+	const char *b = exp;
+	size_t size   = cnt * esize;
+
+	// Identical bytes are skipped with the vector scan, only differing elements are checked
+	size_t off = 0;
+	while ((off += t_mismatch(a + off, b + off, size - off)) < size) {
+		size_t i = off / esize;
+		if (!t_fnear(a + i * esize, b + i * esize, esize, eps, ulp)) {
+			return i;
+		}
+		off = (i + 1) * esize;
+	}
+
+	return cnt;
+}
+
+int t_farrcmp(const void *act, const void *exp, size_t cnt, size_t esize, double eps, unsigned long long ulp)
+{
+	if (esize != sizeof(float) && esize != sizeof(double)) {
+		return 1;
+	}
+	if (act == exp) {
+		return 0;
+	}
+	if (act == NULL || exp == NULL) {
+		return 1;
+	}
+
+	return t_farr_mismatch(act, exp, cnt, esize, eps, ulp) == cnt ? 0 : 1;
+}
+
+static void print_header(int passed, const char *file, const char *func, int line)
+{
+	if (passed && s_data.table.name) {
+		t_indent();
+		pvr();
+		t_printf("\033[0;31mFAIL %s_%zu\033[0m\n", s_data.table.name, s_data.table.row);
+	} else if (passed && func) {
+		t_indent();
+		pvr();
+		t_printf("\033[0;31mFAIL %s\033[0m\n", t_func_name(func));
+	}
+
+	t_indent();
+	pv();
+
+	t_printf("\033[0;31m");
+
+	if (file == NULL) {
+		return;
+	}
+
+	t_printf("%s:%d: ", file, line);
+}
+
+// clang-format off
+#define get_char(_size, _args) \
+	(char)va_arg(_args, int)
+
+#define get_short(_size, _args)                  \
+	_size == 1 ? (short)va_arg(_args, int) : \
+	_size == 2 ? (short)va_arg(_args, int) : \
+		     0
+
+#define get_int(_size, _args)                  \
+	_size == 1 ? (int)va_arg(_args, int) : \
+	_size == 2 ? (int)va_arg(_args, int) : \
+	_size == 4 ? (int)va_arg(_args, int) : \
+		     0
+// clang-format on
+
+#define get_long(_size, _args)                                                                                                             \
+	_size == 1   ? (long long)va_arg(_args, int)                                                                                       \
+	: _size == 2 ? (long long)va_arg(_args, int)                                                                                       \
+	: _size == 4 ? (long long)va_arg(_args, int)                                                                                       \
+	: _size == 8 ? (long long)va_arg(_args, long long)                                                                                 \
+		     : 0
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static void print_values(int passed, const char *file, const char *func, int line, const char *act, size_t act_size, const char *exp,
+			 size_t exp_size, const char *cond, va_list args)
+{
+	print_header(passed, file, func, line);
+	t_printf("%s %s %s (", act, cond, exp);
+
+	int max_size = MAX((int)act_size, (int)exp_size);
+
+	switch (max_size) {
+	case 0: {
+		const unsigned char a = get_char(act_size, args);
+		const unsigned char b = get_char(exp_size, args);
+
+		t_printf("%c %s %c", a ? '1' : '0', cond, b ? '1' : '0');
+		break;
+	}
+	case 1: {
+		const unsigned char a = get_char(act_size, args);
+		const unsigned char b = get_char(exp_size, args);
 
 		t_printf(BYTE_TO_BIN_PATTERN " %s " BYTE_TO_BIN_PATTERN, BYTE_TO_BIN(a), cond, BYTE_TO_BIN(b));
 		break;
 	}
-	case 2: {
-		const unsigned short a = get_short(act_size, args);
-		const unsigned short b = get_short(exp_size, args);
+	case 2: {
+		const unsigned short a = get_short(act_size, args);
+		const unsigned short b = get_short(exp_size, args);
+
+		t_printf("%04X %s %04X", a, cond, b);
+		break;
+	}
+	case 4: {
+		const int a = get_int(act_size, args);
+		const int b = get_int(exp_size, args);
+
+		t_printf("%08X %s %08X", a, cond, b);
+		break;
+	}
+	case 8: {
+		const long long a = get_long(act_size, args);
+		const long long b = get_long(exp_size, args);
+
+		t_printf("%016llX %s %016llX", a, cond, b);
+		break;
+	}
+	default:
+		t_printf("Unsupported type of size: %zu", act_size);
+		break;
+	}
+
+	t_printf(")");
+}
+
+void t_expect_ch(int passed, const char *file, const char *func, int line, const char *check)
+{
+	s_data.expect_failed++;
+	print_header(passed, file, func, line);
+	t_printf("%s\033[0m\n", check);
+}
+
+void t_expect_g(int passed, const char *file, const char *func, int line, const char *act, size_t act_size, const char *exp,
+		size_t exp_size, const char *cond, ...)
+{
+	s_data.expect_failed++;
+	va_list args;
+	va_start(args, cond);
+	print_values(passed, file, func, line, act, act_size, exp, exp_size, cond, args);
+	va_end(args);
+
+	t_printf("\033[0m\n");
+}
+
+void t_expect_m(int passed, const char *file, const char *func, int line, const char *act, size_t act_size, const char *exp,
+		size_t exp_size, unsigned char mask, const char *cond, ...)
+{
+	s_data.expect_failed++;
+	va_list args;
+	va_start(args, cond);
+	print_values(passed, file, func, line, act, act_size, exp, exp_size, cond, args);
+	va_end(args);
+
+	t_printf(" & " BYTE_TO_BIN_PATTERN "\033[0m\n", BYTE_TO_BIN(mask));
+}
+
+void t_expect_p(int passed, const char *file, const char *func, int line, const char *act, const char *exp, const char *cond,
+		const void *act_ptr, const void *exp_ptr)
+{
+	s_data.expect_failed++;
+	print_header(passed, file, func, line);
+	t_printf("%s %s %s (%0*" PRIXPTR " %s %0*" PRIXPTR ")\033[0m\n",
+		 act,
+		 cond,
+		 exp,
+		 PTR_HEX_WIDTH,
+		 (uintptr_t)act_ptr,
+		 cond,
+		 PTR_HEX_WIDTH,
+		 (uintptr_t)exp_ptr);
+}
+
+static int print_line(int passed, const char *h, const char *str, size_t ln, size_t col, size_t line_start, size_t line_end, size_t *h_len)
+{
+	print_header(passed, NULL, NULL, 0);
+
+	int app = 0;
+	*h_len	= t_printf("%s:%zu: ", h, ln);
+	for (size_t i = 0; i < line_end - line_start; i++) {
+		char c = str[line_start + i];
+		// clang-format off
+		switch (c) {
+		case '\n': t_printf("\\n"); app += (i <= col ? 1 : 0); break;
+		case '\r': t_printf("\\r"); app += (i <= col ? 1 : 0); break;
+		case '\t': t_printf("\\t"); app += (i <= col ? 1 : 0); break;
+		case '\033': t_printf("\\033"); app += (i <= col ? 3 : 0); break;
+		default: t_printf("%c", c); break;
+		}
+		// clang-format on
+	}
+
+	t_printf("\033[0m\n");
+
+	return app;
+}
+
+static void print_str_at(int passed, const char *file, const char *func, int line, const char *act_str, const char *exp_str, size_t act_len,
+			 size_t exp_len, size_t ln)
+{
+	size_t min  = MIN(exp_len, act_len);
+	size_t max  = MAX(exp_len, act_len);
+	size_t diff = t_mismatch(act_str, exp_str, min);
+	if (diff == min) {
+		// Past the end of the shorter string only '\0' compares equal
+		const char *rest = act_len > exp_len ? act_str : exp_str;
+		while (diff < max && rest[diff] == '\0') {
+			diff++;
+		}
+	}
+
+	size_t line_start = 0;
+	ln += t_count_nl(exp_str, MIN(diff, exp_len), sizeof(char), &line_start);
+	size_t col = diff - line_start;
+
+	const char *exp_nl  = diff < exp_len ? memchr(exp_str + diff, '\n', exp_len - diff) : NULL;
+	const char *act_nl  = diff < act_len ? memchr(act_str + diff, '\n', act_len - diff) : NULL;
+	size_t exp_line_end = exp_nl ? (size_t)(exp_nl - exp_str) + 1 : 0;
+	size_t act_line_end = act_nl ? (size_t)(act_nl - act_str) + 1 : 0;
+
+	print_header(passed, file, func, line);
+	t_printf("\033[0m\n");
+
+	size_t h_len;
+	int exp_app = print_line(passed, "exp", exp_str, ln, col, line_start, exp_line_end == 0 ? exp_len : exp_line_end, &h_len);
+	int act_app = print_line(passed, "act", act_str, ln, col, line_start, act_line_end == 0 ? act_len : act_line_end, &h_len);
+
+	print_header(passed, NULL, NULL, 0);
+	t_printf("%*s^\033[0m\n", (int)h_len + MIN(act_app, exp_app) + col, "");
+}
+
+static void print_str(int passed, const char *file, const char *func, int line, const char *act_str, const char *exp_str, size_t act_len,
+		      size_t exp_len)
+{
+	print_str_at(passed, file, func, line, act_str, exp_str, act_len, exp_len, 0);
+}
+
+static int print_wline(int passed, const char *h, const wchar_t *str, size_t ln, size_t col, size_t line_start, size_t line_end,
+		       size_t *h_len)
+{
+	print_header(passed, NULL, NULL, 0);
+
+	int app = 0;
+	*h_len	= t_printf("%s:%zu: ", h, ln);
+	c_startw(stdout);
+	for (size_t i = 0; i < line_end - line_start; i++) {
+		wchar_t c = str[line_start + i];
+		// clang-format off
+		switch (c) {
+		case L'\n': t_wprintf(L"\\n"); app += (i <= col ? 1 : 0); break;
+		case L'\r': t_wprintf(L"\\r"); app += (i <= col ? 1 : 0); break;
+		case L'\t': t_wprintf(L"\\t"); app += (i <= col ? 1 : 0); break;
+		case L'\033': t_wprintf(L"\\033"); app += (i <= col ? 3 : 0); break;
+		default: t_wprintf(L"%c", c); break;
+		}
+		// clang-format on
+	}
+	c_endw(stdout);
+
+	t_printf("\033[0m\n");
+
+	return app;
+}
+
+static void print_wstr(int passed, const char *file, const char *func, int line, const wchar_t *act_str, const wchar_t *exp_str,
+		       size_t act_len, size_t exp_len)
+{
+	size_t min  = MIN(exp_len, act_len);
+	size_t max  = MAX(exp_len, act_len);
+	size_t diff = t_mismatch(act_str, exp_str, min * sizeof(wchar_t)) / sizeof(wchar_t);
+	if (diff == min) {
+		// Past the end of the shorter string only '\0' compares equal
+		const wchar_t *rest = act_len > exp_len ? act_str : exp_str;
+		while (diff < max && rest[diff] == L'\0') {
+			diff++;
+		}
+	}
+
+	size_t line_start = 0;
+	size_t ln	  = t_count_nl(exp_str, MIN(diff, exp_len), sizeof(wchar_t), &line_start);
+	size_t col	  = diff - line_start;
+
+	const wchar_t *exp_nl = diff < exp_len ? wmemchr(exp_str + diff, L'\n', exp_len - diff) : NULL;
+	const wchar_t *act_nl = diff < act_len ? wmemchr(act_str + diff, L'\n', act_len - diff) : NULL;
+	size_t exp_line_end   = exp_nl ? (size_t)(exp_nl - exp_str) + 1 : 0;
+	size_t act_line_end   = act_nl ? (size_t)(act_nl - act_str) + 1 : 0;
+
+	print_header(passed, file, func, line);
+	t_printf("\033[0m\n");
+
+	size_t h_len;
+	int exp_app = print_wline(passed, "exp", exp_str, ln, col, line_start, exp_line_end == 0 ? exp_len : exp_line_end, &h_len);
+	int act_app = print_wline(passed, "act", act_str, ln, col, line_start, act_line_end == 0 ? act_len : act_line_end, &h_len);
+
+	print_header(passed, NULL, NULL, 0);
+	t_printf("%*s^\033[0m\n", (int)h_len + MIN(act_app, exp_app) + col, "");
+}
+
+void t_expect_str(int passed, const char *file, const char *func, int line, const char *act, const char *exp)
+{
+	s_data.expect_failed++;
+	print_str(passed, file, func, line, act, exp, act == NULL ? 0 : t_strlen(act), exp == NULL ? 0 : t_strlen(exp));
+}
+
+void t_expect_strn(int passed, const char *file, const char *func, int line, const char *act, const char *exp, size_t len)
+{
+	s_data.expect_failed++;
+	print_str(passed, file, func, line, act, exp, MIN(len, act == NULL ? 0 : t_strlen(act)), exp == NULL ? 0 : t_strlen(exp));
+}
+
+void t_expect_fmt(int passed, const char *file, const char *func, int line, const char *act, unsigned int cnt, ...)
+{
+	s_data.expect_failed++;
+	va_list args;
+	va_start(args, cnt);
+	const char *exp = va_arg(args, const char *);
+	va_end(args);
+
+	print_str(passed, file, func, line, act, exp, t_strlen(act), t_strlen(exp));
+}
+
+void t_expect_wstr(int passed, const char *file, const char *func, int line, const wchar_t *act, const wchar_t *exp)
+{
+	s_data.expect_failed++;
+	print_wstr(passed, file, func, line, act, exp, act == NULL ? 0 : t_wcslen(act), exp == NULL ? 0 : t_wcslen(exp));
+}
+
+void t_expect_wstrn(int passed, const char *file, const char *func, int line, const wchar_t *act, const wchar_t *exp, size_t len)
+{
+	s_data.expect_failed++;
+	print_wstr(passed, file, func, line, act, exp, MIN(len, act == NULL ? 0 : t_wcslen(act)), exp == NULL ? 0 : t_wcslen(exp));
+}
+
+// Prints one row of elements, floats use a fixed width so the caret lines up
+static int print_mem_row(int passed, const char *h, const char *ptr, size_t start, size_t end, size_t esize, int flt)
+{
+	print_header(passed, NULL, NULL, 0);
+
+	int h_len = (int)t_printf("%s:%zu:", h, start);
+	for (size_t i = start; i < end; i++) {
+		const char *elem = ptr + i * esize;
+		if (flt && esize == sizeof(float)) {
+			float val;
+			memcpy(&val, elem, sizeof(val));
+			t_printf(" % .8e", (double)val);
+		} else if (flt) {
+			double val;
+			memcpy(&val, elem, sizeof(val));
+			t_printf(" % .16e", val);
+		} else {
+			t_printf(" ");
+			for (size_t j = esize; j-- > 0;) {
+				t_printf("%02X", (unsigned char)elem[j]);
+			}
+		}
+	}
+
+	t_printf("\033[0m\n");
+
+	return h_len;
+}
+
+static void print_mem(int passed, const char *file, const char *func, int line, const char *act_str, const char *exp_str, const void *act,
+		      const void *exp, size_t cnt, size_t esize, int flt, size_t diff)
+{
+	if (act == NULL || exp == NULL) {
+		print_header(passed, file, func, line);
+		t_printf("%s == %s (%s is NULL)\033[0m\n", act_str, exp_str, act == NULL ? act_str : exp_str);
+		return;
+	}
+
+	print_header(passed, file, func, line);
+	t_printf("%s == %s (%s %zu of %zu)\033[0m\n", act_str, exp_str, esize == 1 && !flt ? "byte" : "index", diff, cnt);
+
+	// Integers are printed in hex as they are stored, most significant byte first
+	size_t width = flt ? (esize == sizeof(float) ? 16 : 24) : esize * 2 + 1;
+	size_t row   = MAX(T_MEM_ROW / esize, 4);
+	size_t start = diff / row * row;
+	size_t end   = MIN(start + row, cnt);
+
+	int h_len = print_mem_row(passed, "exp", exp, start, end, esize, flt);
+	print_mem_row(passed, "act", act, start, end, esize, flt);
+
+	print_header(passed, NULL, NULL, 0);
+	t_printf("%*s^\033[0m\n", h_len + 1 + (int)((diff - start) * width), "");
+}
+
+void t_expect_mem(int passed, const char *file, const char *func, int line, const char *act_str, const char *exp_str, const void *act,
+		  const void *exp, size_t cnt, size_t esize)
+{
+	s_data.expect_failed++;
+	size_t diff = act && exp ? t_mismatch(act, exp, cnt * esize) / esize : 0;
+	print_mem(passed, file, func, line, act_str, exp_str, act, exp, cnt, esize, 0, diff);
+}
+
+void t_expect_farr(int passed, const char *file, const char *func, int line, const char *act_str, const char *exp_str, const void *act,
+		   const void *exp, size_t cnt, size_t esize, double eps, unsigned long long ulp)
+{
+	s_data.expect_failed++;
+	if (esize != sizeof(float) && esize != sizeof(double)) {
+		print_header(passed, file, func, line);
+		t_printf("Unsupported type of size: %zu\033[0m\n", esize);
+		return;
+	}
+
+	size_t diff = act && exp ? t_farr_mismatch(act, exp, cnt, esize, eps, ulp) : 0;
+	print_mem(passed, file, func, line, act_str, exp_str, act, exp, cnt, esize, 1, diff);
+}
+
+void t_expect_alloc(int passed, const char *file, const char *func, int line, const char *what, const char *mark, unsigned long long act,
+		    unsigned long long max)
+{
+	s_data.expect_failed++;
+	print_header(passed, file, func, line);
+	if (!t_alloc_counted()) {
+		t_printf("%s since %s: not counted without a glibc build with T_ALLOC_HOOK and no sanitizer\033[0m\n", what, mark);
+		return;
+	}
+	t_printf("%s since %s: %llu > %llu\033[0m\n", what, mark, act, max);
+}
+
+void t_expect_fail(int passed, const char *fmt, ...)
+{
+	s_data.expect_failed++;
+	print_header(passed, NULL, NULL, 0);
+
+	va_list args;
+	va_start(args, fmt);
+	t_printv(fmt, args);
+	va_end(args);
+
+	t_printf("\033[0m\n");
+}
+
+// Compares a write at the current offset, only the start of the output after the first mismatch is kept
+static int t_stream_write(tstream_t *stream, const char *exp, const char *str, size_t len)
+{
+	size_t i = 0;
+	if (stream->diff == (size_t)-1) {
+		while (i < len && stream->off + i < stream->exp_len && str[i] == exp[stream->off + i]) {
+			i++;
+		}
+
+		if (i == len) {
+			stream->off += len;
+			return 0;
+		}
+
+		stream->diff = stream->off + i;
+	}
+
+	int full = stream->win_len > 0 && (stream->win_len == sizeof(stream->win) || stream->win[stream->win_len - 1] == '\n');
+	for (; i < len && !full; i++) {
+		stream->win[stream->win_len++] = str[i];
+		full = stream->win_len == sizeof(stream->win) || str[i] == '\n';
+	}
+
+	stream->off += len;
+	return full ? 1 : 0;
+}
+
+int t_fprintf(void *priv, const char *fmt, ...)
+{
+	(void)priv;
+
+	tarena_t *arena = &s_data.buf;
+	if (s_data.stream.on) {
+		// Only the current write is kept
+		t_arena_reset(arena);
+	}
+
+	tchunk_t *tail = arena->tail;
+
+	va_list args;
+	va_start(args, fmt);
+	int ret = vsnprintf(tail ? tail->data + tail->len : NULL, tail ? tail->size - tail->len : 0, fmt, args);
+	va_end(args);
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (tail == NULL || (size_t)ret >= tail->size - tail->len) {
+		tail = t_arena_reserve(arena, (size_t)ret + 1);
+		if (tail == NULL) {
+			return -1;
+		}
+
+		va_start(args, fmt);
+		vsnprintf(tail->data + tail->len, tail->size - tail->len, fmt, args);
+		va_end(args);
+	}
+
+	tail->len += (size_t)ret;
+	arena->len += (size_t)ret;
+
+	if (s_data.stream.on && t_stream_write(&s_data.stream, s_data.exp, tail->data + tail->len - ret, (size_t)ret)) {
+		// The output already differs, the caller can stop printing
+		return -1;
+	}
+
+	return ret;
+}
+
+void t_expect_fstr_start(const char *exp, size_t len)
+{
+	s_data.exp	 = exp;
+	s_data.exp_len	 = len;
+	s_data.stream.on = 0;
+
+	t_arena_reset(&s_data.buf);
+}
+
+void t_expect_fstr_stream_start(const char *exp, size_t len)
+{
+	s_data.exp	      = exp;
+	s_data.exp_len	      = len;
+	s_data.stream.on      = 1;
+	s_data.stream.exp_len = exp == NULL ? 0 : t_strlen(exp);
+	s_data.stream.off     = 0;
+	s_data.stream.diff    = (size_t)-1;
+	s_data.stream.win_len = 0;
+
+	t_arena_reset(&s_data.buf);
+}
+
+static int t_expect_fstr_stream_end(int passed, const char *file, const char *func, int line)
+{
+	tstream_t *stream = &s_data.stream;
+	const char *exp	  = s_data.exp;
+
+	stream->on = 0;
+	if (stream->diff == (size_t)-1 && stream->off != stream->exp_len) {
+		stream->diff = stream->off;
+	}
+
+	int ret = exp == NULL || stream->diff != (size_t)-1;
+	if (!ret) {
+		return ret;
+	}
+
+	size_t ln	  = 0;
+	size_t line_start = 0;
+	for (size_t i = 0; exp && i < stream->diff; i++) {
+		if (exp[i] == '\n') {
+			ln++;
+			line_start = i + 1;
+		}
+	}
+
+	// The output matched the expected string up to the mismatch
+	size_t act_len = exp == NULL ? 0 : stream->diff - line_start + stream->win_len;
+	s_data.alloc_guard++;
+	char *act = malloc(act_len + 1);
+	s_data.alloc_guard--;
+	if (act) {
+		if (exp) {
+			memcpy(act, exp + line_start, stream->diff - line_start);
+			memcpy(act + stream->diff - line_start, stream->win, stream->win_len);
+		}
+		act[act_len] = '\0';
+	}
+
+	print_str_at(passed, file, func, line, act, exp ? exp + line_start : NULL, act ? act_len : 0, stream->exp_len - line_start, ln);
+	t_guard_free(act);
+
+	return ret;
+}
+
+int t_expect_fstr_end(int passed, const char *file, const char *func, int line)
+{
+	if (s_data.stream.on) {
+		int ret = t_expect_fstr_stream_end(passed, file, func, line);
+		s_data.expect_failed += ret != 0;
+		return ret;
+	}
+
+	const tarena_t *arena = &s_data.buf;
+	const char *exp	      = s_data.exp;
+
+	int ret = exp == NULL || arena->len != t_strlen(exp);
+
+	size_t off = 0;
+	for (const tchunk_t *chunk = arena->head; !ret && chunk && off < arena->len; chunk = chunk->next) {
+		ret = memcmp(chunk->data, exp + off, chunk->len) != 0;
+		off += chunk->len;
+		if (chunk == arena->tail) {
+			break;
+		}
+	}
+
+	if (ret) {
+		s_data.expect_failed++;
+
+		// Only a failing comparison needs the output in one piece
+		s_data.alloc_guard++;
+		char *act = malloc(arena->len + 1);
+		s_data.alloc_guard--;
+		if (act) {
+			off = 0;
+			for (const tchunk_t *chunk = arena->head; chunk && off < arena->len; chunk = chunk->next) {
+				memcpy(act + off, chunk->data, chunk->len);
+				off += chunk->len;
+				if (chunk == arena->tail) {
+					break;
+				}
+			}
+			act[arena->len] = '\0';
+		}
+
+		print_str(passed, file, func, line, act, exp, act ? arena->len : 0, s_data.exp_len);
+		t_guard_free(act);
+	}
+
+	return ret;
+}
+
+static unsigned long long t_rotl(unsigned long long x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+// xoshiro256**
+static unsigned long long t_rng_next(unsigned long long *s)
+{
+	unsigned long long res = t_rotl(s[1] * 5, 7) * 9;
+	unsigned long long t   = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = t_rotl(s[3], 45);
+
+	return res;
+}
+
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 tu128_t;
+#endif
+
+// Maps a random value to [0, max] with a multiplication instead of a division where the compiler has 128-bit integers
+static unsigned long long t_rng_bound(unsigned long long r, unsigned long long max)
+{
+	if (max == ULLONG_MAX) {
+		return r;
+	}
+
+#if defined(__SIZEOF_INT128__)
+	return (unsigned long long)(((tu128_t)r * (max + 1)) >> 64);
+#else
+	return r % (max + 1);
+#endif
+}
+
+static int t_prop_grow(tprop_t *prop)
+{
+	if (prop->cap >= T_PROP_DRAWS) {
+		return 1;
+	}
+
+	size_t cap = prop->cap ? prop->cap * 2 : 256;
+
+	s_data.alloc_guard++;
+	unsigned long long *draws = realloc(prop->draws, cap * sizeof(*draws));
+	s_data.alloc_guard--;
+	if (draws == NULL) {
+		return 1;
+	}
+
+	prop->draws = draws;
+	prop->cap   = cap;
+	return 0;
+}
+
+unsigned long long t_gen_choice(unsigned long long max)
+{
+	tprop_t *prop = &s_data.prop;
+
+	unsigned long long val;
+	if (prop->replay) {
+		val = prop->pos < prop->prefix_len ? prop->prefix[prop->pos] : 0;
+		val = val < max ? val : max;
+		prop->pos++;
+	} else {
+		unsigned long long r = t_rng_next(prop->rng);
+		if ((r & 0x1f) == 0) {
+			// Values next to the bounds are drawn more often than uniform draws would find them
+			unsigned long long d = (r >> 5) & 3;
+			val		     = d > max ? max : r & 0x80 ? max - d : d;
+		} else {
+			val = t_rng_bound(r, max);
+		}
+	}
+
+	if (prop->on && (prop->len < prop->cap || !t_prop_grow(prop))) {
+		prop->draws[prop->len++] = val;
+	}
+
+	return val;
+}
+
+unsigned long long t_gen_uint(unsigned long long min, unsigned long long max)
+{
+	if (min > max) {
+		unsigned long long tmp = min;
+		min		       = max;
+		max		       = tmp;
+	}
+
+	return min + t_gen_choice(max - min);
+}
+
+// Negates a magnitude up to 2^63 without overflowing
+static long long t_neg(unsigned long long val)
+{
+	return val == 0 ? 0 : -(long long)(val - 1) - 1;
+}
+
+long long t_gen_int(long long min, long long max)
+{
+	if (min > max) {
+		long long tmp = min;
+		min	      = max;
+		max	      = tmp;
+	}
+
+	unsigned long long val = t_gen_choice((unsigned long long)max - (unsigned long long)min);
+	if (min >= 0) {
+		return (long long)((unsigned long long)min + val);
+	}
+	if (max <= 0) {
+		return t_neg(0 - (unsigned long long)max + val);
+	}
+
+	// Small choices alternate around 0: 0, 1, -1, 2, -2 and continue on the longer side
+	unsigned long long pos	= (unsigned long long)max;
+	unsigned long long neg	= 0 - (unsigned long long)min;
+	unsigned long long both = pos < neg ? pos : neg;
+	if (val <= both * 2) {
+		return val & 1 ? (long long)((val + 1) / 2) : t_neg(val / 2);
+	}
+
+	return pos > neg ? (long long)(val - both) : t_neg(val - both);
+}
+
+// Values of a case are kept in the property arena until the next case starts
+static char *t_prop_reserve(size_t len)
+{
+	if (!s_data.prop.on) {
+		return NULL;
+	}
+
+	tchunk_t *chunk = t_arena_reserve(&s_data.prop.mem, len);
+	return chunk ? chunk->data + chunk->len : NULL;
+}
+
+// Each element is preceded by a choice to continue, a 0 ends the sequence
+static int t_gen_more(size_t len, size_t max)
+{
+	return len < max && t_gen_choice(max / 2 > 0 ? max / 2 : 1) != 0;
+}
+
+const char *t_gen_str(size_t max, const char *chars)
+{
+	size_t cnt = chars ? t_strlen(chars) : 0;
+	char *str  = t_prop_reserve(max + 1);
+	if (str == NULL || (chars && cnt == 0)) {
+		return "";
+	}
+
+	size_t len = 0;
+	while (t_gen_more(len, max)) {
+		str[len++] = chars ? chars[t_gen_choice(cnt - 1)] : (char)(' ' + t_gen_choice('~' - ' '));
+	}
+	str[len] = '\0';
+
+	s_data.prop.mem.tail->len += len + 1;
+	return str;
+}
+
+tgen_buf_t t_gen_buf(size_t max)
+{
+	tgen_buf_t buf = {0};
+
+	buf.data = (unsigned char *)t_prop_reserve(max + 1);
+	if (buf.data == NULL) {
+		return buf;
+	}
+
+	while (t_gen_more(buf.len, max)) {
+		buf.data[buf.len++] = (unsigned char)t_gen_choice(UCHAR_MAX);
+	}
+
+	s_data.prop.mem.tail->len += buf.len + 1;
+	return buf;
+}
+
+void t_prop_show(const char *fmt, ...)
+{
+	if (!s_data.prop.show) {
+		return;
+	}
+
+	t_indent();
+	pv();
+	t_printf("\033[0;31m");
+
+	va_list args;
+	va_start(args, fmt);
+	t_printv(fmt, args);
+	va_end(args);
+
+	t_printf("\033[0m\n");
+}
+
+void t_prop_show_buf(const char *name, tgen_buf_t buf)
+{
+	if (!s_data.prop.show) {
+		return;
+	}
+
+	t_indent();
+	pv();
+	t_printf("\033[0;31m%s =", name);
+	for (size_t i = 0; i < buf.len && i < T_MEM_ROW; i++) {
+		t_printf(" %02X", buf.data[i]);
+	}
+	t_printf("%s (%zu B)\033[0m\n", buf.len > T_MEM_ROW ? " ..." : "", buf.len);
+}
+
+// Runs one case, drawing from the random stream or replaying prefix, returns 1 if an expectation failed
+static int t_prop_case(prop_fn fn, const unsigned long long *prefix, size_t prefix_len)
+{
+	tprop_t *prop = &s_data.prop;
+
+	prop->replay	 = prefix != NULL;
+	prop->prefix	 = prefix;
+	prop->prefix_len = prefix_len;
+	prop->pos	 = 0;
+	prop->len	 = 0;
+	t_arena_reset(&prop->mem);
+
+	const long long failed = s_data.expect_failed;
+	fn(0);
+
+	return s_data.expect_failed != failed;
+}
+
+static void t_prop_seed(unsigned long long seed)
+{
+	for (int i = 0; i < 4; i++) {
+		s_data.prop.rng[i] = t_splitmix(&seed);
+	}
+}
+
+// Shorter choice sequences are simpler, then the one with the smaller first differing choice
+static int t_prop_simpler(const unsigned long long *a, size_t a_len, const unsigned long long *b, size_t b_len)
+{
+	if (a_len != b_len) {
+		return a_len < b_len;
+	}
+
+	for (size_t i = 0; i < a_len; i++) {
+		if (a[i] != b[i]) {
+			return a[i] < b[i];
+		}
+	}
+
+	return 0;
+}
+
+typedef struct tshrink_s {
+	unsigned long long *best;
+	size_t len;
+	unsigned long long *cand;
+	int runs;
+	int steps;
+} tshrink_t;
+
+// Replays the first len candidate choices, they become the best ones if the case still fails with simpler choices
+static int t_prop_try(prop_fn fn, tshrink_t *shrink, size_t len)
+{
+	if (shrink->runs >= T_PROP_SHRINKS) {
+		return 0;
+	}
+	shrink->runs++;
+
+	const tprop_t *prop = &s_data.prop;
+	if (!t_prop_case(fn, shrink->cand, len) || !t_prop_simpler(prop->draws, prop->len, shrink->best, shrink->len)) {
+		return 0;
+	}
+
+	memcpy(shrink->best, prop->draws, prop->len * sizeof(*prop->draws));
+	shrink->len = prop->len;
+	shrink->steps++;
+	return 1;
+}
+
+static void t_prop_shrink(prop_fn fn, tshrink_t *shrink)
+{
+	const size_t size = sizeof(*shrink->best);
+
+	int progress = 1;
+	while (progress && shrink->runs < T_PROP_SHRINKS) {
+		progress = 0;
+
+		// Deleting runs of choices removes elements from the end first
+		for (size_t k = 8; k > 0; k /= 2) {
+			for (size_t i = shrink->len >= k ? shrink->len - k + 1 : 0; i-- > 0;) {
+				if (i + k > shrink->len) {
+					continue;
+				}
+
+				memcpy(shrink->cand, shrink->best, i * size);
+				memcpy(shrink->cand + i, shrink->best + i + k, (shrink->len - i - k) * size);
+				progress |= t_prop_try(fn, shrink, shrink->len - k);
+			}
+		}
+
+		// Each choice is lowered to the smallest one that still fails, assuming larger ones do too
+		for (size_t i = 0; i < shrink->len && shrink->runs < T_PROP_SHRINKS; i++) {
+			unsigned long long lo = 0;
+			while (i < shrink->len && lo < shrink->best[i] && shrink->runs < T_PROP_SHRINKS) {
+				memcpy(shrink->cand, shrink->best, shrink->len * size);
+				shrink->cand[i] = lo + (shrink->best[i] - lo) / 2;
+				if (t_prop_try(fn, shrink, shrink->len)) {
+					progress = 1;
+				} else {
+					lo = shrink->cand[i] + 1;
+				}
+			}
+		}
+	}
+}
+
+int t_prop(prop_fn fn, const char *func)
+{
+	tprop_t *prop = &s_data.prop;
+
+	unsigned long long seed	 = prop->seeded ? prop->seed : t_wall() ^ t_fnv1a(s_data.path, s_data.path_len);
+	unsigned long long chain = seed;
+	int cases		 = prop->cases > 0 ? prop->cases : T_PROP_CASES;
+
+	s_data.repeat.drawn = 1;
+
+	prop->on    = 1;
+	prop->quiet = 1;
+
+	int cnt    = 0;
+	int failed = 0;
+	while (cnt < cases && !failed) {
+		if (cnt > 0) {
+			seed = t_splitmix(&chain);
+		}
+		t_prop_seed(seed);
+		failed = t_prop_case(fn, NULL, 0);
+		cnt++;
+	}
+
+	if (failed) {
+		tshrink_t shrink = {0};
+		size_t size	 = (prop->len > 0 ? prop->len : 1) * sizeof(*prop->draws);
+
+		s_data.alloc_guard++;
+		shrink.best = malloc(size);
+		shrink.cand = malloc(size);
+		s_data.alloc_guard--;
+
+		if (shrink.best && shrink.cand) {
+			memcpy(shrink.best, prop->draws, prop->len * sizeof(*prop->draws));
+			shrink.len = prop->len;
+			t_prop_shrink(fn, &shrink);
+		}
+
+		prop->quiet = 0;
+		print_header(1, NULL, func, 0);
+		t_printf("falsified by case %d, shrunk %d times, reproduce with --seed %llu\033[0m\n", cnt, shrink.steps, seed);
+
+		// The simplest failing case runs once more to print its values and expectations
+		prop->show = 1;
+		int again;
+		if (shrink.best && shrink.cand) {
+			again = t_prop_case(fn, shrink.best, shrink.len);
+		} else {
+			t_prop_seed(seed);
+			again = t_prop_case(fn, NULL, 0);
+		}
+
+		if (!again) {
+			t_indent();
+			pv();
+			t_printf("\033[0;31mthe case passed when it was replayed\033[0m\n");
+		}
+
+		t_guard_free(shrink.best);
+		t_guard_free(shrink.cand);
+	}
+
+	t_guard_free(prop->draws);
+	t_arena_free(&prop->mem);
+
+	prop->on     = 0;
+	prop->replay = 0;
+	prop->quiet  = 0;
+	prop->show   = 0;
+	prop->draws  = NULL;
+	prop->len    = 0;
+	prop->cap    = 0;
+	prop->prefix = NULL;
+
+	return failed;
+}
+
+#if defined(T_FUZZ_COV) && !defined(C_WIN)
+
+static uint32_t s_fuzz_guards;
+
+T_NO_COV void __sanitizer_cov_trace_pc_guard_init(uint32_t *start, uint32_t *stop)
+{
+	if (start == stop || *start) {
+		return;
+	}
+
+	for (uint32_t *guard = start; guard < stop; guard++) {
+		*guard = ++s_fuzz_guards;
+	}
+}
+
+// Called on every edge of code built with -fsanitize-coverage=trace-pc-guard
+T_NO_COV void __sanitizer_cov_trace_pc_guard(uint32_t *guard)
+{
+	unsigned char *map = s_data.fuzz.map;
+	if (map) {
+		map[*guard & (T_FUZZ_MAP - 1)]++;
+	}
+}
+
+// Called on every block of code built with -fsanitize-coverage=trace-pc, edges are told apart by the blocks at both ends
+T_NO_COV void __sanitizer_cov_trace_pc(void)
+{
+	unsigned char *map = s_data.fuzz.map;
+	if (map == NULL) {
+		return;
+	}
+
+	unsigned long long cur = (unsigned long long)(uintptr_t)__builtin_return_address(0) * 0x9E3779B97F4A7C15ULL >> 48;
+	map[(cur ^ s_data.fuzz.prev) & (T_FUZZ_MAP - 1)]++;
+	s_data.fuzz.prev = cur >> 1;
+}
+
+#endif
+
+typedef struct tinput_s {
+	unsigned char *data;
+	size_t len;
+	char *path;
+} tinput_t;
+
+// Corpus of a fuzz target and the coverage seen so far, map counts the edges of the latest run
+typedef struct tfuzzer_s {
+	const char *func;
+	const char *corpus;
+	char dir[T_PATH_MAX];
+	tinput_t *inputs;
+	size_t cnt;
+	size_t cap;
+	unsigned long long *map;
+	unsigned char *seen;
+	size_t news[T_FUZZ_NEWS];
+	unsigned char bits[T_FUZZ_NEWS];
+	int news_cnt;
+	unsigned long long rng[4];
+	unsigned long long execs;
+} tfuzzer_t;
+
+// Takes data and path, they are freed if the input cannot be added
+static int t_fuzz_add(tfuzzer_t *fz, unsigned char *data, size_t len, char *path)
+{
+	if (fz->cnt == fz->cap) {
+		size_t cap	 = fz->cap ? fz->cap * 2 : 64;
+		tinput_t *inputs = realloc(fz->inputs, cap * sizeof(*inputs));
+		if (inputs == NULL) {
+			free(data);
+			free(path);
+			return 1;
+		}
+		fz->inputs = inputs;
+		fz->cap	   = cap;
+	}
+
+	fz->inputs[fz->cnt++] = (tinput_t){.data = data, .len = len, .path = path};
+	return 0;
+}
+
+// Runs the target on a copy of exactly len bytes so that the sanitizers catch reads past the input
+static int t_fuzz_run(fuzz_fn fn, const unsigned char *data, size_t len)
+{
+	unsigned char *input = malloc(len > 0 ? len : 1);
+	if (input == NULL) {
+		return 0;
+	}
+	if (len > 0) {
+		memcpy(input, data, len);
+	}
+
+	if (s_data.fuzz.map) {
+		memset(s_data.fuzz.map, 0, T_FUZZ_MAP);
+	}
+	s_data.fuzz.prev      = 0;
+	s_data.fuzz.input     = input;
+	s_data.fuzz.input_len = len;
+
+	const long long failed = s_data.expect_failed;
+	fn(0, input, len);
+
+	s_data.fuzz.input = NULL;
+	free(input);
+
+	return s_data.expect_failed != failed;
+}
+
+// Edge counts are compared in power of two buckets, like AFL does
+static unsigned char t_fuzz_bucket(unsigned char cnt)
+{
+	return cnt < 4 ? (unsigned char)(cnt == 3 ? 4 : cnt) : cnt < 8 ? 8 : cnt < 16 ? 16 : cnt < 32 ? 32 : cnt < 128 ? 64 : 128;
+}
+
+// Finds the buckets of the latest run that no input reached before
+static int t_fuzz_news(tfuzzer_t *fz)
+{
+	const unsigned char *map = (const unsigned char *)fz->map;
+	const size_t word	 = sizeof(*fz->map);
+
+	fz->news_cnt = 0;
+	for (size_t w = 0; w < T_FUZZ_MAP / word; w++) {
+		if (fz->map[w] == 0) {
+			continue;
+		}
 
-		t_printf("%04X %s %04X", a, cond, b);
-		break;
+		for (size_t i = w * word; i < (w + 1) * word && fz->news_cnt < T_FUZZ_NEWS; i++) {
+			unsigned char bit = (unsigned char)(t_fuzz_bucket(map[i]) & ~fz->seen[i]);
+			if (bit) {
+				fz->news[fz->news_cnt] = i;
+				fz->bits[fz->news_cnt] = bit;
+				fz->news_cnt++;
+			}
+		}
 	}
-	case 4: {
-		const int a = get_int(act_size, args);
-		const int b = get_int(exp_size, args);
 
-		t_printf("%08X %s %08X", a, cond, b);
-		break;
+	return fz->news_cnt;
+}
+
+static void t_fuzz_merge(tfuzzer_t *fz)
+{
+	const unsigned char *map = (const unsigned char *)fz->map;
+	const size_t word	 = sizeof(*fz->map);
+
+	for (size_t w = 0; w < T_FUZZ_MAP / word; w++) {
+		for (size_t i = w * word; fz->map[w] && i < (w + 1) * word; i++) {
+			fz->seen[i] |= t_fuzz_bucket(map[i]);
+		}
 	}
-	case 8: {
-		const long long a = get_long(act_size, args);
-		const long long b = get_long(exp_size, args);
+}
 
-		t_printf("%016llX %s %016llX", a, cond, b);
-		break;
+// Whether the input still fails, or still passes and reaches the new buckets of the input being minimized
+static int t_fuzz_keep(fuzz_fn fn, tfuzzer_t *fz, const unsigned char *data, size_t len, int fail)
+{
+	fz->execs++;
+	if (t_fuzz_run(fn, data, len)) {
+		return fail;
 	}
-	default:
-		t_printf("Unsupported type of size: %zu", act_size);
-		break;
+	if (fail) {
+		return 0;
 	}
 
-	t_printf(")");
-}
+	const unsigned char *map = (const unsigned char *)fz->map;
+	for (int i = 0; i < fz->news_cnt; i++) {
+		if (!(t_fuzz_bucket(map[fz->news[i]]) & fz->bits[i])) {
+			return 0;
+		}
+	}
 
-void t_expect_ch(int passed, const char *file, const char *func, int line, const char *check)
-{
-	print_header(passed, file, func, line);
-	t_printf("%s\033[0m\n", check);
+	return 1;
 }
 
-void t_expect_g(int passed, const char *file, const char *func, int line, const char *act, size_t act_size, const char *exp,
-		size_t exp_size, const char *cond, ...)
+// Removes halves, then quarters and so on of the input for as long as it is kept
+static size_t t_fuzz_minimize(fuzz_fn fn, tfuzzer_t *fz, unsigned char *data, size_t len, unsigned char *tmp, int fail)
 {
-	va_list args;
-	va_start(args, cond);
-	print_values(passed, file, func, line, act, act_size, exp, exp_size, cond, args);
-	va_end(args);
+	int runs = 0;
+	for (size_t chunk = len; chunk > 0 && runs < T_FUZZ_MINIMIZE; chunk /= 2) {
+		for (size_t i = 0; i + chunk <= len && runs < T_FUZZ_MINIMIZE; runs++) {
+			memcpy(tmp, data, i);
+			memcpy(tmp + i, data + i + chunk, len - i - chunk);
+			if (t_fuzz_keep(fn, fz, tmp, len - chunk, fail)) {
+				len -= chunk;
+				memcpy(data, tmp, len);
+			} else {
+				i += chunk;
+			}
+		}
+	}
 
-	t_printf("\033[0m\n");
+	return len;
 }
 
-void t_expect_m(int passed, const char *file, const char *func, int line, const char *act, size_t act_size, const char *exp,
-		size_t exp_size, unsigned char mask, const char *cond, ...)
+// Applies 1 to 4 random mutations, the last kind splices in a part of another input
+static size_t t_fuzz_mutate(tfuzzer_t *fz, unsigned char *buf, size_t len)
 {
-	va_list args;
-	va_start(args, cond);
-	print_values(passed, file, func, line, act, act_size, exp, exp_size, cond, args);
-	va_end(args);
+	static const unsigned char magic[] = {0x00, 0x01, 0x7f, 0x80, 0xff};
+
+	int cnt = 1 + (int)(t_rng_next(fz->rng) % 4);
+	for (int m = 0; m < cnt; m++) {
+		unsigned long long r = t_rng_next(fz->rng);
+		unsigned long long v = r >> 40;
+
+		int op	   = len > 0 ? (int)(r % 8) : r & 1 ? 4 : 7;
+		size_t pos = len > 0 ? (size_t)((r >> 8) % len) : 0;
+
+		switch (op) {
+		case 0:
+			buf[pos] ^= (unsigned char)(1 << (v & 7));
+			break;
+		case 1:
+			buf[pos] = (unsigned char)v;
+			break;
+		case 2:
+			buf[pos] = magic[v % sizeof(magic)];
+			break;
+		case 3:
+			buf[pos] = (unsigned char)(buf[pos] + v % 33 - 16);
+			break;
+		case 4: {
+			size_t num = MIN(1 + (size_t)(v % 8), T_FUZZ_MAX - len);
+			pos	   = len > 0 ? (size_t)((r >> 8) % (len + 1)) : 0;
+			memmove(buf + pos + num, buf + pos, len - pos);
+			for (size_t i = 0; i < num; i++) {
+				buf[pos + i] = (unsigned char)t_rng_next(fz->rng);
+			}
+			len += num;
+			break;
+		}
+		case 5: {
+			size_t num = 1 + (size_t)(v % (len - pos));
+			memmove(buf + pos, buf + pos + num, len - pos - num);
+			len -= num;
+			break;
+		}
+		case 6: {
+			size_t src = (size_t)(v % len);
+			size_t num = 1 + (size_t)(t_rng_next(fz->rng) % (len - MAX(src, pos)));
+			memmove(buf + pos, buf + src, num);
+			break;
+		}
+		default: {
+			const tinput_t *other = &fz->inputs[t_rng_next(fz->rng) % fz->cnt];
+			if (other->len == 0) {
+				break;
+			}
+			size_t src = (size_t)(v % other->len);
+			size_t num = MIN(MIN(1 + (size_t)(t_rng_next(fz->rng) % 16), other->len - src), T_FUZZ_MAX - pos);
+			memcpy(buf + pos, other->data + src, num);
+			len = MAX(len, pos + num);
+			break;
+		}
+		}
+	}
 
-	t_printf(" & " BYTE_TO_BIN_PATTERN "\033[0m\n", BYTE_TO_BIN(mask));
+	return len;
 }
 
-void t_expect_p(int passed, const char *file, const char *func, int line, const char *act, const char *exp, const char *cond,
-		const void *act_ptr, const void *exp_ptr)
+// Prints the input with the expectations that fail on it, the header only for the first failing input of the target
+static void t_fuzz_report(fuzz_fn fn, tfuzzer_t *fz, const unsigned char *data, size_t len, const char *path, int first)
 {
-	print_header(passed, file, func, line);
-	t_printf("%s %s %s (%0*" PRIXPTR " %s %0*" PRIXPTR ")\033[0m\n",
-		 act,
-		 cond,
-		 exp,
-		 PTR_HEX_WIDTH,
-		 (uintptr_t)act_ptr,
-		 cond,
-		 PTR_HEX_WIDTH,
-		 (uintptr_t)exp_ptr);
+	s_data.prop.quiet = 0;
+
+	print_header(first, NULL, first ? fz->func : NULL, 0);
+	if (fz->execs > 0) {
+		t_printf("input %s (%zu B) found after %llu runs\033[0m\n", path ? path : "not saved", len, fz->execs);
+	} else {
+		t_printf("input %s (%zu B)\033[0m\n", path, len);
+	}
+	t_fuzz_run(fn, data, len);
+
+	s_data.prop.quiet = 1;
 }
 
-static int print_line(int passed, const char *h, const char *str, size_t ln, size_t col, size_t line_start, size_t line_end, size_t *h_len)
+// Runs the empty input and every input of the corpus, their coverage is what fuzzing starts from
+static int t_fuzz_replay(fuzz_fn fn, tfuzzer_t *fz)
 {
-	print_header(passed, NULL, NULL, 0);
-
-	int app = 0;
-	*h_len	= t_printf("%s:%zu: ", h, ln);
-	for (size_t i = 0; i < line_end - line_start; i++) {
-		char c = str[line_start + i];
-		// clang-format off
-		switch (c) {
-		case '\n': t_printf("\\n"); app += (i <= col ? 1 : 0); break;
-		case '\r': t_printf("\\r"); app += (i <= col ? 1 : 0); break;
-		case '\t': t_printf("\\t"); app += (i <= col ? 1 : 0); break;
-		case '\033': t_printf("\\033"); app += (i <= col ? 3 : 0); break;
-		default: t_printf("%c", c); break;
+	int failed = 0;
+	for (size_t i = 0; i <= fz->cnt; i++) {
+		const tinput_t empty = {.path = "(empty)"};
+		const tinput_t *in   = i > 0 ? &fz->inputs[i - 1] : &empty;
+
+		if (t_fuzz_run(fn, in->data, in->len)) {
+			t_fuzz_report(fn, fz, in->data, in->len, in->path, !failed);
+			failed = 1;
+		} else if (fz->map) {
+			t_fuzz_merge(fz);
 		}
-		// clang-format on
 	}
 
-	t_printf("\033[0m\n");
+	return failed;
+}
 
-	return app;
+#if !defined(C_WIN)
+
+static int t_fuzz_path_cmp(const void *a, const void *b)
+{
+	return strcmp(((const tinput_t *)a)->path, ((const tinput_t *)b)->path);
 }
 
-static void print_str(int passed, const char *file, const char *func, int line, const char *act_str, const char *exp_str, size_t act_len,
-		      size_t exp_len)
+static void t_fuzz_load(tfuzzer_t *fz)
 {
-	size_t ln	    = 0;
-	size_t col	    = 0;
-	size_t line_start   = 0;
-	size_t exp_line_end = 0;
-	size_t act_line_end = 0;
-	int diff	    = 0;
+	DIR *dir = opendir(fz->dir);
+	if (dir == NULL) {
+		return;
+	}
 
-	for (size_t i = 0; i < MAX(exp_len, act_len); i++) {
-		char exp = i < exp_len ? exp_str[i] : '\0';
-		char act = i < act_len ? act_str[i] : '\0';
+	const struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		char path[T_PATH_MAX];
+		int ret = snprintf(path, sizeof(path), "%s%s", fz->dir, ent->d_name);
 
-		diff |= act != exp;
+		struct stat st;
+		if (ent->d_name[0] == '.' || ret < 0 || (size_t)ret >= sizeof(path) || stat(path, &st) || !S_ISREG(st.st_mode)) {
+			continue;
+		}
 
-		if (diff) {
-			if (exp == '\n' && exp_line_end == 0) {
-				exp_line_end = i + 1;
-			}
-			if (act == '\n' && act_line_end == 0) {
-				act_line_end = i + 1;
-			}
-			if (exp_line_end != 0 && act_line_end != 0) {
-				break;
-			}
-		} else if (exp == '\n') {
-			col = 0;
-			ln++;
-			line_start = i + 1;
-		} else {
-			col++;
+		FILE *file	    = fopen(path, "rb");
+		unsigned char *data = file ? malloc(st.st_size > 0 ? (size_t)st.st_size : 1) : NULL;
+		size_t len	    = data ? fread(data, 1, (size_t)st.st_size, file) : 0;
+		if (file) {
+			fclose(file);
 		}
-	}
 
-	print_header(passed, file, func, line);
-	t_printf("\033[0m\n");
+		char *copy = data ? malloc((size_t)ret + 1) : NULL;
+		if (copy == NULL || len != (size_t)st.st_size) {
+			free(data);
+			free(copy);
+			continue;
+		}
+		memcpy(copy, path, (size_t)ret + 1);
 
-	size_t h_len;
-	int exp_app = print_line(passed, "exp", exp_str, ln, col, line_start, exp_line_end == 0 ? exp_len : exp_line_end, &h_len);
-	int act_app = print_line(passed, "act", act_str, ln, col, line_start, act_line_end == 0 ? act_len : act_line_end, &h_len);
+		t_fuzz_add(fz, data, len, copy);
+	}
 
-	print_header(passed, NULL, NULL, 0);
-	t_printf("%*s^\033[0m\n", (int)h_len + MIN(act_app, exp_app) + col, "");
+	closedir(dir);
+
+	if (fz->cnt > 1) {
+		qsort(fz->inputs, fz->cnt, sizeof(*fz->inputs), t_fuzz_path_cmp);
+	}
 }
 
-static int print_wline(int passed, const char *h, const wchar_t *str, size_t ln, size_t col, size_t line_start, size_t line_end,
-		       size_t *h_len)
+// Inputs are named after a hash of their content, saving one twice keeps one file
+static char *t_fuzz_save(tfuzzer_t *fz, const unsigned char *data, size_t len)
 {
-	print_header(passed, NULL, NULL, 0);
+	char path[T_PATH_MAX];
+	int ret = snprintf(path, sizeof(path), "%s%016llx", fz->dir, t_fnv1a((const char *)data, len));
+	if (ret < 0 || (size_t)ret >= sizeof(path)) {
+		return NULL;
+	}
 
-	int app = 0;
-	*h_len	= t_printf("%s:%zu: ", h, ln);
-	c_startw(stdout);
-	for (size_t i = 0; i < line_end - line_start; i++) {
-		wchar_t c = str[line_start + i];
-		// clang-format off
-		switch (c) {
-		case L'\n': t_wprintf(L"\\n"); app += (i <= col ? 1 : 0); break;
-		case L'\r': t_wprintf(L"\\r"); app += (i <= col ? 1 : 0); break;
-		case L'\t': t_wprintf(L"\\t"); app += (i <= col ? 1 : 0); break;
-		case L'\033': t_wprintf(L"\\033"); app += (i <= col ? 3 : 0); break;
-		default: t_wprintf(L"%c", c); break;
-		}
-		// clang-format on
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		return NULL;
 	}
-	c_endw(stdout);
 
-	t_printf("\033[0m\n");
+	int err = len > 0 && fwrite(data, 1, len, file) != len;
+	err |= fclose(file) != 0;
 
-	return app;
+	char *copy = err ? NULL : malloc((size_t)ret + 1);
+	if (copy) {
+		memcpy(copy, path, (size_t)ret + 1);
+	}
+	return copy;
 }
 
-static void print_wstr(int passed, const char *file, const char *func, int line, const wchar_t *act_str, const wchar_t *exp_str,
-		       size_t act_len, size_t exp_len)
+// Mutates inputs of the corpus until the time is up or one fails, inputs reaching new coverage are added to the corpus
+static int t_fuzz_loop(fuzz_fn fn, tfuzzer_t *fz)
 {
-	size_t ln	    = 0;
-	size_t col	    = 0;
-	size_t line_start   = 0;
-	size_t exp_line_end = 0;
-	size_t act_line_end = 0;
-	int diff	    = 0;
+	fz->map		   = calloc(T_FUZZ_MAP / sizeof(*fz->map), sizeof(*fz->map));
+	fz->seen	   = calloc(T_FUZZ_MAP, 1);
+	unsigned char *buf = malloc(T_FUZZ_MAX);
+	unsigned char *tmp = malloc(T_FUZZ_MAX);
+	if (fz->map == NULL || fz->seen == NULL || buf == NULL || tmp == NULL) {
+		free(buf);
+		free(tmp);
+		return t_fuzz_replay(fn, fz);
+	}
 
-	for (size_t i = 0; i < MAX(exp_len, act_len); i++) {
-		wchar_t exp = i < exp_len ? exp_str[i] : '\0';
-		wchar_t act = i < act_len ? act_str[i] : '\0';
+	// The directory of the target exists before a crash needs it
+	mkdir(fz->corpus, 0755);
+	mkdir(fz->dir, 0755);
 
-		diff |= act != exp;
+	s_data.fuzz.map	  = (unsigned char *)fz->map;
+	s_data.fuzz.crash = fz->dir;
 
-		if (diff) {
-			if (exp == '\n' && exp_line_end == 0) {
-				exp_line_end = i + 1;
-			}
-			if (act == '\n' && act_line_end == 0) {
-				act_line_end = i + 1;
-			}
-			if (exp_line_end != 0 && act_line_end != 0) {
-				break;
-			}
-		} else if (exp == '\n') {
-			col = 0;
-			ln++;
-			line_start = i + 1;
-		} else {
-			col++;
+	int failed = t_fuzz_replay(fn, fz);
+	if (fz->cnt == 0) {
+		unsigned char *empty = malloc(1);
+		if (empty) {
+			t_fuzz_add(fz, empty, 0, NULL);
 		}
 	}
 
-	print_header(passed, file, func, line);
-	t_printf("\033[0m\n");
+	unsigned long long seed = t_wall() ^ t_fnv1a(fz->dir, t_strlen(fz->dir));
+	for (int i = 0; i < 4; i++) {
+		fz->rng[i] = t_splitmix(&seed);
+	}
 
-	size_t h_len;
-	int exp_app = print_wline(passed, "exp", exp_str, ln, col, line_start, exp_line_end == 0 ? exp_len : exp_line_end, &h_len);
-	int act_app = print_wline(passed, "act", act_str, ln, col, line_start, act_line_end == 0 ? act_len : act_line_end, &h_len);
+	unsigned long long end = t_wall() + (unsigned long long)s_data.fuzz.secs * 1000000000ULL;
+	while (!failed && fz->cnt > 0 && ((fz->execs & 63) != 0 || t_wall() < end)) {
+		const tinput_t *in = &fz->inputs[t_rng_next(fz->rng) % fz->cnt];
 
-	print_header(passed, NULL, NULL, 0);
-	t_printf("%*s^\033[0m\n", (int)h_len + MIN(act_app, exp_app) + col, "");
+		size_t len = MIN(in->len, T_FUZZ_MAX);
+		if (len > 0) {
+			memcpy(buf, in->data, len);
+		}
+		len = t_fuzz_mutate(fz, buf, len);
+
+		fz->execs++;
+		if (t_fuzz_run(fn, buf, len)) {
+			len	   = t_fuzz_minimize(fn, fz, buf, len, tmp, 1);
+			char *path = t_fuzz_save(fz, buf, len);
+			t_fuzz_report(fn, fz, buf, len, path, 1);
+			free(path);
+			failed = 1;
+		} else if (t_fuzz_news(fz) > 0) {
+			len = t_fuzz_minimize(fn, fz, buf, len, tmp, 0);
+			t_fuzz_run(fn, buf, len);
+			t_fuzz_merge(fz);
+
+			unsigned char *data = malloc(len > 0 ? len : 1);
+			if (data) {
+				memcpy(data, buf, len);
+				t_fuzz_add(fz, data, len, t_fuzz_save(fz, buf, len));
+			}
+		}
+	}
+
+	s_data.fuzz.map	  = NULL;
+	s_data.fuzz.crash = NULL;
+
+	free(buf);
+	free(tmp);
+	return failed;
 }
 
-void t_expect_str(int passed, const char *file, const char *func, int line, const char *act, const char *exp)
+#endif
+
+int t_fuzz(fuzz_fn fn, const char *func)
 {
-	print_str(passed, file, func, line, act, exp, act == NULL ? 0 : t_strlen(act), exp == NULL ? 0 : t_strlen(exp));
+	tfuzzer_t fz = {
+		.func	= func,
+		.corpus = s_data.fuzz.corpus ? s_data.fuzz.corpus : T_FUZZ_CORPUS,
+	};
+
+	int ret = snprintf(fz.dir, sizeof(fz.dir), "%s/%s/", fz.corpus, t_func_name(func));
+	if (ret < 0 || (size_t)ret >= sizeof(fz.dir)) {
+		fz.dir[0] = '\0';
+	}
+
+	s_data.prop.quiet = 1;
+
+	int failed;
+#if !defined(C_WIN)
+	if (fz.dir[0]) {
+		t_fuzz_load(&fz);
+	}
+	failed = s_data.fuzz.secs > 0 && fz.dir[0] ? t_fuzz_loop(fn, &fz) : t_fuzz_replay(fn, &fz);
+#else
+	failed = t_fuzz_replay(fn, &fz);
+#endif
+
+	s_data.prop.quiet = 0;
+
+	for (size_t i = 0; i < fz.cnt; i++) {
+		free(fz.inputs[i].data);
+		free(fz.inputs[i].path);
+	}
+	free(fz.inputs);
+	free(fz.map);
+	free(fz.seen);
+
+	return failed;
 }
 
-void t_expect_strn(int passed, const char *file, const char *func, int line, const char *act, const char *exp, size_t len)
+// Both sides of a differential test and the batch they run over, outputs of a side are packed one after another in out
+typedef struct tdiffer_s {
+	diff_fn fn[2];
+	const char *names[2];
+	size_t out_max;
+	unsigned char *in;
+	size_t in_cap;
+	size_t offs[T_DIFF_BATCH + 1];
+	size_t cnt;
+	unsigned char *out[2];
+	size_t lens[2][T_DIFF_BATCH];
+	unsigned long long rng[4];
+} tdiffer_t;
+
+static unsigned long long t_diff_side(tdiffer_t *df, int side)
 {
-	print_str(passed, file, func, line, act, exp, MIN(len, act == NULL ? 0 : t_strlen(act)), exp == NULL ? 0 : t_strlen(exp));
+	diff_fn fn	   = df->fn[side];
+	unsigned char *out = df->out[side];
+	size_t *lens	   = df->lens[side];
+	size_t pos	   = 0;
+
+	unsigned long long start = t_wall();
+	for (size_t i = 0; i < df->cnt; i++) {
+		lens[i] = fn(df->in + df->offs[i], df->offs[i + 1] - df->offs[i], out + pos, df->out_max);
+		pos += MIN(lens[i], df->out_max);
+	}
+
+	return t_wall() - start;
 }
 
-void t_expect_fmt(int passed, const char *file, const char *func, int line, const char *act, unsigned int cnt, ...)
+// Finds the first input of the batch the sides disagree on, cnt if they agree on all of them
+static size_t t_diff_find(const tdiffer_t *df)
 {
-	va_list args;
-	va_start(args, cnt);
-	const char *exp = va_arg(args, const char *);
-	va_end(args);
+	size_t pos = 0;
+	for (size_t i = 0; i < df->cnt; i++) {
+		size_t len = MIN(df->lens[0][i], df->out_max);
+		if (df->lens[0][i] != df->lens[1][i] || t_memcmp(df->out[0] + pos, df->out[1] + pos, len)) {
+			return i;
+		}
+		pos += len;
+	}
 
-	print_str(passed, file, func, line, act, exp, t_strlen(act), t_strlen(exp));
+	return df->cnt;
 }
 
-void t_expect_wstr(int passed, const char *file, const char *func, int line, const wchar_t *act, const wchar_t *exp)
+// Runs both sides on one input, the batch is over once an input diverges
+static int t_diff_differs(tdiffer_t *df, const unsigned char *data, size_t len)
 {
-	print_wstr(passed, file, func, line, act, exp, act == NULL ? 0 : wcslen(act), exp == NULL ? 0 : wcslen(exp));
+	memcpy(df->in, data, len);
+	df->offs[0] = 0;
+	df->offs[1] = len;
+	df->cnt	    = 1;
+
+	t_diff_side(df, 0);
+	t_diff_side(df, 1);
+	return t_diff_find(df) == 0;
 }
 
-void t_expect_wstrn(int passed, const char *file, const char *func, int line, const wchar_t *act, const wchar_t *exp, size_t len)
+// Removes halves, then quarters and so on of the input while the sides still disagree on it, then clears the bytes it can
+static size_t t_diff_minimize(tdiffer_t *df, unsigned char *data, size_t len,
+			unsigned char *tmp)
 {
-	print_wstr(passed, file, func, line, act, exp, MIN(len, act == NULL ? 0 : wcslen(act)), exp == NULL ? 0 : wcslen(exp));
+	int runs = 0;
+	for (size_t chunk = len; chunk > 0 && runs < T_DIFF_MINIMIZE; chunk /= 2) {
+		for (size_t i = 0; i + chunk <= len && runs < T_DIFF_MINIMIZE; runs++) {
+			memcpy(tmp, data, i);
+			memcpy(tmp + i, data + i + chunk, len - i - chunk);
+			if (t_diff_differs(df, tmp, len - chunk)) {
+				len -= chunk;
+				memcpy(data, tmp, len);
+			} else {
+				i += chunk;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < len && runs < T_DIFF_MINIMIZE; i++) {
+		if (data[i] == 0) {
+			continue;
+		}
+		memcpy(tmp, data, len);
+		tmp[i] = 0;
+		runs++;
+		if (t_diff_differs(df, tmp, len)) {
+			data[i] = 0;
+		}
+	}
+
+	return len;
 }
 
-void t_expect_fail(int passed, const char *fmt, ...)
+static void t_diff_fail(tdiffer_t *df, const char *func, const char *what, const char *note, unsigned char *data, size_t len,
+			unsigned char *tmp)
 {
-	print_header(passed, NULL, NULL, 0);
+	size_t orig = len;
+	len	    = t_diff_minimize(df, data, len, tmp);
+	t_diff_differs(df, data, len);
+
+	print_header(1, NULL, func, 0);
+	t_printf("%s and %s differ on %s (%zu B), minimized to %zu B%s\033[0m\n", df->names[0], df->names[1], what, orig, len, note);
+	if (len > 0) {
+		print_mem_row(0, "in", (const char *)data, 0, MIN(len, T_MEM_ROW), 1, 0);
+	}
 
-	va_list args;
-	va_start(args, fmt);
-	t_printv(fmt, args);
-	va_end(args);
+	size_t exp_len = MIN(df->lens[0][0], df->out_max);
+	size_t act_len = MIN(df->lens[1][0], df->out_max);
+	if (df->lens[0][0] != df->lens[1][0]) {
+		print_header(0, NULL, NULL, 0);
+		t_printf("%s returned %zu B, %s returned %zu B\033[0m\n", df->names[0], df->lens[0][0], df->names[1], df->lens[1][0]);
+	}
 
-	t_printf("\033[0m\n");
+	size_t cnt  = MIN(exp_len, act_len);
+	size_t diff = t_mismatch(df->out[1], df->out[0], cnt);
+	if (diff < cnt) {
+		print_mem(0, NULL, NULL, 0, df->names[1], df->names[0], df->out[1], df->out[0], cnt, 1, 0, diff);
+	}
 }
 
-int t_fprintf(void *priv, const char *fmt, ...)
+int t_diff(diff_fn ref, diff_fn opt, size_t in_max, size_t out_max, const char *ref_str, const char *opt_str, const char *func)
 {
-	(void)priv;
+	tdiffer_t df = {
+		.fn	 = {ref, opt},
+		.names	 = {ref_str, opt_str},
+		.out_max = out_max,
+	};
+
+	tfuzzer_t fz = {0};
+#if !defined(C_WIN)
+	int ret = snprintf(fz.dir, sizeof(fz.dir), "%s/%s/", s_data.fuzz.corpus ? s_data.fuzz.corpus : T_FUZZ_CORPUS, t_func_name(func));
+	if (ret >= 0 && (size_t)ret < sizeof(fz.dir)) {
+		t_fuzz_load(&fz);
+	}
+#endif
 
-	va_list args;
-	va_start(args, fmt);
-	int ret = vsnprintf(s_data.buf + s_data.buf_len, s_data.buf_size - s_data.buf_len, fmt, args);
-	va_end(args);
+	size_t largest = in_max;
+	for (size_t i = 0; i < fz.cnt; i++) {
+		largest = MAX(largest, fz.inputs[i].len);
+	}
 
-	s_data.buf_len += ret;
+	df.in_cap	   = T_DIFF_BATCH * in_max + largest;
+	df.in		   = malloc(df.in_cap > 0 ? df.in_cap : 1);
+	df.out[0]	   = malloc(T_DIFF_BATCH * out_max + 1);
+	df.out[1]	   = malloc(T_DIFF_BATCH * out_max + 1);
+	unsigned char *buf = malloc(largest + 1);
+	unsigned char *tmp = malloc(largest + 1);
+
+	unsigned long long seed = s_data.prop.seeded ? s_data.prop.seed : t_wall() ^ t_fnv1a(s_data.path, s_data.path_len);
+	unsigned long long rng	= seed;
+	for (int i = 0; i < 4; i++) {
+		df.rng[i] = t_splitmix(&rng);
+	}
+	s_data.repeat.drawn = 1;
 
-	return ret;
-}
+	tdiff_t res = {.names = {ref_str, opt_str}};
+	int failed  = df.in == NULL || df.out[0] == NULL || df.out[1] == NULL || buf == NULL || tmp == NULL;
+	if (failed) {
+		print_header(1, NULL, func, 0);
+		t_printf("failed to allocate the batches\033[0m\n");
+	}
 
-void t_expect_fstr_start(const char *exp, size_t len)
-{
-	s_data.exp     = exp;
-	s_data.exp_len = len;
+	size_t next	       = 0;
+	unsigned long long gen = 0;
+	while (!failed && (next < fz.cnt || gen < T_DIFF_INPUTS)) {
+		size_t first		     = next;
+		unsigned long long gen_first = gen;
+
+		df.cnt = 0;
+		for (size_t pos = 0; df.cnt < T_DIFF_BATCH; df.offs[++df.cnt] = pos) {
+			if (next < fz.cnt) {
+				const tinput_t *in = &fz.inputs[next];
+				if (pos + in->len > df.in_cap) {
+					break;
+				}
+				memcpy(df.in + pos, in->data, in->len);
+				pos += in->len;
+				next++;
+			} else if (gen < T_DIFF_INPUTS) {
+				// Short inputs are as likely as long ones in total, so that the edge cases of lengths are all covered
+				size_t len = (size_t)t_rng_bound(t_rng_next(df.rng), t_rng_bound(t_rng_next(df.rng), in_max));
+				if (pos + len > df.in_cap) {
+					break;
+				}
+				for (size_t i = 0; i < len; i += sizeof(unsigned long long)) {
+					unsigned long long r = t_rng_next(df.rng);
+					memcpy(df.in + pos + i, &r, MIN(sizeof(r), len - i));
+				}
+				pos += len;
+				gen++;
+			} else {
+				break;
+			}
+		}
+
+		res.ns[0] += t_diff_side(&df, 0);
+		res.ns[1] += t_diff_side(&df, 1);
+		res.inputs += df.cnt;
+
+		size_t at = t_diff_find(&df);
+		if (at == df.cnt) {
+			continue;
+		}
 
-	if (s_data.buf_size < len + 1) {
-		void *buf = realloc(s_data.buf, len + 1);
-		if (buf != NULL) {
-			s_data.buf_size = len + 1;
-			s_data.buf	= buf;
+		size_t len = df.offs[at + 1] - df.offs[at];
+		memcpy(buf, df.in + df.offs[at], len);
+
+		char what[T_PATH_MAX + 32];
+		char note[64] = "";
+		if (first + at < fz.cnt) {
+			snprintf(what, sizeof(what), "input %s", fz.inputs[first + at].path);
+		} else {
+			snprintf(what, sizeof(what), "generated input %llu", gen_first + (first + at - fz.cnt));
+			snprintf(note, sizeof(note), ", reproduce with --seed %llu", seed);
 		}
+
+		t_diff_fail(&df, func, what, note, buf, len, tmp);
+		failed = 1;
+	}
+
+	if (!failed) {
+		res.done = 1;
 	}
+	s_data.diff = res;
 
-	memset(s_data.buf, 0, s_data.buf_size);
-	s_data.buf_len = 0;
+	for (size_t i = 0; i < fz.cnt; i++) {
+		free(fz.inputs[i].data);
+		free(fz.inputs[i].path);
+	}
+	free(fz.inputs);
+	free(df.in);
+	free(df.out[0]);
+	free(df.out[1]);
+	free(buf);
+	free(tmp);
+
+	return failed;
 }
 
-int t_expect_fstr_end(int passed, const char *file, const char *func, int line)
+int t_table(table_fn fn, const void *rows, size_t cnt, size_t size, const char *func)
 {
-	const int ret = t_strcmp(s_data.buf, s_data.exp);
+	ttable_t *table = &s_data.table;
+
+	// Rows are only named to be matched when the filters select some of them
+	const char *name = t_func_name(func);
+	const int filter = s_data.filter_argc > 0 && !s_data.filter_run_all;
+
+	table->name = name;
+	table->rows = 0;
+	table->cnt  = cnt;
+
+	size_t failed = 0;
+	for (size_t i = 0; i < cnt; i++) {
+		if (filter) {
+			char row[T_PATH_MAX];
+			int run_all = 0;
+			snprintf(row, sizeof(row), "%s_%zu", name, i);
+			if (!t_filter_match(row, &run_all)) {
+				continue;
+			}
+		}
 
-	if (ret) {
-		print_str(passed, file, func, line, s_data.buf, s_data.exp, s_data.buf_len, s_data.exp_len);
+		table->row		      = i;
+		const long long expect_failed = s_data.expect_failed;
+		fn(1, (const char *)rows + i * size);
+		failed += s_data.expect_failed != expect_failed;
+		table->rows++;
 	}
 
-	return ret;
+	table->name = NULL;
+	table->done = failed == 0;
+
+	if (failed) {
+		t_indent();
+		pv();
+		t_printf("\033[0;31m%zu of %zu rows failed\033[0m\n", failed, table->rows);
+	}
+
+	return failed > 0;
 }
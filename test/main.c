@@ -1,12 +1,152 @@
 #include "mem_stats.h"
+#include "platform.h"
 #include "test.h"
 #include "type.h"
 
+#include <limits.h>
 #include <memory.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined(C_WIN)
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#if defined(__GLIBC__)
+	#include <malloc.h>
+#endif
+
+typedef struct tbuf_s {
+	char *data;
+	size_t len;
+	size_t size;
+} tbuf_t;
+
+typedef struct tchunk_s {
+	struct tchunk_s *next;
+	size_t size;
+	size_t len;
+	char data[];
+} tchunk_t;
+
+typedef struct tarena_s {
+	tchunk_t *head;
+	tchunk_t *tail;
+	size_t len;
+} tarena_t;
+
+typedef struct tstream_s {
+	int on;
+	size_t exp_len;
+	size_t off;
+	size_t diff;
+	size_t win_len;
+	char win[256];
+} tstream_t;
+
+typedef struct twork_s {
+	int jobs;
+	int threads;
+	int worker;
+	int level;
+	int unit;
+	int claim;
+} twork_t;
+
+typedef struct tstamp_s {
+	unsigned long long wall;
+	unsigned long long cpu;
+} tstamp_t;
+
+typedef struct tbench_s {
+	int on;
+	int calibrated;
+	int done;
+	int cnt;
+	size_t iters;
+	unsigned long long start;
+	unsigned long long total;
+	double samples[50];
+	double median;
+	double mean;
+	double stddev;
+	double p99;
+} tbench_t;
+
+typedef struct talloc_s {
+	unsigned long long allocs;
+	unsigned long long frees;
+	long long live;
+	long long peak;
+	unsigned long long sizes[14];
+} talloc_t;
+
+typedef struct tshard_s {
+	int index;
+	int count;
+	int shown;
+	const char *heads[32];
+} tshard_t;
+
+typedef struct tjournal_s {
+	void *file;
+	int run;
+	int first;
+} tjournal_t;
+
+typedef struct tprop_s {
+	unsigned long long seed;
+	int seeded;
+	int cases;
+	int on;
+	int replay;
+	int quiet;
+	int show;
+	unsigned long long rng[4];
+	unsigned long long *draws;
+	size_t len;
+	size_t cap;
+	const unsigned long long *prefix;
+	size_t prefix_len;
+	size_t pos;
+	tarena_t mem;
+} tprop_t;
+
+typedef struct tfuzz_s {
+	const char *corpus;
+	int secs;
+	unsigned char *map;
+	unsigned long long prev;
+	const unsigned char *input;
+	size_t input_len;
+	const char *crash;
+} tfuzz_t;
+
+typedef struct tdiff_s {
+	int done;
+	const char *names[2];
+	unsigned long long inputs;
+	unsigned long long ns[2];
+} tdiff_t;
+
+typedef struct ttable_s {
+	const char *name;
+	size_t row;
+	size_t rows;
+	size_t cnt;
+	int done;
+} ttable_t;
+
+typedef struct trepeat_s {
+	int count;
+	int until_fail;
+	int on;
+	int drawn;
+} trepeat_t;
+
 typedef struct tdata_s {
 	void *priv;
 	setup_fn setup;
@@ -15,23 +155,62 @@ typedef struct tdata_s {
 	wdst_t wdst;
 	long long passed;
 	long long failed;
+	long long expect_failed;
 	int depth;
-	char *buf;
-	size_t buf_size;
-	size_t buf_len;
+	tarena_t buf;
 	const char *exp;
 	size_t exp_len;
+	tstream_t stream;
 	size_t mem;
 	mem_stats_t mem_stats;
 	int filter_argc;
 	char **filter_argv;
 	char *filter_matched;
 	int filter_run_all;
+	void *filter_nodes;
+	int *filter_next;
+	int level;
+	tbuf_t out;
+	twork_t work;
+	void *pool;
+	char path[512];
+	size_t path_len;
+	size_t path_lens[32];
+	int time;
+	int time_slowest;
+	tstamp_t time_start;
+	tstamp_t time_suites[32];
+	void *time_slow;
+	tbuf_t *recs;
+	tbench_t bench;
+	void *base;
+	dst_t sink;
+	void *flush;
+	int alloc_on;
+	talloc_t alloc;
+	talloc_t alloc_test;
+	talloc_t alloc_suites[32];
+	volatile int alloc_guard;
+	int leaks;
+	void *leak_tab;
+	int timeout;
+	int isolate;
+	int tests;
+	tshard_t shard;
+	void *dur;
+	tjournal_t journal;
+	tprop_t prop;
+	tfuzz_t fuzz;
+	tdiff_t diff;
+	ttable_t table;
+	trepeat_t repeat;
 } tdata_t;
 
 extern tdata_t t_get_data(void);
 extern void t_set_data(tdata_t data);
 
+#define T_BUFFER ((size_t)-2)
+
 #define CW "\033[0m"
 #define CR "\033[0;31m"
 #define CG "\033[0;32m"
@@ -75,6 +254,8 @@ TEST(t_init_args)
 	base.filter_argc    = 0;
 	base.filter_argv    = NULL;
 	base.filter_matched = NULL;
+	base.filter_nodes   = NULL;
+	base.filter_next    = NULL;
 	base.filter_run_all = 0;
 
 	char *args[] = {"ctest", "missing"};
@@ -84,11 +265,15 @@ TEST(t_init_args)
 
 	tdata_t tmp = t_get_data();
 	EXPECT_EQ(tmp.filter_argc, 1);
-	EXPECT_PTR(tmp.filter_argv, args + 1);
+	EXPECT_PTR(tmp.filter_argv[0], args[1]);
 	EXPECT_NOT_NULL(tmp.filter_matched);
 
-	free(tmp.buf);
+	// t_init dropped the leak table the filter array was tracked in
+	t_set_data(data);
+	free(tmp.filter_argv);
 	free(tmp.filter_matched);
+	free(tmp.filter_nodes);
+	free(tmp.filter_next);
 
 	char *null_args[] = {"ctest", NULL};
 
@@ -97,12 +282,14 @@ TEST(t_init_args)
 
 	tmp = t_get_data();
 	EXPECT_EQ(tmp.filter_argc, 1);
-	EXPECT_PTR(tmp.filter_argv, null_args + 1);
+	EXPECT_NULL(tmp.filter_argv[0]);
 	EXPECT_NOT_NULL(tmp.filter_matched);
 
-	free(tmp.buf);
-	free(tmp.filter_matched);
 	t_set_data(data);
+	free(tmp.filter_argv);
+	free(tmp.filter_matched);
+	free(tmp.filter_nodes);
+	free(tmp.filter_next);
 
 	END;
 }
@@ -111,8 +298,8 @@ TEST(t_init_help)
 {
 	START;
 
-	char buf[512] = {0};
-	char *args[]  = {"ctest", "-h"};
+	char buf[4096] = {0};
+	char *args[]   = {"ctest", "-h"};
 
 	tdata_t data = t_get_data();
 	tdata_t tmp  = {0};
@@ -122,15 +309,259 @@ TEST(t_init_help)
 	EXPECT_EQ(t_init(2, args), 1);
 	t_set_data(data);
 
+	// The allocation options are only listed when the build counts allocations
+	const char *allocs = "";
+	if (t_alloc_counted()) {
+		allocs = "  --allocs              Print allocation counts of each test and suite.\n"
+			 "  --leaks               Show where memory leaked by a test was allocated.\n"
+			 "  --leak-trace          Like --leaks, with a short backtrace of each site.\n";
+	}
+
+	char exp[4096];
+	snprintf(exp,
+		 sizeof(exp),
+		 "Usage: ctest [options] [filter...]\n"
+		 "\n"
+		 "Options:\n"
+		 "  -h, --help            Print this help message.\n"
+		 "  -j, --jobs N          Run top-level tests in N worker processes.\n"
+		 "  --threads N           Run top-level tests on N worker threads.\n"
+		 "  -t, --time            Print test durations and the slowest tests.\n"
+		 "  --slowest N           List the N slowest tests (default 10).\n"
+		 "  --bench               Measure benchmarks, otherwise they run once.\n"
+		 "  --bench-save FILE     Save benchmark results to FILE.\n"
+		 "  --bench-compare FILE  Fail benchmarks that are slower than in FILE.\n"
+		 "  --max-regress N%%      Allowed median slowdown (default 5%%).\n"
+		 "  --async-output        Write output from a background thread.\n"
+		 "%s"
+		 "  --timeout N           Fail a test that runs longer than N seconds.\n"
+		 "  --isolate             Run each test in its own process, crashes fail only that test.\n"
+		 "  --list                Print the names of the declared tests without running them.\n"
+		 "  --shard I/N           Run only shard I of N, tests are assigned by a hash of their path.\n"
+		 "  --durations FILE      Keep test durations in FILE to run long tests first and balance shards.\n"
+		 "  --journal FILE        Keep the result of each test in FILE.\n"
+		 "  --failed-first        Run the tests that failed last time first, stop if one still fails.\n"
+		 "  --failed-only         Run only the tests that failed last time.\n"
+		 "  --seed N              Draw the values of the first case of each property from seed N.\n"
+		 "  --cases N             Check N cases of each property (default 100).\n"
+		 "  --corpus DIR          Keep the inputs of each fuzz target in DIR/NAME (default corpus).\n"
+		 "  --fuzz N              Fuzz each selected target for N seconds instead of replaying its corpus.\n"
+		 "  --repeat N            Run the selected tests N times in this process, print only the first failing run.\n"
+		 "  --until-fail          Repeat the selected tests until a run fails, at most N times with --repeat.\n"
+		 "\n"
+		 "Filters:\n"
+		 "  Each filter selects tests or suites by name prefix.\n"
+		 "  Selecting a suite runs all tests under that suite.\n",
+		 allocs);
+	EXPECT_STR(buf, exp);
+
+	END;
+}
+
+TEST(t_init_jobs)
+{
+	START;
+
+	char buf[256] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t base = data;
+
+	base.filter_argc    = 0;
+	base.filter_argv    = NULL;
+	base.filter_matched = NULL;
+	base.filter_nodes   = NULL;
+	base.filter_next    = NULL;
+	base.filter_run_all = 0;
+
+	char *args[] = {"ctest", "-j", "2", "suite"};
+
+	t_set_data(base);
+	EXPECT_EQ(t_init(4, args), 0);
+
+	tdata_t tmp = t_get_data();
+	EXPECT_EQ(tmp.work.jobs, 2);
+	EXPECT_EQ(tmp.filter_argc, 1);
+	EXPECT_STR(tmp.filter_argv[0], "suite");
+	EXPECT_STR(args[1], "-j");
+	EXPECT_STR(args[3], "suite");
+
+	// t_init dropped the leak table the filter array was tracked in
+	t_set_data(data);
+	free(tmp.filter_argv);
+	free(tmp.filter_matched);
+	free(tmp.filter_nodes);
+	free(tmp.filter_next);
+
+	char *long_args[] = {"ctest", "--jobs=3"};
+
+	t_set_data(base);
+	EXPECT_EQ(t_init(2, long_args), 0);
+
+	tmp = t_get_data();
+	EXPECT_EQ(tmp.work.jobs, 3);
+	EXPECT_EQ(tmp.filter_argc, 0);
+
+	t_set_data(data);
+	free(tmp.filter_argv);
+	free(tmp.filter_matched);
+	free(tmp.filter_nodes);
+	free(tmp.filter_next);
+
+	char *short_args[] = {"ctest", "-j4"};
+
+	t_set_data(base);
+	EXPECT_EQ(t_init(2, short_args), 0);
+
+	tmp = t_get_data();
+	EXPECT_EQ(tmp.work.jobs, 4);
+	EXPECT_EQ(tmp.work.threads, 0);
+
+	t_set_data(data);
+	free(tmp.filter_argv);
+	free(tmp.filter_matched);
+	free(tmp.filter_nodes);
+	free(tmp.filter_next);
+
+	char *thread_args[] = {"ctest", "--threads", "2"};
+
+	base.dst = DST_BUF(buf);
+	t_set_data(base);
+	EXPECT_EQ(t_init(3, thread_args), 0);
+
+	tmp = t_get_data();
+	EXPECT_EQ(tmp.work.jobs, 2);
+	EXPECT_EQ(tmp.work.threads, 1);
+	if (t_alloc_counted()) {
+		EXPECT_STR(buf, "ctest: warning: leaks are not checked on worker threads without '--leaks', use '-j' to check them\n");
+	} else {
+		EXPECT_STR(buf, "ctest: warning: leak checking is off on worker threads in this build, use '-j' to check leaks\n");
+	}
+
+	t_set_data(data);
+	free(tmp.filter_argv);
+	free(tmp.filter_matched);
+	free(tmp.filter_nodes);
+	free(tmp.filter_next);
+
+	char *zero_args[] = {"ctest", "-j", "0"};
+
+	memset(buf, 0, sizeof(buf));
+	base.dst = DST_BUF(buf);
+	t_set_data(base);
+	EXPECT_EQ(t_init(3, zero_args), -1);
+	EXPECT_STR(buf, "ctest: invalid value '0' for '-j'\n");
+
+	char *unknown_args[] = {"ctest", "--unknown"};
+
+	t_set_data(base);
+	EXPECT_EQ(t_init(2, unknown_args), -1);
+	EXPECT_STR(buf, "ctest: unknown option '--unknown'\n");
+
+	t_set_data(data);
+
+	END;
+}
+
+TEST(t_init_errors)
+{
+	START;
+
+	char buf[256] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	char *jobs_args[] = {"ctest", "--jobs", "abc"};
+
+	t_set_data(tmp);
+	EXPECT_EQ(t_init(3, jobs_args), -1);
+	EXPECT_STR(buf, "ctest: invalid value 'abc' for '--jobs'\n");
+
+	char *bogus_args[] = {"ctest", "--bogus"};
+
+	memset(buf, 0, sizeof(buf));
+	t_set_data(tmp);
+	EXPECT_EQ(t_init(2, bogus_args), -1);
+	EXPECT_STR(buf, "ctest: unknown option '--bogus'\n");
+
+	char *compare_args[] = {"ctest", "--bench-compare", "t_init_errors.missing"};
+
+	memset(buf, 0, sizeof(buf));
+	t_set_data(tmp);
+	EXPECT_EQ(t_init(3, compare_args), -1);
+	EXPECT_STR(buf, "ctest: cannot read baseline 't_init_errors.missing'\n");
+
+	char *repeat_args[] = {"ctest", "--threads", "2", "--repeat", "3"};
+
+	memset(buf, 0, sizeof(buf));
+	t_set_data(tmp);
+	EXPECT_EQ(t_init(5, repeat_args), -1);
+	EXPECT_STR(buf, "ctest: '--repeat' cannot be combined with '--threads'\n");
+
+	char *first_args[] = {"ctest", "--failed-first"};
+
+	memset(buf, 0, sizeof(buf));
+	t_set_data(tmp);
+	EXPECT_EQ(t_init(2, first_args), -1);
+	EXPECT_STR(buf, "ctest: '--failed-first' needs '--journal FILE'\n");
+
+	t_set_data(data);
+
+	END;
+}
+
+TEST(t_init_list)
+{
+	START;
+
+	char buf[256] = {0};
+	char *args[]  = {"ctest", "--list", "t_init_", "t_run_filter_suite"};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	EXPECT_EQ(t_init(4, args), 1);
+	t_set_data(data);
+
 	EXPECT_STR(buf,
-		   "Usage: ctest [filter...]\n"
-		   "\n"
-		   "Options:\n"
-		   "  -h, --help  Print this help message.\n"
-		   "\n"
-		   "Filters:\n"
-		   "  Each filter selects tests or suites by name prefix.\n"
-		   "  Selecting a suite runs all tests under that suite.\n");
+		   "t_init_args\n"
+		   "t_init_errors\n"
+		   "t_init_finish\n"
+		   "t_init_help\n"
+		   "t_init_jobs\n"
+		   "t_init_list\n"
+		   "t_run_filter_suite\n"
+		   "t_run_filter_suite_child\n");
+
+	END;
+}
+
+TEST(t_test_registry)
+{
+	START;
+
+	size_t cnt = t_test_count();
+	EXPECT_GT(cnt, 80);
+	EXPECT_NULL(t_test_get(cnt));
+
+	int sorted = 1;
+	for (size_t i = 1; i < cnt; i++) {
+		sorted &= strcmp(t_test_get(i - 1)->name, t_test_get(i)->name) < 0;
+	}
+	EXPECT_EQ(sorted, 1);
+
+	const ttest_t *test = t_test_find("t_test_registry");
+	EXPECT_NOT_NULL(test);
+	EXPECT_STR(test->name, "t_test_registry");
+	EXPECT(test->fn == test_t_test_registry);
+	EXPECT_NULL(t_test_find("t_test_"));
+	EXPECT_NULL(t_test_find(NULL));
+
+	EXPECT_NOT_NULL(t_test_find("t_bench_sum"));
 
 	END;
 }
@@ -187,176 +618,384 @@ TEST(t_filter_suite)
 	SEND;
 }
 
-static void t_test_filter(int argc, char **argv)
+static int test_t_jobs_pass(void)
 {
-	tdata_t data = t_get_data();
-
-	if (data.filter_matched) {
-		free(data.filter_matched);
-	}
+	START;
+	END;
+}
 
-	data.filter_argc    = argc;
-	data.filter_argv    = argv;
-	data.filter_matched = NULL;
-	data.filter_run_all = 0;
+static int test_t_jobs_fail(void)
+{
+	START;
+	EXPECT(0);
+	END;
+}
 
-	if (argc > 0) {
-		data.filter_matched = calloc((size_t)argc, sizeof(*data.filter_matched));
-	}
+static int test_t_jobs_suite(void)
+{
+	SSTART;
+	RUN(t_jobs_pass);
+	RUN(t_jobs_fail);
+	SEND;
+}
 
-	t_set_data(data);
+static int test_t_jobs_root(void)
+{
+	SSTART;
+	RUN(t_jobs_pass);
+	RUN(t_jobs_suite);
+	RUN(t_jobs_fail);
+	RUN(t_jobs_pass);
+	SEND;
 }
 
-TEST(t_run_filter)
+TEST(t_run_jobs)
 {
 	START;
 
+	char serial[1024]   = {0};
+	char parallel[1024] = {0};
+
 	tdata_t data = t_get_data();
 	tdata_t tmp  = data;
 
-	char buf[1024] = {0};
-	char *args[]   = {"ctest", "t_filter_suite_count"};
-
-	tmp.dst		   = DST_BUF(buf);
 	tmp.passed	   = 0;
 	tmp.failed	   = 0;
-	tmp.depth	   = 0;
+	tmp.depth	   = -1;
+	tmp.level	   = 0;
 	tmp.filter_argc	   = 0;
 	tmp.filter_argv	   = NULL;
 	tmp.filter_matched = NULL;
-
-	t_filter_calls = 0;
-	t_filter_skips = 0;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
+	tmp.filter_run_all = 0;
+	tmp.work.jobs	   = 1;
+	tmp.work.threads   = 0;
+	tmp.work.worker	   = 0;
+	tmp.work.level	   = 0;
+	tmp.pool	   = NULL;
+	tmp.time	   = 0;
+	tmp.alloc_on	   = 0;
+	tmp.recs	   = NULL;
+
+	tmp.dst = DST_BUF(serial);
 	t_set_data(tmp);
-	t_test_filter(1, args + 1);
+	EXPECT_EQ(t_run(test_t_jobs_root, 1), 1);
+	tdata_t res = t_get_data();
 
-	EXPECT_EQ(t_run_named(test_t_filter_suite_count, "t_filter_suite_count", 1), 0);
-	EXPECT_EQ(t_filter_calls, 1);
-	EXPECT_EQ(t_run_named(test_t_filter_suite_count, "empty", 1), -1);
-	EXPECT_EQ(t_filter_calls, 1);
-	EXPECT_EQ(t_filter_skips, 0);
-	EXPECT_STR(buf, "├─" CG "PASS t_filter_suite_count" CW "\n");
+	tmp.dst	      = DST_BUF(parallel);
+	tmp.work.jobs = 3;
+	t_set_data(tmp);
+	EXPECT_EQ(t_run(test_t_jobs_root, 1), 1);
+	tdata_t par = t_get_data();
 
-	t_test_filter(0, NULL);
 	t_set_data(data);
 
+	EXPECT_EQ(res.passed, 3);
+	EXPECT_EQ(res.failed, 2);
+	EXPECT_EQ(par.passed, res.passed);
+	EXPECT_EQ(par.failed, res.failed);
+	EXPECT_EQ(par.level, 0);
+	EXPECT_NULL(par.pool);
+	EXPECT_STR(parallel, serial);
+
 	END;
 }
 
-TEST(t_run_filter_suite)
+#if !defined(C_WIN)
+static int test_t_timeout_hang(void)
+{
+	START;
+
+	t_timeout(50);
+	for (;;) {
+		pause();
+	}
+
+	END;
+}
+
+static int test_t_timeout_root(void)
+{
+	SSTART;
+	RUN(t_jobs_pass);
+	RUN(t_timeout_hang);
+	RUN(t_jobs_pass);
+	SEND;
+}
+
+TEST(t_run_timeout)
 {
 	START;
 
+	char buf[2048] = {0};
+
 	tdata_t data = t_get_data();
 	tdata_t tmp  = data;
 
-	char buf[1024] = {0};
-	char *args[]   = {"ctest", "t_filter_suite"};
-
-	tmp.dst		   = DST_BUF(buf);
 	tmp.passed	   = 0;
 	tmp.failed	   = 0;
-	tmp.depth	   = 0;
+	tmp.depth	   = -1;
+	tmp.level	   = 0;
 	tmp.filter_argc	   = 0;
 	tmp.filter_argv	   = NULL;
 	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
 	tmp.filter_run_all = 0;
+	tmp.work.jobs	   = 2;
+	tmp.work.threads   = 0;
+	tmp.work.worker	   = 0;
+	tmp.work.level	   = 0;
+	tmp.pool	   = NULL;
+	tmp.time	   = 0;
+	tmp.alloc_on	   = 0;
+	tmp.recs	   = NULL;
+	tmp.dst		   = DST_BUF(buf);
 
-	t_filter_calls = 0;
-	t_filter_skips = 0;
+	// The worker running the stuck test reports it and exits, the other tests still run
 	t_set_data(tmp);
-	t_test_filter(1, args + 1);
-
-	EXPECT_EQ(t_run_named(test_t_filter_suite, "t_filter_suite", 1), 0);
-	EXPECT_EQ(t_filter_calls, 1);
-	EXPECT_EQ(t_filter_skips, 1);
-	EXPECT_STR(buf,
-		   "├─t_filter_suite\n"
-		   "│ ├─" CG "PASS t_filter_suite_count" CW "\n"
-		   "│ ├─" CG "PASS t_filter_suite_skip" CW "\n"
-		   "│ └─" CG "PASS 2 TESTS" CW "\n");
-
-	t_test_filter(0, NULL);
+	int ret	    = t_run(test_t_timeout_root, 1);
+	tdata_t res = t_get_data();
 	t_set_data(data);
 
+	EXPECT_EQ(ret, 1);
+	EXPECT_EQ(res.passed, 2);
+	EXPECT_EQ(res.failed, 1);
+	EXPECT_NOT_NULL(strstr(buf, "├─" CR "FAIL t_timeout_hang" CW "\n"));
+#if !defined(__SANITIZE_THREAD__)
+	// TSan does not let a child of a multi-threaded process start the watchdog thread
+	EXPECT_NOT_NULL(strstr(buf, "│ " CR "timed out after 50.0 ms" CW "\n"));
+#endif
+	EXPECT_NOT_NULL(strstr(buf, "└─" CR "FAIL 1/3 TEST" CW "\n"));
+
 	END;
 }
 
-TEST(t_run_filter_suite_child)
+static int test_t_isolate_crash(void)
 {
 	START;
 
+	raise(SIGABRT);
+
+	END;
+}
+
+static int test_t_isolate_root(void)
+{
+	SSTART;
+	RUN(t_jobs_pass);
+	RUN(t_isolate_crash);
+	RUN(t_timeout_hang);
+	RUN(t_jobs_pass);
+	SEND;
+}
+
+TEST(t_run_isolate)
+{
+	char buf[2048] = {0};
+
 	tdata_t data = t_get_data();
 	tdata_t tmp  = data;
 
-	char buf[1024] = {0};
-	char *args[]   = {"ctest", "t_filter_suite", "t_filter_suite_count"};
-
-	tmp.dst		   = DST_BUF(buf);
 	tmp.passed	   = 0;
 	tmp.failed	   = 0;
-	tmp.depth	   = 0;
+	tmp.depth	   = -1;
+	tmp.level	   = 0;
 	tmp.filter_argc	   = 0;
 	tmp.filter_argv	   = NULL;
 	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
 	tmp.filter_run_all = 0;
+	tmp.work.jobs	   = 1;
+	tmp.work.threads   = 0;
+	tmp.work.worker	   = 0;
+	tmp.work.level	   = 0;
+	tmp.pool	   = NULL;
+	tmp.time	   = 0;
+	tmp.alloc_on	   = 0;
+	tmp.recs	   = NULL;
+	tmp.isolate	   = 1;
+	tmp.shard	   = (tshard_t){0};
+	tmp.journal	   = (tjournal_t){0};
+	tmp.dst		   = DST_BUF(buf);
 
-	t_filter_calls = 0;
-	t_filter_skips = 0;
+	// Tests run from inside a running test are not isolated, so this runs before START
 	t_set_data(tmp);
-	t_test_filter(2, args + 1);
+	int ret	    = t_run(test_t_isolate_root, 1);
+	tdata_t res = t_get_data();
+	t_set_data(data);
 
-	EXPECT_EQ(t_run_named(test_t_filter_suite, "t_filter_suite", 1), 0);
-	EXPECT_EQ(t_filter_calls, 1);
-	EXPECT_EQ(t_filter_skips, 0);
-	tmp = t_get_data();
-	EXPECT_EQ(tmp.filter_matched[0], 1);
-	EXPECT_EQ(tmp.filter_matched[1], 1);
-	EXPECT_STR(buf,
-		   "├─t_filter_suite\n"
-		   "│ ├─" CG "PASS t_filter_suite_count" CW "\n"
-		   "│ └─" CG "PASS 1 TEST" CW "\n");
+	START;
 
-	t_test_filter(0, NULL);
-	t_set_data(data);
+	EXPECT_EQ(ret, 1);
+	EXPECT_EQ(res.passed, 2);
+	EXPECT_EQ(res.failed, 2);
+	EXPECT_NOT_NULL(strstr(buf,
+			       "├─" CR "FAIL t_isolate_crash" CW "\n"
+			       "│ " CR "test terminated by SIGABRT" CW "\n"));
+	EXPECT_NOT_NULL(strstr(buf, "├─" CR "FAIL t_timeout_hang" CW "\n"));
+#if !defined(__SANITIZE_THREAD__)
+	EXPECT_NOT_NULL(strstr(buf, "│ " CR "timed out after 50.0 ms" CW "\n"));
+#endif
+	EXPECT_NOT_NULL(strstr(buf, "└─" CR "FAIL 2/4 TESTS" CW "\n"));
 
 	END;
 }
+#endif
 
-TEST(t_run_filter_parent)
+TEST(t_run_threads)
 {
 	START;
 
+	char serial[1024]   = {0};
+	char parallel[1024] = {0};
+
 	tdata_t data = t_get_data();
 	tdata_t tmp  = data;
 
-	char *args[] = {"ctest", "parent_child"};
-
 	tmp.passed	   = 0;
 	tmp.failed	   = 0;
-	tmp.depth	   = 0;
+	tmp.depth	   = -1;
+	tmp.level	   = 0;
 	tmp.filter_argc	   = 0;
 	tmp.filter_argv	   = NULL;
 	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
 	tmp.filter_run_all = 0;
-
-	t_filter_calls = 0;
+	tmp.work.jobs	   = 1;
+	tmp.work.threads   = 0;
+	tmp.work.worker	   = 0;
+	tmp.work.level	   = 0;
+	tmp.pool	   = NULL;
+	tmp.time	   = 0;
+	tmp.alloc_on	   = 0;
+	tmp.recs	   = NULL;
+
+	tmp.dst = DST_BUF(serial);
 	t_set_data(tmp);
-	t_test_filter(1, args + 1);
+	EXPECT_EQ(t_run(test_t_jobs_root, 1), 1);
+	tdata_t res = t_get_data();
 
-	EXPECT_EQ(t_run_named(test_t_filter_suite_count, "parent", 0), 0);
-	EXPECT_EQ(t_run_named(test_t_filter_suite_count, "other", 0), -1);
-	EXPECT_EQ(t_filter_calls, 1);
-	tmp = t_get_data();
-	EXPECT_EQ(tmp.filter_matched[0], 0);
+	tmp.dst		 = DST_BUF(parallel);
+	tmp.work.jobs	 = 3;
+	tmp.work.threads = 1;
+	t_set_data(tmp);
+	EXPECT_EQ(t_run(test_t_jobs_root, 1), 1);
+	tdata_t par = t_get_data();
 
-	t_test_filter(0, NULL);
 	t_set_data(data);
 
+	EXPECT_EQ(par.passed, res.passed);
+	EXPECT_EQ(par.failed, res.failed);
+	EXPECT_EQ(par.level, 0);
+	EXPECT_NULL(par.pool);
+	EXPECT_STR(parallel, serial);
+
 	END;
 }
 
-TEST(t_filter_finish_unmatched)
+static void *t_thread_leak_ptr;
+
+TEST(t_thread_leak)
+{
+	START;
+	t_thread_leak_ptr = malloc(24);
+	t_do_not_optimize(t_thread_leak_ptr);
+	END;
+}
+
+static int test_t_thread_leak_root(void)
+{
+	SSTART;
+	RUN(t_jobs_pass);
+	RUN(t_thread_leak);
+	SEND;
+}
+
+TEST(t_run_threads_leak)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = data;
+
+	tmp.passed	   = 0;
+	tmp.failed	   = 0;
+	tmp.depth	   = -1;
+	tmp.level	   = 0;
+	tmp.filter_argc	   = 0;
+	tmp.filter_argv	   = NULL;
+	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
+	tmp.filter_run_all = 0;
+	tmp.work.jobs	   = 2;
+	tmp.work.threads   = 1;
+	tmp.work.worker	   = 0;
+	tmp.work.level	   = 0;
+	tmp.pool	   = NULL;
+	tmp.time	   = 0;
+	tmp.alloc_on	   = 0;
+	tmp.recs	   = NULL;
+	tmp.leaks	   = 1;
+	tmp.dst		   = DST_BUF(buf);
+
+	// mem_stats cannot tell the threads apart, each worker thread tracks its blocks in its own leak table
+	t_set_data(tmp);
+	int ret	    = t_run(test_t_thread_leak_root, 1);
+	tdata_t res = t_get_data();
+	t_set_data(data);
+
+	free(t_thread_leak_ptr);
+
+	if (!t_alloc_counted()) {
+		// Without T_ALLOC_HOOK or with sanitizers no blocks are tracked
+		EXPECT_EQ(ret, 0);
+		EXPECT_NOT_NULL(strstr(buf, "├─" CG "PASS t_thread_leak" CW "\n"));
+	} else {
+		EXPECT_EQ(ret, 1);
+		EXPECT_EQ(res.failed, 1);
+		EXPECT_NOT_NULL(strstr(buf, "├─" CR "LEAK t_thread_leak" CW "\n"));
+		EXPECT_NOT_NULL(strstr(buf, "└─" CR "FAIL 1/2 TEST" CW "\n"));
+	}
+
+	END;
+}
+
+static void t_test_filter(int argc, char **argv)
+{
+	tdata_t data = t_get_data();
+
+	if (data.filter_matched) {
+		free(data.filter_matched);
+	}
+
+	free(data.filter_argv);
+	free(data.filter_nodes);
+	free(data.filter_next);
+
+	data.filter_argc    = argc;
+	data.filter_argv    = NULL;
+	data.filter_matched = NULL;
+	data.filter_nodes   = NULL;
+	data.filter_next    = NULL;
+	data.filter_run_all = 0;
+
+	if (argc > 0) {
+		data.filter_argv = malloc((size_t)argc * sizeof(*data.filter_argv));
+		memcpy(data.filter_argv, argv, (size_t)argc * sizeof(*data.filter_argv));
+		data.filter_matched = calloc((size_t)argc, sizeof(*data.filter_matched));
+	}
+
+	t_set_data(data);
+}
+
+TEST(t_run_filter)
 {
 	START;
 
@@ -364,94 +1003,1631 @@ TEST(t_filter_finish_unmatched)
 	tdata_t tmp  = data;
 
 	char buf[1024] = {0};
-	char *args[]   = {"ctest", "missing"};
+	char *args[]   = {"ctest", "t_filter_suite_count"};
+
+	tmp.dst		   = DST_BUF(buf);
+	tmp.passed	   = 0;
+	tmp.failed	   = 0;
+	tmp.depth	   = 0;
+	tmp.filter_argc	   = 0;
+	tmp.filter_argv	   = NULL;
+	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
+	tmp.time	   = 0;
+	tmp.alloc_on	   = 0;
+
+	t_filter_calls = 0;
+	t_filter_skips = 0;
+	t_set_data(tmp);
+	t_test_filter(1, args + 1);
+
+	EXPECT_EQ(t_run_named(test_t_filter_suite_count, "t_filter_suite_count", 1), 0);
+	EXPECT_EQ(t_filter_calls, 1);
+	EXPECT_EQ(t_run_named(test_t_filter_suite_count, "empty", 1), -1);
+	EXPECT_EQ(t_filter_calls, 1);
+	EXPECT_EQ(t_filter_skips, 0);
+	EXPECT_STR(buf, "├─" CG "PASS t_filter_suite_count" CW "\n");
+
+	t_test_filter(0, NULL);
+	t_set_data(data);
+
+	END;
+}
+
+TEST(t_run_filter_suite)
+{
+	START;
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = data;
+
+	char buf[1024] = {0};
+	char *args[]   = {"ctest", "t_filter_suite"};
 
 	tmp.dst		   = DST_BUF(buf);
 	tmp.passed	   = 0;
 	tmp.failed	   = 0;
 	tmp.depth	   = 0;
-	tmp.buf		   = malloc(tmp.buf_size);
 	tmp.filter_argc	   = 0;
 	tmp.filter_argv	   = NULL;
 	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
 	tmp.filter_run_all = 0;
+	tmp.time	   = 0;
+	tmp.alloc_on	   = 0;
 
+	t_filter_calls = 0;
+	t_filter_skips = 0;
 	t_set_data(tmp);
 	t_test_filter(1, args + 1);
-	EXPECT_EQ(t_finish(), 1);
+
+	EXPECT_EQ(t_run_named(test_t_filter_suite, "t_filter_suite", 1), 0);
+	EXPECT_EQ(t_filter_calls, 1);
+	EXPECT_EQ(t_filter_skips, 1);
+	EXPECT_STR(buf,
+		   "├─t_filter_suite\n"
+		   "│ ├─" CG "PASS t_filter_suite_count" CW "\n"
+		   "│ ├─" CG "PASS t_filter_suite_skip" CW "\n"
+		   "│ └─" CG "PASS 2 TESTS" CW "\n");
+
+	t_test_filter(0, NULL);
 	t_set_data(data);
 
-	EXPECT_STR(buf, CR "FAIL filter 'missing' matched no tests" CW "\n" CR "FAIL 1/1 TEST" CW "\n");
+	END;
+}
+
+TEST(t_run_filter_suite_child)
+{
+	START;
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = data;
+
+	char buf[1024] = {0};
+	char *args[]   = {"ctest", "t_filter_suite", "t_filter_suite_count"};
+
+	tmp.dst		   = DST_BUF(buf);
+	tmp.passed	   = 0;
+	tmp.failed	   = 0;
+	tmp.depth	   = 0;
+	tmp.filter_argc	   = 0;
+	tmp.filter_argv	   = NULL;
+	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
+	tmp.filter_run_all = 0;
+	tmp.time	   = 0;
+	tmp.alloc_on	   = 0;
+
+	t_filter_calls = 0;
+	t_filter_skips = 0;
+	t_set_data(tmp);
+	t_test_filter(2, args + 1);
+
+	EXPECT_EQ(t_run_named(test_t_filter_suite, "t_filter_suite", 1), 0);
+	EXPECT_EQ(t_filter_calls, 1);
+	EXPECT_EQ(t_filter_skips, 0);
+	tmp = t_get_data();
+	EXPECT_EQ(tmp.filter_matched[0], 1);
+	EXPECT_EQ(tmp.filter_matched[1], 1);
+	EXPECT_STR(buf,
+		   "├─t_filter_suite\n"
+		   "│ ├─" CG "PASS t_filter_suite_count" CW "\n"
+		   "│ └─" CG "PASS 1 TEST" CW "\n");
+
+	t_test_filter(0, NULL);
+	t_set_data(data);
 
 	END;
 }
 
-TEST(t_priv)
+TEST(t_run_filter_parent)
 {
 	START;
 
 	tdata_t data = t_get_data();
+	tdata_t tmp  = data;
 
-	int a = 0;
-	t_set_priv(&a);
-	EXPECT_PTR(t_get_priv(), &a);
+	char *args[] = {"ctest", "parent_child"};
+
+	tmp.passed	   = 0;
+	tmp.failed	   = 0;
+	tmp.depth	   = 0;
+	tmp.filter_argc	   = 0;
+	tmp.filter_argv	   = NULL;
+	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
+	tmp.filter_run_all = 0;
+	tmp.time	   = 0;
+	tmp.alloc_on	   = 0;
+
+	t_filter_calls = 0;
+	t_set_data(tmp);
+	t_test_filter(1, args + 1);
+
+	EXPECT_EQ(t_run_named(test_t_filter_suite_count, "parent", 0), 0);
+	EXPECT_EQ(t_run_named(test_t_filter_suite_count, "other", 0), -1);
+	EXPECT_EQ(t_filter_calls, 1);
+	tmp = t_get_data();
+	EXPECT_EQ(tmp.filter_matched[0], 0);
 
+	t_test_filter(0, NULL);
 	t_set_data(data);
 
 	END;
 }
 
-static int setup(void *priv)
+TEST(t_run_filter_trie)
 {
-	(void)priv;
-	return 0;
+	START;
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = data;
+
+	char *args[] = {"ctest", "suite", "suite_a", "suite_a", "other"};
+
+	tmp.filter_argc	   = 0;
+	tmp.filter_argv	   = NULL;
+	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
+	tmp.filter_run_all = 0;
+
+	t_set_data(tmp);
+	t_test_filter(4, args + 1);
+
+	int state = t_enter("suite");
+	EXPECT_EQ(state, 0);
+	EXPECT_EQ(t_get_data().filter_run_all, 0);
+	EXPECT_EQ(t_enter("suite_b"), -1);
+	EXPECT_EQ(t_enter("sui"), -1);
+
+	int child = t_enter("suite_a");
+	EXPECT_EQ(child, 0);
+	EXPECT_EQ(t_get_data().filter_run_all, 1);
+	EXPECT_EQ(t_enter("suite_a_x"), 1);
+	t_leave(1);
+	t_leave(child);
+	EXPECT_EQ(t_get_data().filter_run_all, 0);
+	t_leave(state);
+
+	tmp = t_get_data();
+	EXPECT_EQ(tmp.filter_matched[0], 1);
+	EXPECT_EQ(tmp.filter_matched[1], 1);
+	EXPECT_EQ(tmp.filter_matched[2], 1);
+	EXPECT_EQ(tmp.filter_matched[3], 0);
+
+	t_test_filter(0, NULL);
+	t_set_data(data);
+
+	END;
 }
 
-static int teardown(void *priv)
+// The filter tests share the call counters, so they run as one unit
+TEST(t_shard_a)
 {
-	(void)priv;
-	return 0;
+	START;
+	END;
 }
 
-TEST(t_setup_teardown)
+TEST(t_shard_b)
+{
+	START;
+	END;
+}
+
+TEST(t_shard_c)
+{
+	START;
+	END;
+}
+
+TEST(t_shard_e)
+{
+	START;
+	END;
+}
+
+TEST(t_shard_suite)
+{
+	SSTART;
+	RUN(t_shard_c);
+	RUN(t_shard_e);
+	SEND;
+}
+
+TEST(t_shard_root)
+{
+	SSTART;
+	RUN(t_shard_a);
+	RUN(t_shard_b);
+	RUN(t_shard_suite);
+	SEND;
+}
+
+TEST(t_run_shard)
 {
 	START;
 
 	tdata_t data = t_get_data();
+	tdata_t tmp  = data;
+
+	char buf[1024] = {0};
+
+	tmp.dst		   = DST_BUF(buf);
+	tmp.passed	   = 0;
+	tmp.failed	   = 0;
+	tmp.depth	   = 0;
+	tmp.level	   = 0;
+	tmp.path[0]	   = '\0';
+	tmp.path_len	   = 0;
+	tmp.filter_argc	   = 0;
+	tmp.filter_argv	   = NULL;
+	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
+	tmp.filter_run_all = 0;
+	tmp.work.jobs	   = 1;
+	tmp.work.threads   = 0;
+	tmp.work.worker	   = 0;
+	tmp.work.level	   = 0;
+	tmp.pool	   = NULL;
+	tmp.time	   = 0;
+	tmp.alloc_on	   = 0;
+	tmp.recs	   = NULL;
+	tmp.isolate	   = 0;
+	tmp.tests	   = 0;
+	tmp.shard	   = (tshard_t){.index = 0, .count = 2, .shown = 1};
+	tmp.dur		   = NULL;
+	tmp.journal	   = (tjournal_t){0};
 
-	tdata_t tmp = {0};
 	t_set_data(tmp);
+	EXPECT_EQ(t_run_named(test_t_shard_root, "t_shard_root", 1), 0);
+	tdata_t res = t_get_data();
+	t_set_data(data);
 
-	t_setup(setup);
-	t_teardown(teardown);
+	EXPECT_EQ(res.passed, 3);
+	EXPECT_STR(buf,
+		   "├─t_shard_root\n"
+		   "│ ├─" CG "PASS t_shard_b" CW "\n"
+		   "│ ├─t_shard_suite\n"
+		   "│ │ ├─" CG "PASS t_shard_c" CW "\n"
+		   "│ │ ├─" CG "PASS t_shard_e" CW "\n"
+		   "│ │ └─" CG "PASS 2 TESTS" CW "\n"
+		   "│ └─" CG "PASS 2 TESTS" CW "\n");
+
+	// The suite has no test in this shard and is skipped
+	tmp.shard.index = 1;
+	t_set_data(tmp);
+	EXPECT_EQ(t_run_named(test_t_shard_root, "t_shard_root", 1), 0);
+	res = t_get_data();
+	t_set_data(data);
+
+	EXPECT_EQ(res.passed, 1);
+	EXPECT_STR(buf,
+		   "├─t_shard_root\n"
+		   "│ ├─" CG "PASS t_shard_a" CW "\n"
+		   "│ └─" CG "PASS 1 TEST" CW "\n");
+
+	END;
+}
+
+#if !defined(C_WIN)
+static int t_dur_order[3];
+static int t_dur_cnt;
+
+static void t_dur_mark(int id)
+{
+	t_dur_order[__atomic_fetch_add(&t_dur_cnt, 1, __ATOMIC_RELAXED) % 3] = id;
+}
+
+TEST(t_dur_a)
+{
+	START;
+	t_dur_mark('a');
+	END;
+}
+
+TEST(t_dur_b)
+{
+	START;
+	t_dur_mark('b');
+	END;
+}
+
+TEST(t_dur_c)
+{
+	START;
+	t_dur_mark('c');
+	END;
+}
+
+TEST(t_dur_root)
+{
+	SSTART;
+	RUN(t_dur_a);
+	RUN(t_dur_b);
+	RUN(t_dur_c);
+	SEND;
+}
+
+static void t_dur_write(const char *path, unsigned long long a, unsigned long long b, unsigned long long c)
+{
+	FILE *file		= fopen(path, "wb");
+	unsigned int cnt	= 3;
+	unsigned int len	= 18;
+	unsigned long long ns[] = {a, b, c};
+
+	fwrite("CTD1", 1, 4, file);
+	fwrite(&cnt, sizeof(cnt), 1, file);
+	for (unsigned int i = 0; i < cnt; i++) {
+		unsigned int off = i * len;
+		fwrite(&off, sizeof(off), 1, file);
+		fwrite(&len, sizeof(len), 1, file);
+		fwrite(&ns[i], sizeof(ns[i]), 1, file);
+	}
+	fwrite("t_dur_root/t_dur_at_dur_root/t_dur_bt_dur_root/t_dur_c", 1, 3 * len, file);
+	fclose(file);
+}
+
+static long long t_dur_run(int argc, char **argv)
+{
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	t_init(argc, argv);
+
+	tmp	  = t_get_data();
+	tmp.dst	  = DST_BUF(buf);
+	tmp.depth = 0;
+	t_set_data(tmp);
+
+	t_dur_cnt = 0;
+	t_run_named(test_t_dur_root, "t_dur_root", 1);
+	long long passed = t_get_data().passed;
+	t_finish();
+	t_set_data(data);
+
+	return passed;
+}
+
+TEST(t_run_durations)
+{
+	START;
+
+	char name[] = "t_durations.bin";
+
+	// Workers claim the longest unit first, so the shortest one runs last
+	char *args[] = {"ctest", "--threads", "2", "--durations", name};
+	t_dur_write(name, 1000000, 2000000, 3000000);
+	EXPECT_EQ(t_dur_run(5, args), 3);
+	EXPECT_EQ(t_dur_cnt, 3);
+	EXPECT_EQ(t_dur_order[2], 'a');
+
+	char file[64] = {0};
+	FILE *saved   = fopen(name, "rb");
+	EXPECT_NOT_NULL(saved);
+	if (saved) {
+		EXPECT_EQ(fread(file, 1, sizeof(file), saved), sizeof(file));
+		fclose(saved);
+	}
+	unsigned int cnt = 0;
+	memcpy(&cnt, file + 4, sizeof(cnt));
+	EXPECT_STRN(file, "CTD1", 4);
+	EXPECT_EQ(cnt, 3);
+	EXPECT_STRN(file + 56, "t_dur_ro", 8);
+
+	// The longest test gets a shard of its own, by hash it would share one with c
+	char *shard_args[] = {"ctest", "--shard", "1/2", "--durations", name};
+	t_dur_write(name, 3000000, 2000000, 2000000);
+	EXPECT_EQ(t_dur_run(5, shard_args), 1);
+	EXPECT_EQ(t_dur_order[0], 'a');
+
+	shard_args[2] = "2/2";
+	t_dur_write(name, 3000000, 2000000, 2000000);
+	EXPECT_EQ(t_dur_run(5, shard_args), 2);
+
+	remove(name);
+
+	END;
+}
+#endif
+
+static char t_jr_order[4];
+static int t_jr_cnt;
+static int t_jr_fail;
+static char t_jr_buf[1024];
+
+TEST(t_jr_a)
+{
+	START;
+	t_jr_order[t_jr_cnt++ % 3] = 'a';
+	END;
+}
+
+TEST(t_jr_b)
+{
+	START;
+	t_jr_order[t_jr_cnt++ % 3] = 'b';
+	END;
+}
+
+TEST(t_jr_c)
+{
+	START;
+	t_jr_order[t_jr_cnt++ % 3] = 'c';
+	EXPECT(!t_jr_fail);
+	END;
+}
+
+TEST(t_jr_suite)
+{
+	SSTART;
+	RUN(t_jr_c);
+	SEND;
+}
+
+TEST(t_jr_root)
+{
+	SSTART;
+	RUN(t_jr_a);
+	RUN(t_jr_suite);
+	RUN(t_jr_b);
+	SEND;
+}
+
+static long long t_jr_run(int argc, char **argv, char *order)
+{
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(t_jr_buf);
+
+	t_set_data(tmp);
+	t_init(argc, argv);
+
+	tmp		 = t_get_data();
+	tmp.dst		 = DST_BUF(t_jr_buf);
+	tmp.depth	 = 0;
+	tmp.shard.shown	 = 1;
+	t_set_data(tmp);
+
+	memset(t_jr_buf, 0, sizeof(t_jr_buf));
+	memset(t_jr_order, 0, sizeof(t_jr_order));
+	t_jr_cnt = 0;
+	t_run_named(test_t_jr_root, "t_jr_root", 1);
+	long long passed = t_get_data().passed;
+	t_finish();
+	t_set_data(data);
+
+	memcpy(order, t_jr_order, sizeof(t_jr_order));
+	return passed;
+}
+
+TEST(t_run_journal)
+{
+	START;
+
+	char name[]   = "t_journal.bin";
+	char order[4] = {0};
+
+	char *args[]	   = {"ctest", "--journal", name};
+	char *only_args[]  = {"ctest", "--journal", name, "--failed-only"};
+	char *first_args[] = {"ctest", "--journal", name, "--failed-first"};
+
+	remove(name);
+	t_jr_fail = 1;
+	EXPECT_EQ(t_jr_run(3, args, order), 2);
+	EXPECT_STR(order, "acb");
+
+	EXPECT_EQ(t_jr_run(4, only_args, order), 0);
+	EXPECT_STR(order, "c");
+
+	// The failed test still fails, so the others do not run
+	EXPECT_EQ(t_jr_run(4, first_args, order), 0);
+	EXPECT_STR(order, "c");
+
+	t_jr_fail = 0;
+	EXPECT_EQ(t_jr_run(4, first_args, order), 3);
+	EXPECT_STR(order, "cab");
+	EXPECT_STR(t_jr_buf,
+		   "├─t_jr_root\n"
+		   "│ ├─t_jr_suite\n"
+		   "│ │ ├─" CG "PASS t_jr_c" CW "\n"
+		   "│ │ └─" CG "PASS 1 TEST" CW "\n"
+		   "│ └─" CG "PASS 1 TEST" CW "\n"
+		   "├─t_jr_root\n"
+		   "│ ├─" CG "PASS t_jr_a" CW "\n"
+		   "│ ├─" CG "PASS t_jr_b" CW "\n"
+		   "│ └─" CG "PASS 2 TESTS" CW "\n" CG "PASS 3 TESTS" CW "\n");
+
+	EXPECT_EQ(t_jr_run(4, only_args, order), 0);
+	EXPECT_STR(order, "");
+
+	remove(name);
+
+	END;
+}
+
+static int t_repeat_calls;
+
+TEST(t_repeat_third)
+{
+	START;
+	if (++t_repeat_calls == 3) {
+		EXPECT_FAIL("%s", "third run");
+	}
+	END;
+}
+
+PROPERTY(t_repeat_draw, T_INT(a, 0, 10))
+{
+	EXPECT(a >= 0 && a <= 10);
+}
+
+// t_repeat_draw draws from the seed of each run
+TEST(t_repeat_prop)
+{
+	SSTART;
+	RUN(t_repeat_draw);
+	RUN(t_repeat_third);
+	SEND;
+}
+
+TEST(t_run_repeat)
+{
+	START;
+
+	char buf[1024] = {0};
+	unsigned long long seed;
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+	tmp.repeat   = (trepeat_t){.count = 5};
+
+	t_repeat_calls = 0;
+	t_set_data(tmp);
+	int ret	    = t_run_named(test_t_repeat_third, "t_repeat_third", 1);
+	tdata_t res = t_get_data();
+	t_set_data(data);
+
+	EXPECT_EQ(ret, 1);
+	EXPECT_EQ(t_repeat_calls, 5);
+	EXPECT_EQ(res.passed, 0);
+	EXPECT_EQ(res.failed, 1);
+	EXPECT_EQ(res.prop.seeded, 0);
+	// Nothing drew from the seed, so it would not reproduce the run
+	EXPECT_NOT_NULL(strstr(buf, "│ " CR "third run" CW "\n" CR "run 3 failed" CW "\n"));
+	EXPECT_NOT_NULL(strstr(buf, CW "\n" CR "FAIL 1/5 RUNS (20%)" CW "\n"));
+
+	memset(buf, 0, sizeof(buf));
+	tmp.repeat = (trepeat_t){.count = 3};
+
+	t_repeat_calls = 0;
+	t_set_data(tmp);
+	ret = t_run_named(test_t_repeat_prop, "t_repeat_prop", 1);
+	t_set_data(data);
+
+	EXPECT_EQ(ret, 1);
+	const char *head = "│ │ " CR "third run" CW "\n" "│ └─" CR "FAIL 1/2 TEST" CW "\n" CR "run 3 failed, reproduce with --seed %llu";
+	EXPECT_EQ(t_scan(strstr(buf, "│ │ " CR "third run"), head, &seed), 1);
+
+	memset(buf, 0, sizeof(buf));
+	tmp.repeat = (trepeat_t){.until_fail = 1};
+
+	t_repeat_calls = 0;
+	t_set_data(tmp);
+	ret = t_run_named(test_t_repeat_third, "t_repeat_third", 1);
+	t_set_data(data);
+
+	EXPECT_EQ(ret, 1);
+	EXPECT_EQ(t_repeat_calls, 3);
+	EXPECT_NOT_NULL(strstr(buf, CW "\n" CR "FAIL 1/3 RUNS (33.33%)" CW "\n"));
+
+	memset(buf, 0, sizeof(buf));
+	tmp.repeat = (trepeat_t){.count = 2};
+
+	t_repeat_calls = 3;
+	t_set_data(tmp);
+	ret = t_run_named(test_t_repeat_third, "t_repeat_third", 1);
+	res = t_get_data();
+	t_set_data(data);
+
+	EXPECT_EQ(ret, 0);
+	EXPECT_EQ(res.passed, 1);
+	EXPECT_STR(buf, CG "PASS 2 RUNS" CW "\n");
+
+	END;
+}
+
+TEST(t_run_filters)
+{
+	SSTART;
+	RUN(t_run_filter);
+	RUN(t_run_filter_suite);
+	RUN(t_run_filter_suite_child);
+	RUN(t_run_filter_parent);
+	RUN(t_run_filter_trie);
+	SEND;
+}
+
+TEST(t_filter_finish_unmatched)
+{
+	START;
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = data;
+
+	char buf[1024] = {0};
+	char *args[]   = {"ctest", "missing"};
+
+	tmp.dst		   = DST_BUF(buf);
+	tmp.passed	   = 0;
+	tmp.failed	   = 0;
+	tmp.depth	   = 0;
+	tmp.buf		   = (tarena_t){0};
+	tmp.filter_argc	   = 0;
+	tmp.filter_argv	   = NULL;
+	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
+	tmp.filter_run_all = 0;
+	tmp.time_slow	   = NULL;
+	tmp.base	   = NULL;
+	tmp.leak_tab	   = NULL;
+	tmp.dur		   = NULL;
+	tmp.journal	   = (tjournal_t){0};
+
+	t_set_data(tmp);
+	t_test_filter(1, args + 1);
+	EXPECT_EQ(t_finish(), 1);
+	t_set_data(data);
+
+	EXPECT_STR(buf, CR "FAIL filter 'missing' matched no tests" CW "\n" CR "FAIL 1/1 TEST" CW "\n");
+
+	END;
+}
+
+TEST(t_priv)
+{
+	START;
+
+	tdata_t data = t_get_data();
+
+	int a = 0;
+	t_set_priv(&a);
+	EXPECT_PTR(t_get_priv(), &a);
+
+	t_set_data(data);
+
+	END;
+}
+
+static int setup(void *priv)
+{
+	(void)priv;
+	return 0;
+}
+
+static int teardown(void *priv)
+{
+	(void)priv;
+	return 0;
+}
+
+TEST(t_setup_teardown)
+{
+	START;
+
+	tdata_t data = t_get_data();
+
+	tdata_t tmp = {0};
+	t_set_data(tmp);
+
+	t_setup(setup);
+	t_teardown(teardown);
+
+	t_start();
+	t_end(0, "", "", 0);
+
+	t_set_data(data);
+
+	END;
+}
+
+TEST(t_start_end)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	int res;
+
+	tmp.dst.off = 0;
+	t_set_data(tmp);
+	t_start();
+	res = t_end(1, "file", "test_func", 0);
+	t_set_data(data);
+	EXPECT_EQ(res, 0);
+	EXPECT_STR(buf, "├─" CG "PASS func" CW "\n");
+
+	END;
+}
+
+TEST(t_start_end_time)
+{
+	START;
+
+	char buf[1024] = {0};
+	char *args[]   = {"ctest", "--slowest", "2"};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+
+	t_set_data(tmp);
+	EXPECT_EQ(t_init(3, args), 0);
+	tmp = t_get_data();
+	EXPECT_EQ(tmp.time, 1);
+	EXPECT_EQ(tmp.time_slowest, 2);
+	EXPECT_NOT_NULL(tmp.time_slow);
+
+	tmp.dst	  = DST_BUF(buf);
+	tmp.depth = 0;
+	t_set_data(tmp);
+
+	int suite = t_enter("suite");
+	int state = t_enter("a");
+	tdata_t path = t_get_data();
+	t_start();
+	t_end(1, "file", "test_a", 0);
+	t_leave(state);
+
+	state = t_enter("b");
+	t_start();
+	t_end(0, "file", "test_b", 0);
+	t_leave(state);
+
+	state = t_enter("c");
+	t_start();
+	t_end(1, "file", "test_c", 0);
+	t_leave(state);
+	t_leave(suite);
+
+	tmp = t_get_data();
+	EXPECT_EQ(t_finish(), 1);
+	t_set_data(data);
+
+	EXPECT_STR(path.path, "suite/a");
+	EXPECT_EQ(tmp.path_len, 0);
+	EXPECT_EQ(tmp.level, 0);
+	EXPECT_EQ(strncmp(buf, "├─" CG "PASS a (", sizeof("├─" CG "PASS a (") - 1), 0);
+	EXPECT_NOT_NULL(strstr(buf, "│ " CR "took "));
+	EXPECT_NOT_NULL(strstr(buf, "SLOWEST 2 TESTS\n├─"));
+	EXPECT_NOT_NULL(strstr(buf, "suite/"));
+
+	END;
+}
+
+static int t_bench_iters;
+
+BENCH(t_bench_sum)
+{
+	START;
+
+	int sum = 0;
+	BLOOP
+	{
+		sum++;
+		t_do_not_optimize(&sum);
+	}
+
+	t_bench_iters = sum;
+	EXPECT_GT(sum, 0);
+
+	END;
+}
+
+TEST(t_start_end_leak)
+{
+	START;
+
+	char buf[2048] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+	tmp.depth    = -1;
+	tmp.leaks    = 1;
+
+	t_set_data(tmp);
+	void *old = malloc(24);
+	t_do_not_optimize(old);
+	t_sstart("test_suite");
+	t_start();
+	void *a = malloc(24);
+	void *b = malloc(40);
+	t_do_not_optimize(a);
+	t_do_not_optimize(b);
+	free(b);
+	free(old);
+	t_end(1, "file", "test_a", 0);
+	t_send(1, 0);
+	tmp	   = t_get_data();
+	int failed = t_finish();
+	t_set_data(data);
+
+	free(a);
+
+	if (!t_alloc_counted()) {
+		// Without T_ALLOC_HOOK or with sanitizers no blocks are tracked
+		EXPECT_EQ(failed, 0);
+		EXPECT_NOT_NULL(strstr(buf, "├─" CG "PASS a" CW "\n"));
+	} else {
+		// Only the block allocated and kept by the test is reported, freeing an older block is not a leak
+		EXPECT_EQ(failed, 1);
+		EXPECT_NOT_NULL(strstr(buf, "├─" CR "LEAK a" CW "\n"));
+		EXPECT_NOT_NULL(strstr(buf, "│ " CR "1 block, 24 B allocated at:" CW "\n"));
+		EXPECT_EQ(strstr(buf, "40 B"), NULL);
+	}
+
+	END;
+}
+
+TEST(t_start_end_allocs)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+	tmp.depth    = -1;
+	tmp.alloc_on = 1;
+
+	t_set_data(tmp);
+	t_sstart("test_suite");
+	t_start();
+	void *a = malloc(100);
+	void *b = malloc(20);
+	t_do_not_optimize(a);
+	t_do_not_optimize(b);
+	free(a);
+	free(b);
+	t_end(1, "file", "test_a", 0);
+	t_send(1, 0);
+	tmp = t_get_data();
+	t_set_data(data);
+
+	if (!t_alloc_counted()) {
+		// Without T_ALLOC_HOOK or with sanitizers nothing is counted
+		EXPECT_STR(buf,
+			   "suite\n"
+			   "├─" CG "PASS a" CW "\n"
+			   "│ allocs 0, frees 0, peak 0 B\n"
+			   "└─" CG "PASS 1 TEST (allocs 0, frees 0, peak 0 B)" CW "\n");
+	} else {
+		EXPECT_EQ(tmp.alloc.allocs, 2);
+		EXPECT_EQ(tmp.alloc.frees, 2);
+		EXPECT_NOT_NULL(strstr(buf, "│ allocs 2, frees 2, peak "));
+		EXPECT_NOT_NULL(strstr(buf, " B, sizes 32: 1, 128: 1\n"));
+		EXPECT_NOT_NULL(strstr(buf, "└─" CG "PASS 1 TEST (allocs 2, frees 2, peak "));
+	}
+
+	END;
+}
+
+TEST(t_alloc_mark)
+{
+	START;
+
+	ALLOC_MARK(mark);
+	void *a = malloc(100);
+	void *b = malloc(1000);
+	t_do_not_optimize(a);
+	t_do_not_optimize(b);
+	free(a);
+	free(b);
+	unsigned long long allocs = t_alloc_allocs(&mark);
+	unsigned long long peak	  = t_alloc_peak(&mark);
+
+	ALLOC_MARK(next);
+	a = malloc(10);
+	t_do_not_optimize(a);
+	free(a);
+	unsigned long long next_peak = t_alloc_peak(&next);
+
+	if (t_alloc_counted()) {
+		EXPECT_EQ(allocs, 2);
+		EXPECT_EQ(t_alloc_allocs(&mark), 3);
+		EXPECT_GE(peak, 1100);
+		EXPECT_LT(peak, 1200);
+		EXPECT_GE(next_peak, 10);
+		EXPECT_LT(next_peak, 100);
+
+		ALLOC_MARK(none);
+		EXPECT_NO_ALLOC(none);
+		EXPECT_PEAK_MEM_LE(none, 0);
+		EXPECT_ALLOCS_LE(mark, 3);
+		EXPECT_PEAK_MEM_LE(next, 100);
+	} else {
+		// Without T_ALLOC_HOOK or with sanitizers nothing is counted
+		EXPECT_EQ(allocs, 0);
+		EXPECT_EQ(peak, 0);
+	}
+
+	END;
+}
+
+TEST(t_alloc_own)
+{
+	START;
+
+	char buf[256] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	ALLOC_MARK(mark);
+	t_fprintf(NULL, "%s", "output");
+	unsigned long long allocs = t_alloc_allocs(&mark);
+	tmp			  = t_get_data();
+	t_finish();
+	t_set_data(data);
+
+	// The arena chunk that t_fprintf writes to belongs to the framework, so it is not charged to the test
+	EXPECT_NOT_NULL(tmp.buf.head);
+	EXPECT_EQ(allocs, 0);
+
+	END;
+}
+
+TEST(t_alloc_budget)
+{
+	START;
+	ALLOC_MARK(mark);
+	EXPECT_NO_ALLOC(mark);
+	END;
+}
+
+TEST(t_alloc_budgets)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	int ret = t_run_named(test_t_alloc_budget, "t_alloc_budget", 1);
+	t_set_data(data);
+
+	if (t_alloc_counted()) {
+		EXPECT_EQ(ret, 0);
+		EXPECT_STR(buf, "├─" CG "PASS t_alloc_budget" CW "\n");
+	} else {
+		// A budget that cannot be checked fails instead of passing with nothing counted
+		EXPECT_EQ(ret, 1);
+		EXPECT_NOT_NULL(strstr(buf, "├─" CR "FAIL t_alloc_budget" CW "\n"));
+		EXPECT_NOT_NULL(strstr(buf, "allocations since mark: not counted without a glibc build with T_ALLOC_HOOK"));
+	}
+
+	END;
+}
+
+#if defined(__GLIBC__)
+TEST(t_alloc_aligned)
+{
+	START;
+
+	tdata_t before = t_get_data();
+	void *a	       = memalign(64, 100);
+	void *b	       = valloc(100);
+	t_do_not_optimize(a);
+	t_do_not_optimize(b);
+	EXPECT_EQ((size_t)a % 64, 0);
+	free(a);
+	free(b);
+	tdata_t after = t_get_data();
+
+	if (t_alloc_counted()) {
+		// The aligned blocks are counted like any other, so freeing them leaves nothing live
+		EXPECT_EQ(after.alloc.allocs - before.alloc.allocs, 2);
+		EXPECT_EQ(after.alloc.frees - before.alloc.frees, 2);
+		EXPECT_EQ(after.alloc.live, before.alloc.live);
+	}
+
+	END;
+}
+#endif
+
+TEST(t_bench)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	int ret = t_run_named(bench_t_bench_sum, "t_bench_sum", 1);
+	t_set_data(data);
+	EXPECT_EQ(ret, 0);
+	EXPECT_EQ(t_bench_iters, 1);
+	EXPECT_STR(buf, "├─" CG "PASS t_bench_sum" CW "\n");
+
+	tmp.bench.on = 1;
+	t_set_data(tmp);
+	ret	    = t_run_named(bench_t_bench_sum, "t_bench_sum", 1);
+	tdata_t res = t_get_data();
+	t_set_data(data);
+	EXPECT_EQ(ret, 0);
+	EXPECT_GT(t_bench_iters, 1);
+	EXPECT_EQ(res.bench.done, 1);
+	EXPECT_GE(res.bench.cnt, 5);
+	EXPECT_GT(res.bench.iters, 1);
+	EXPECT_LE(res.bench.samples[0], res.bench.median);
+	EXPECT_LE(res.bench.median, res.bench.p99);
+	EXPECT_NOT_NULL(strstr(buf, "├─" CG "PASS t_bench_sum (median "));
+
+	END;
+}
+
+static void t_bench_base_write(const char *path, const char *name, double sample)
+{
+	FILE *file	    = fopen(path, "wb");
+	unsigned int cnt    = 1;
+	unsigned int len    = (unsigned int)strlen(name);
+	unsigned int num    = 10;
+	double samples[10] = {0};
+
+	for (int i = 0; i < 10; i++) {
+		samples[i] = sample;
+	}
+
+	fwrite("CTB1", 1, 4, file);
+	fwrite(&cnt, sizeof(cnt), 1, file);
+	fwrite(&len, sizeof(len), 1, file);
+	fwrite(name, 1, len, file);
+	fwrite(&num, sizeof(num), 1, file);
+	fwrite(samples, sizeof(samples[0]), num, file);
+	fclose(file);
+}
+
+static char t_bench_buf[1024];
+
+static int t_bench_base_run(int argc, char **argv)
+{
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(t_bench_buf);
+
+	t_set_data(tmp);
+	if (t_init(argc, argv)) {
+		t_set_data(data);
+		return -1;
+	}
+
+	tmp	  = t_get_data();
+	tmp.dst	  = DST_BUF(t_bench_buf);
+	tmp.depth = 0;
+	t_set_data(tmp);
+
+	int ret = t_run_named(bench_t_bench_sum, "t_bench_sum", 1);
+	t_finish();
+	t_set_data(data);
+
+	return ret;
+}
+
+TEST(t_bench_base)
+{
+	START;
+
+	const char *buf = t_bench_buf;
+	char name[]	= "t_bench_base.bin";
+
+	char *save_args[] = {"ctest", "--bench-save", name};
+	EXPECT_EQ(t_bench_base_run(3, save_args), 0);
+
+	char file[16] = {0};
+	FILE *saved   = fopen(name, "rb");
+	EXPECT_NOT_NULL(saved);
+	if (saved) {
+		EXPECT_EQ(fread(file, 1, sizeof(file), saved), sizeof(file));
+		fclose(saved);
+	}
+	EXPECT_STRN(file, "CTB1", 4);
+	EXPECT_STRN(file + 12, "t_be", 4);
+
+	char *compare_args[] = {"ctest", "--bench-compare", name, "--max-regress", "5%"};
+
+	t_bench_base_write(name, "t_bench_sum", 1e-6);
+	EXPECT_EQ(t_bench_base_run(5, compare_args), 1);
+	EXPECT_NOT_NULL(strstr(buf, "├─" CR "FAIL t_bench_sum (median "));
+	EXPECT_NOT_NULL(strstr(buf, ", baseline 0.0 ns, +"));
+
+	t_bench_base_write(name, "t_bench_sum", 1e6);
+	EXPECT_EQ(t_bench_base_run(5, compare_args), 0);
+	EXPECT_NOT_NULL(strstr(buf, "├─" CG "PASS t_bench_sum (median "));
+	EXPECT_NOT_NULL(strstr(buf, ", baseline 1.0 ms, -100.0%)"));
+
+	t_bench_base_write(name, "other", 1e-6);
+	EXPECT_EQ(t_bench_base_run(5, compare_args), 0);
+	EXPECT_NULL(strstr(buf, "baseline"));
+
+	remove(name);
+
+	char *missing_args[] = {"ctest", "--bench-compare", name};
+	EXPECT_EQ(t_bench_base_run(3, missing_args), -1);
+	EXPECT_STR(buf, "ctest: cannot read baseline 't_bench_base.bin'\n");
+
+	END;
+}
+
+// t_bench_sum records its iterations in t_bench_iters, so the benchmark tests run as one unit
+TEST(t_benchmarks)
+{
+	SSTART;
+	RUN(t_bench);
+	RUN(t_bench_base);
+	SEND;
+}
+
+PROPERTY(t_prop_int, T_INT(a, -1000, 1000), T_UINT(b, 10, 20), T_LLONG(c, LLONG_MIN, -5))
+{
+	EXPECT(a >= -1000 && a <= 1000);
+	EXPECT(b >= 10 && b <= 20);
+	EXPECT_LE(c, -5);
+}
+
+PROPERTY(t_prop_str, T_STR(s, 16), T_BUF(b, 8))
+{
+	size_t len = strlen(s);
+	EXPECT_LE(len, 16);
+	EXPECT_LE(b.len, 8);
+	for (size_t i = 0; i < len; i++) {
+		EXPECT(s[i] >= ' ' && s[i] <= '~');
+	}
+}
+
+// Fails once a reaches 100 with a 'b' in s, the simplest such case is a = 100 and s = "b"
+PROPERTY(t_prop_fail, T_INT(a, 0, 1000), T_STRC(s, 10, "ab"))
+{
+	EXPECT(a < 100 || strchr(s, 'b') == NULL);
+}
+
+TEST(t_prop_shrink)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data	= t_get_data();
+	tdata_t tmp	= {0};
+	tmp.dst		= DST_BUF(buf);
+	tmp.prop.seed	= 1;
+	tmp.prop.seeded = 1;
+
+	t_set_data(tmp);
+	int res = t_prop(prop_case_t_prop_fail, "test_t_prop_fail");
+	tmp	= t_get_data();
+	t_set_data(data);
+
+	EXPECT_EQ(res, 1);
+	EXPECT_EQ(tmp.prop.on, 0);
+	EXPECT_NULL(tmp.prop.draws);
+	EXPECT_NULL(tmp.prop.mem.head);
+	EXPECT_NOT_NULL(strstr(buf, "├─" CR "FAIL t_prop_fail" CW "\n│ " CR "falsified by case "));
+	EXPECT_NOT_NULL(strstr(buf, "reproduce with --seed "));
+	EXPECT_NOT_NULL(strstr(buf, "│ " CR "a = 100" CW "\n│ " CR "s = \"b\"" CW "\n│ " CR));
+	EXPECT_NOT_NULL(strstr(buf, "a < 100 || strchr(s, 'b') == NULL" CW "\n"));
+
+	END;
+}
+
+TEST(t_properties)
+{
+	SSTART;
+	RUN(t_prop_int);
+	RUN(t_prop_str);
+	RUN(t_prop_shrink);
+	SEND;
+}
+
+FUZZ(t_fuzz_short)
+{
+	(void)data;
+	EXPECT_LT(size, 3);
+}
+
+#if !defined(C_WIN)
+TEST(t_fuzz_corpus)
+{
+	START;
+
+	char buf[1024]	= {0};
+	char path[256]	= {0};
+	const char *dir = "t_corpus/t_fuzz_short";
+
+	tdata_t data	= t_get_data();
+	tdata_t tmp	= {0};
+	tmp.dst		= DST_BUF(buf);
+	tmp.fuzz.corpus = "t_corpus";
+	tmp.fuzz.secs	= 10;
+
+	t_set_data(tmp);
+	int res = t_fuzz(fuzz_t_fuzz_short, "test_t_fuzz_short");
+	t_set_data(data);
+
+	EXPECT_EQ(res, 1);
+	EXPECT_EQ(t_scan(buf, "├─" CR "FAIL t_fuzz_short" CW "\n│ " CR "input %255s (3 B) found after ", path), 1);
+	EXPECT_STRN(path, dir, strlen(dir));
+
+	memset(buf, 0, sizeof(buf));
+	tmp.dst	      = DST_BUF(buf);
+	tmp.fuzz.secs = 0;
+
+	t_set_data(tmp);
+	res = t_fuzz(fuzz_t_fuzz_short, "test_t_fuzz_short");
+	t_set_data(data);
+
+	EXPECT_EQ(res, 1);
+	EXPECT_EQ(remove(path), 0);
+	EXPECT_EQ(remove(dir), 0);
+	EXPECT_EQ(remove("t_corpus"), 0);
+
+	char exp[512];
+	snprintf(exp, sizeof(exp), "├─" CR "FAIL t_fuzz_short" CW "\n│ " CR "input %s (3 B)" CW "\n│ " CR, path);
+	EXPECT_STRN(buf, exp, strlen(exp));
+
+	END;
+}
+#endif
+
+TEST(t_fuzzing)
+{
+	SSTART;
+	RUN(t_fuzz_short);
+#if !defined(C_WIN)
+	RUN(t_fuzz_corpus);
+#endif
+	SEND;
+}
+
+static size_t t_xor_ref(const unsigned char *in, size_t len, unsigned char *out, size_t out_max)
+{
+	(void)out_max;
+	unsigned char x = 0;
+	for (size_t i = 0; i < len; i++) {
+		x ^= in[i];
+	}
+	out[0] = x;
+	return 1;
+}
+
+static size_t t_xor_fast(const unsigned char *in, size_t len, unsigned char *out, size_t out_max)
+{
+	(void)out_max;
+	unsigned long long w = 0;
+	size_t i	     = 0;
+	for (; i + sizeof(w) <= len; i += sizeof(w)) {
+		unsigned long long v;
+		memcpy(&v, in + i, sizeof(v));
+		w ^= v;
+	}
+	for (; i < len; i++) {
+		w ^= in[i];
+	}
+	for (size_t s = sizeof(w) * 4; s >= 8; s /= 2) {
+		w ^= w >> s;
+	}
+	out[0] = (unsigned char)w;
+	return 1;
+}
+
+static size_t t_xor_bad(const unsigned char *in, size_t len, unsigned char *out, size_t out_max)
+{
+	(void)out_max;
+	unsigned char x = 0;
+	for (size_t i = 0; i < len; i++) {
+		x ^= in[i] == 0xff ? 0 : in[i];
+	}
+	out[0] = x;
+	return 1;
+}
+
+DIFF(t_diff_xor, t_xor_ref, t_xor_fast, 64, 1)
+
+TEST(t_diff_pass)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	int ret	    = t_run_named(test_t_diff_xor, "t_diff_xor", 1);
+	tdata_t res = t_get_data();
+	t_set_data(data);
+
+	EXPECT_EQ(ret, 0);
+	EXPECT_EQ(res.diff.done, 1);
+	EXPECT_EQ(res.diff.inputs, 65536);
+	EXPECT_STR(res.diff.names[1], "t_xor_fast");
+	EXPECT_NOT_NULL(strstr(buf, "├─" CG "PASS t_diff_xor (65536 inputs, t_xor_ref "));
+
+	END;
+}
+
+TEST(t_diff_fail)
+{
+	START;
+
+	char buf[1024] = {0};
+	unsigned long long input;
+
+	tdata_t data	= t_get_data();
+	tdata_t tmp	= {0};
+	tmp.dst		= DST_BUF(buf);
+	tmp.prop.seed	= 1;
+	tmp.prop.seeded = 1;
+
+	t_set_data(tmp);
+	int ret	    = t_diff(t_xor_ref, t_xor_bad, 64, 1, "t_xor_ref", "t_xor_bad", "test_t_diff_bad");
+	tdata_t res = t_get_data();
+	t_set_data(data);
+
+	EXPECT_EQ(ret, 1);
+	EXPECT_EQ(res.diff.done, 0);
+	const char *head = "├─" CR "FAIL t_diff_bad" CW "\n│ " CR "t_xor_ref and t_xor_bad differ on generated input %llu";
+	EXPECT_EQ(t_scan(buf, head, &input), 1);
+	EXPECT_NOT_NULL(strstr(buf,
+			       "minimized to 1 B, reproduce with --seed 1" CW "\n│ " CR "in:0: FF" CW "\n│ " CR
+			       "t_xor_bad == t_xor_ref (byte 0 of 1)" CW "\n│ " CR "exp:0: FF" CW "\n│ " CR "act:0: 00" CW "\n│ " CR
+			       "       ^" CW "\n"));
+
+	END;
+}
+
+#if !defined(C_WIN)
+TEST(t_diff_corpus_wide)
+{
+	START;
+
+	char buf[1024] = {0};
+	char path[64];
+	unsigned char in[100];
+
+	// The corpus inputs fill most of the first batch, the generated ones have to stop at its end
+	mkdir("t_corpus", 0755);
+	mkdir("t_corpus/t_diff_wide", 0755);
+	for (int i = 0; i < 21; i++) {
+		memset(in, i, sizeof(in));
+		snprintf(path, sizeof(path), "t_corpus/t_diff_wide/%02d", i);
+		FILE *file = fopen(path, "wb");
+		EXPECT_NOT_NULL(file);
+		if (file) {
+			EXPECT_EQ(fwrite(in, 1, sizeof(in), file), sizeof(in));
+			fclose(file);
+		}
+	}
+
+	tdata_t data	= t_get_data();
+	tdata_t tmp	= {0};
+	tmp.dst		= DST_BUF(buf);
+	tmp.fuzz.corpus = "t_corpus";
+
+	t_set_data(tmp);
+	int ret	    = t_diff(t_xor_ref, t_xor_fast, 8, 1, "t_xor_ref", "t_xor_fast", "test_t_diff_wide");
+	tdata_t res = t_get_data();
+	t_set_data(data);
+
+	for (int i = 0; i < 21; i++) {
+		snprintf(path, sizeof(path), "t_corpus/t_diff_wide/%02d", i);
+		EXPECT_EQ(remove(path), 0);
+	}
+	EXPECT_EQ(remove("t_corpus/t_diff_wide"), 0);
+	EXPECT_EQ(remove("t_corpus"), 0);
+
+	EXPECT_EQ(ret, 0);
+	EXPECT_EQ(res.diff.done, 1);
+	EXPECT_EQ(res.diff.inputs, 65536 + 21);
+	EXPECT_STR(buf, "");
+
+	END;
+}
+#endif
+
+TEST(t_differential)
+{
+	SSTART;
+	RUN(t_diff_xor);
+	RUN(t_diff_pass);
+	RUN(t_diff_fail);
+#if !defined(C_WIN)
+	RUN(t_diff_corpus_wide);
+#endif
+	SEND;
+}
+
+typedef struct t_add_row_s {
+	int a;
+	int b;
+	int sum;
+} t_add_row_t;
+
+static const t_add_row_t s_add_rows[] = {{0, 0, 0}, {1, 2, 3}, {-1, 1, 0}, {20, 22, 42}};
+static const t_add_row_t s_add_bad[]  = {{1, 1, 2}, {1, 2, 4}, {2, 2, 4}, {3, 3, 7}};
+
+TEST_TABLE(t_table_add, t_add_row_t, s_add_rows)
+{
+	EXPECT_EQ(row->a + row->b, row->sum);
+}
+
+TEST_TABLE(t_table_bad, t_add_row_t, s_add_bad)
+{
+	if (row->a + row->b != row->sum) {
+		EXPECT_FAIL("%d + %d != %d", row->a, row->b, row->sum);
+	}
+}
+
+TEST(t_table_rows)
+{
+	START;
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = data;
+
+	char buf[1024] = {0};
+	char *args[]   = {"ctest", "t_table_add_1"};
+
+	tmp.dst		   = DST_BUF(buf);
+	tmp.depth	   = 0;
+	tmp.filter_argc	   = 0;
+	tmp.filter_argv	   = NULL;
+	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
+	tmp.filter_run_all = 0;
+	tmp.time	   = 0;
+	tmp.alloc_on	   = 0;
+
+	t_set_data(tmp);
+	EXPECT_EQ(t_run_named(test_t_table_add, "t_table_add", 1), 0);
+	EXPECT_STR(buf, "├─" CG "PASS t_table_add (4 rows)" CW "\n");
+
+	memset(buf, 0, sizeof(buf));
+	t_set_data(tmp);
+	t_test_filter(1, args + 1);
+	EXPECT_EQ(t_run_named(test_t_table_add, "t_table_add", 1), 0);
+	tdata_t res = t_get_data();
+	t_test_filter(0, NULL);
+	t_set_data(data);
+
+	EXPECT_EQ(res.table.rows, 1);
+	EXPECT_EQ(res.table.cnt, 4);
+	EXPECT_STR(buf, "├─" CG "PASS t_table_add (1 of 4 rows)" CW "\n");
+
+	END;
+}
+
+TEST(t_table_fail)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	int ret = t_run_named(test_t_table_bad, "t_table_bad", 1);
+	t_set_data(data);
+
+	EXPECT_EQ(ret, 1);
+	EXPECT_STR(buf,
+		   "├─" CR "FAIL t_table_bad_1" CW "\n"
+		   "│ " CR "1 + 2 != 4" CW "\n"
+		   "├─" CR "FAIL t_table_bad_3" CW "\n"
+		   "│ " CR "3 + 3 != 7" CW "\n"
+		   "│ " CR "2 of 4 rows failed" CW "\n");
+
+	END;
+}
+
+TEST(t_tables)
+{
+	SSTART;
+	RUN(t_table_add);
+	RUN(t_table_rows);
+	RUN(t_table_fail);
+	SEND;
+}
+
+TEST(t_output_buffer)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.sink     = DST_BUF(buf);
+	tmp.dst	     = DST_NONE();
+	tmp.dst.off  = T_BUFFER;
+	tmp.depth    = 2;
 
+	t_set_data(tmp);
+	t_sstart("test_suite");
 	t_start();
-	t_end(0, "", "", 0);
-
+	t_end(1, "file", "test_func", 0);
+	tdata_t mid = t_get_data();
+	t_send(1, 0);
+	tmp = t_get_data();
 	t_set_data(data);
 
+	EXPECT_EQ(mid.sink.off, 0);
+	EXPECT_EQ(tmp.out.len, 0);
+	EXPECT_STR(buf,
+		   "│ │ ├─suite\n"
+		   "│ │ │ ├─" CG "PASS func" CW "\n"
+		   "│ │ │ └─" CG "PASS 1 TEST" CW "\n");
+
+	free(tmp.out.data);
+
 	END;
 }
 
-TEST(t_start_end)
+TEST(t_output_async)
 {
 	START;
 
 	char buf[1024] = {0};
+	char *args[]   = {"ctest", "--async-output"};
 
 	tdata_t data = t_get_data();
 	tdata_t tmp  = {0};
-	tmp.dst	     = DST_BUF(buf);
 
-	int res;
+	t_set_data(tmp);
+	EXPECT_EQ(t_init(2, args), 0);
+	tmp = t_get_data();
+	EXPECT_NOT_NULL(tmp.flush);
+	EXPECT_EQ(tmp.dst.off, T_BUFFER);
 
-	tmp.dst.off = 0;
+	tmp.sink = DST_BUF(buf);
 	t_set_data(tmp);
 	t_start();
-	res = t_end(1, "file", "test_func", 0);
+	t_end(1, "file", "test_func", 0);
+	t_start();
+	t_end(0, "file", "test_fail", 0);
+	t_finish();
+	tmp = t_get_data();
 	t_set_data(data);
-	EXPECT_EQ(res, 0);
-	EXPECT_STR(buf, "├─" CG "PASS func" CW "\n");
+
+	EXPECT_NULL(tmp.flush);
+	EXPECT_STR(buf, "├─" CG "PASS func" CW "\n" CR "FAIL 1/2 TEST" CW "\n");
 
 	END;
 }
@@ -466,6 +2642,9 @@ TEST(t_end_leak)
 	tdata_t tmp  = data;
 	tmp.dst	     = DST_BUF(buf);
 	tmp.depth    = 1;
+	tmp.time     = 0;
+	tmp.alloc_on = 0;
+	tmp.pool     = NULL;
 	tmp.mem -= 1;
 	t_set_data(tmp);
 
@@ -616,15 +2795,22 @@ TEST(t_finish)
 	tmp.filter_argc	   = 0;
 	tmp.filter_argv	   = NULL;
 	tmp.filter_matched = NULL;
+	tmp.filter_nodes   = NULL;
+	tmp.filter_next    = NULL;
 	tmp.filter_run_all = 0;
+	tmp.time_slow	   = NULL;
+	tmp.base	   = NULL;
+	tmp.leak_tab	   = NULL;
+	tmp.dur		   = NULL;
+	tmp.journal	   = (tjournal_t){0};
 
 	tmp.failed = 1;
-	tmp.buf	   = malloc(tmp.buf_size);
+	tmp.buf	   = (tarena_t){0};
 	t_set_data(tmp);
 	t_finish();
 
 	tmp.failed = 0;
-	tmp.buf	   = malloc(tmp.buf_size);
+	tmp.buf	   = (tarena_t){0};
 	t_set_data(tmp);
 	t_finish();
 
@@ -661,6 +2847,28 @@ TEST(t_check_strcmp)
 	END;
 }
 
+BENCH(t_check_strcmp_doc)
+{
+	START;
+
+	static char act[4096];
+	static char exp[4096];
+	for (size_t i = 0; i < sizeof(act) - 1; i++) {
+		act[i] = exp[i] = i % 64 == 63 ? '\n' : (char)('a' + i % 26);
+	}
+
+	int res = 0;
+	BLOOP
+	{
+		t_do_not_optimize(act);
+		res |= t_strcmp(act, exp);
+	}
+
+	EXPECT_EQ(res, 0);
+
+	END;
+}
+
 TEST(t_check_strncmp)
 {
 	START;
@@ -690,6 +2898,121 @@ TEST(t_check_wstrcmp)
 	EXPECT_EQ(t_wstrcmp(L"a", L"a"), 0);
 	EXPECT_EQ(t_wstrcmp(L"a", L"b"), 1);
 	EXPECT_EQ(t_wstrcmp(L"b", L"a"), 1);
+	EXPECT_EQ(t_wstrcmp(L"ab", L"ax"), 1);
+
+	END;
+}
+
+TEST(t_check_strcmp_long)
+{
+	START;
+
+	char act[128];
+	char exp[128];
+	wchar_t wact[128];
+	wchar_t wexp[128];
+
+	int res = 0;
+	for (int off = 0; off < 32; off++) {
+		for (int len = 0; len < 96 - off; len++) {
+			for (int i = 0; i < len; i++) {
+				act[off + i] = exp[i] = (char)('a' + i % 26);
+				wact[off + i] = wexp[i] = (wchar_t)('a' + i % 26);
+			}
+			act[off + len] = exp[len] = '\0';
+			wact[off + len] = wexp[len] = L'\0';
+
+			res |= t_strcmp(act + off, exp) != 0;
+			res |= t_strncmp(act + off, exp, (size_t)len) != 0;
+			res |= t_wstrcmp(wact + off, wexp) != 0;
+
+			for (int i = 0; i < len; i++) {
+				act[off + i]  = '_';
+				wact[off + i] = L'_';
+				res |= t_strcmp(act + off, exp) != 1;
+				res |= t_strncmp(act + off, exp, (size_t)len) != 1;
+				res |= t_wstrcmp(wact + off, wexp) != 1;
+				act[off + i]  = exp[i];
+				wact[off + i] = wexp[i];
+			}
+
+			if (len > 0) {
+				exp[len - 1]  = '\0';
+				wexp[len - 1] = L'\0';
+				res |= t_strcmp(act + off, exp) != 1;
+				res |= t_wstrcmp(wact + off, wexp) != 1;
+			}
+		}
+	}
+
+	EXPECT_EQ(res, 0);
+
+	END;
+}
+
+TEST(t_check_memcmp)
+{
+	START;
+
+	unsigned char act[100];
+	unsigned char exp[100];
+	for (int i = 0; i < 100; i++) {
+		act[i] = exp[i] = (unsigned char)i;
+	}
+
+	EXPECT_EQ(t_memcmp(NULL, NULL, 1), 0);
+	EXPECT_EQ(t_memcmp(act, NULL, 0), 1);
+	EXPECT_EQ(t_memcmp(NULL, exp, 0), 1);
+	EXPECT_EQ(t_memcmp(act, exp, 0), 0);
+	EXPECT_EQ(t_memcmp(act, exp, sizeof(act)), 0);
+
+	int res = 0;
+	for (int i = 0; i < 100; i++) {
+		act[i] = 0xFF;
+		res |= t_memcmp(act, exp, sizeof(act)) != 1;
+		res |= t_memcmp(act, exp, (size_t)i) != 0;
+		act[i] = exp[i];
+	}
+	EXPECT_EQ(res, 0);
+
+	EXPECT_MEM(act, exp, sizeof(act));
+	EXPECT_ARRAY_EQ(act, exp, 100);
+
+	END;
+}
+
+TEST(t_check_farrcmp)
+{
+	START;
+
+	float act[3] = {1.0f, 2.0f, -0.0f};
+	float exp[3] = {1.0f, 2.0f, 0.0f};
+	double dact[2] = {1.0, 2.0};
+	double dexp[2] = {1.0, 2.001};
+
+	EXPECT_EQ(t_farrcmp(act, exp, 3, sizeof(float), 0, 0), 0);
+	EXPECT_EQ(t_farrcmp(act, NULL, 3, sizeof(float), 0, 0), 1);
+	EXPECT_EQ(t_farrcmp(act, exp, 3, sizeof(char), 0, 0), 1);
+
+	unsigned int bits;
+	memcpy(&bits, &exp[1], sizeof(bits));
+	bits++;
+	memcpy(&act[1], &bits, sizeof(bits));
+	EXPECT_EQ(t_farrcmp(act, exp, 3, sizeof(float), 0, 0), 1);
+	EXPECT_EQ(t_farrcmp(act, exp, 3, sizeof(float), 0, 1), 0);
+	EXPECT_EQ(t_farrcmp(act, exp, 3, sizeof(float), 0.001, 0), 0);
+	EXPECT_ARRAY_NEAR(act, exp, 3, 0, 1);
+
+	bits = 0x7FC00000;
+	memcpy(&act[1], &bits, sizeof(bits));
+	memcpy(&exp[1], &bits, sizeof(bits));
+	EXPECT_EQ(t_farrcmp(act, exp, 3, sizeof(float), 0, 0), 0);
+	act[1] = 2.0f;
+	EXPECT_EQ(t_farrcmp(act, exp, 3, sizeof(float), 1, 1), 1);
+
+	EXPECT_EQ(t_farrcmp(dact, dexp, 2, sizeof(double), 0.0001, 1000), 1);
+	EXPECT_EQ(t_farrcmp(dact, dexp, 2, sizeof(double), 0.01, 0), 0);
+	EXPECT_ARRAY_NEAR(dact, dexp, 2, 0.01, 0);
 
 	END;
 }
@@ -707,6 +3030,24 @@ TEST(t_check_wstrncmp)
 	EXPECT_EQ(t_wstrncmp(L"a", L"a", 1), 0);
 	EXPECT_EQ(t_wstrncmp(L"a", L"b", 1), 1);
 	EXPECT_EQ(t_wstrncmp(L"b", L"a", 1), 1);
+	EXPECT_EQ(t_wstrncmp(L"ab", L"ax", 2), 1);
+
+	END;
+}
+
+BENCH(t_check_strcmp_equal)
+{
+	START;
+
+	const char *str = "the quick brown fox jumps over the lazy dog";
+	int res		= 0;
+	BLOOP
+	{
+		t_do_not_optimize(str);
+		res |= t_strcmp(str, "the quick brown fox jumps over the lazy dog");
+	}
+
+	EXPECT_EQ(res, 0);
 
 	END;
 }
@@ -716,9 +3057,14 @@ TEST(t_check)
 	SSTART;
 	RUN(t_check_scan);
 	RUN(t_check_strcmp);
+	RUN_BENCH(t_check_strcmp_equal);
+	RUN_BENCH(t_check_strcmp_doc);
 	RUN(t_check_strncmp);
 	RUN(t_check_wstrcmp);
 	RUN(t_check_wstrncmp);
+	RUN(t_check_strcmp_long);
+	RUN(t_check_memcmp);
+	RUN(t_check_farrcmp);
 	SEND;
 }
 
@@ -972,6 +3318,29 @@ TEST(t_expect_str_diff_nl)
 	END;
 }
 
+TEST(t_expect_str_diff_long)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	t_expect_str(0, NULL, NULL, 0, "0123456789abcdef\n0123456789abcdef0123456789\n\nline four\nend",
+		     "0123456789abcdef\n0123456789abcdef0123456789\n\nline 4\nend");
+	t_set_data(data);
+	EXPECT_STR(buf,
+		   "│ " CR CW "\n"
+		   "│ " CR "exp:3: line 4\\n" CW "\n"
+		   "│ " CR "act:3: line four\\n" CW "\n"
+		   "│ " CR "            ^" CW "\n");
+
+	END;
+}
+
 TEST(t_expect_str_diff_not_print)
 {
 	START;
@@ -1094,6 +3463,7 @@ TEST(t_expect_str)
 	RUN(t_expect_str_same_nl);
 	RUN(t_expect_str_diff);
 	RUN(t_expect_str_diff_nl);
+	RUN(t_expect_str_diff_long);
 	RUN(t_expect_str_diff_not_print);
 	RUN(t_expect_str_exp_nl);
 	RUN(t_expect_str_act_nl);
@@ -1256,6 +3626,29 @@ TEST(t_expect_wstr_diff_nl)
 	END;
 }
 
+TEST(t_expect_wstr_diff_long)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	t_expect_wstr(0, NULL, NULL, 0, L"0123456789abcdef\n0123456789abcdef0123456789\n\nline four\nend",
+		      L"0123456789abcdef\n0123456789abcdef0123456789\n\nline 4\nend");
+	t_set_data(data);
+	EXPECT_STR(buf,
+		   "│ " CR CW "\n"
+		   "│ " CR "exp:3: " CW "\n"
+		   "│ " CR "act:3: " CW "\n"
+		   "│ " CR "            ^" CW "\n");
+
+	END;
+}
+
 TEST(t_expect_wstr_diff_not_print)
 {
 	START;
@@ -1354,6 +3747,7 @@ TEST(t_expect_wstr)
 	RUN(t_expect_wstr_same_nl);
 	RUN(t_expect_wstr_diff);
 	RUN(t_expect_wstr_diff_nl);
+	RUN(t_expect_wstr_diff_long);
 	RUN(t_expect_wstr_diff_not_print);
 	RUN(t_expect_wstr_exp_nl);
 	RUN(t_expect_wstr_act_nl);
@@ -1361,6 +3755,113 @@ TEST(t_expect_wstr)
 	SEND;
 }
 
+TEST(t_expect_mem)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	unsigned char act[20];
+	unsigned char exp[20];
+	for (int i = 0; i < 20; i++) {
+		act[i] = exp[i] = (unsigned char)i;
+	}
+	act[18] = 0xFF;
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	t_expect_mem(0, NULL, NULL, 0, "a", "b", act, exp, sizeof(act), 1);
+	t_expect_mem(0, NULL, NULL, 0, "a", "b", act, NULL, sizeof(act), 1);
+	t_set_data(data);
+	EXPECT_STR(buf,
+		   "│ " CR "a == b (byte 18 of 20)" CW "\n"
+		   "│ " CR "exp:16: 10 11 12 13" CW "\n"
+		   "│ " CR "act:16: 10 11 FF 13" CW "\n"
+		   "│ " CR "              ^" CW "\n"
+		   "│ " CR "a == b (b is NULL)" CW "\n");
+
+	END;
+}
+
+TEST(t_expect_mem_array)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	unsigned int act[5] = {1, 2, 3, 0x12345679, 5};
+	unsigned int exp[5] = {1, 2, 3, 0x12345678, 5};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	t_expect_mem(0, NULL, NULL, 0, "a", "b", act, exp, 5, sizeof(unsigned int));
+	t_set_data(data);
+	EXPECT_STR(buf,
+		   "│ " CR "a == b (index 3 of 5)" CW "\n"
+		   "│ " CR "exp:0: 00000001 00000002 00000003 12345678" CW "\n"
+		   "│ " CR "act:0: 00000001 00000002 00000003 12345679" CW "\n"
+		   "│ " CR "                                  ^" CW "\n");
+
+	END;
+}
+
+TEST(t_expect_farr)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	float act[3] = {1.0f, 2.5f, 3.0f};
+	float exp[3] = {1.0f, 2.0f, 3.0f};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	t_expect_farr(0, NULL, NULL, 0, "a", "b", act, exp, 3, sizeof(float), 0.1, 0);
+	t_expect_farr(0, NULL, NULL, 0, "a", "b", act, exp, 3, sizeof(char), 0.1, 0);
+	t_set_data(data);
+	EXPECT_STR(buf,
+		   "│ " CR "a == b (index 1 of 3)" CW "\n"
+		   "│ " CR "exp:0:  1.00000000e+00  2.00000000e+00  3.00000000e+00" CW "\n"
+		   "│ " CR "act:0:  1.00000000e+00  2.50000000e+00  3.00000000e+00" CW "\n"
+		   "│ " CR "                       ^" CW "\n"
+		   "│ " CR "Unsupported type of size: 1" CW "\n");
+
+	END;
+}
+
+TEST(t_expect_alloc)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	t_expect_alloc(0, NULL, NULL, 0, "allocations", "mark", 3, 0);
+	t_set_data(data);
+
+	if (t_alloc_counted()) {
+		EXPECT_STR(buf, "│ " CR "allocations since mark: 3 > 0" CW "\n");
+	} else {
+		EXPECT_STR(buf,
+			   "│ " CR "allocations since mark: not counted without a glibc build with T_ALLOC_HOOK and no sanitizer" CW "\n");
+	}
+
+	END;
+}
+
 TEST(t_expect_fail)
 {
 	START;
@@ -1379,6 +3880,16 @@ TEST(t_expect_fail)
 	END;
 }
 
+static void t_test_arena_free(tarena_t *arena)
+{
+	tchunk_t *chunk = arena->head;
+	while (chunk) {
+		tchunk_t *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
 TEST(t_expect_fstr)
 {
 	START;
@@ -1388,9 +3899,6 @@ TEST(t_expect_fstr)
 	tdata_t data = t_get_data();
 	tdata_t tmp  = {0};
 	tmp.dst	     = DST_BUF(buf);
-	tmp.buf	     = malloc(1);
-	tmp.buf_size = 1;
-	tmp.buf_len  = 0;
 
 	t_set_data(tmp);
 	t_expect_fstr_start("aa", 2);
@@ -1398,7 +3906,7 @@ TEST(t_expect_fstr)
 	int res = t_expect_fstr_end(0, NULL, NULL, 0);
 
 	tmp = t_get_data();
-	free(tmp.buf);
+	t_test_arena_free(&tmp.buf);
 
 	t_set_data(data);
 	EXPECT_EQ(res, 1);
@@ -1411,6 +3919,160 @@ TEST(t_expect_fstr)
 	END;
 }
 
+TEST(t_expect_fstr_large)
+{
+	START;
+
+	const size_t len = 100000;
+
+	char *exp = malloc(len + 1);
+	for (size_t i = 0; i < len; i++) {
+		exp[i] = (char)('0' + i % 10);
+	}
+	exp[len] = '\0';
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_NONE();
+
+	t_set_data(tmp);
+	t_expect_fstr_start(exp, len);
+	for (size_t i = 0; i < len / 10; i++) {
+		t_fprintf(NULL, "%s", "0123456789");
+	}
+	int first_res = t_expect_fstr_end(1, NULL, NULL, 0);
+	tdata_t first = t_get_data();
+
+	t_expect_fstr_start(exp, len);
+	for (size_t i = 0; i < len / 10; i++) {
+		t_fprintf(NULL, "%s", "0123456789");
+	}
+	int second_res = t_expect_fstr_end(1, NULL, NULL, 0);
+	tdata_t second = t_get_data();
+
+	t_expect_fstr_start(exp, len);
+	int ret	     = t_fprintf(NULL, "%s", exp);
+	int long_res = t_expect_fstr_end(1, NULL, NULL, 0);
+
+	exp[len - 1] = 'x';
+	t_expect_fstr_start(exp, len);
+	t_fprintf(NULL, "%s", "0123456789");
+	t_fprintf(NULL, "%s", exp + 10);
+	exp[len - 1] = '9';
+	int diff_res = t_expect_fstr_end(1, NULL, NULL, 0);
+
+	tmp = t_get_data();
+	t_set_data(data);
+
+	int chunks = 0;
+	for (tchunk_t *chunk = first.buf.head; chunk != first.buf.tail->next; chunk = chunk->next) {
+		chunks++;
+	}
+
+	EXPECT_EQ(first_res, 0);
+	EXPECT_EQ(first.buf.len, len);
+	EXPECT_LE(chunks, 10);
+	EXPECT_EQ(second_res, 0);
+	EXPECT_PTR(second.buf.head, first.buf.head);
+	EXPECT_PTR(second.buf.tail, first.buf.tail);
+	EXPECT_EQ(ret, (int)len);
+	EXPECT_EQ(long_res, 0);
+	EXPECT_EQ(diff_res, 1);
+
+	t_test_arena_free(&tmp.buf);
+	free(exp);
+
+	END;
+}
+
+TEST(t_expect_fstr_stream)
+{
+	START;
+
+	char buf[1024] = {0};
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_BUF(buf);
+
+	t_set_data(tmp);
+	t_expect_fstr_stream_start("abc\ndef\n", 8);
+	int ok_ret[2];
+	ok_ret[0]  = t_fprintf(NULL, "%s", "abc\n");
+	ok_ret[1]  = t_fprintf(NULL, "%s", "def\n");
+	int ok_res = t_expect_fstr_end(0, NULL, NULL, 0);
+
+	t_expect_fstr_stream_start("abc\ndef\nghi\n", 12);
+	int diff_ret[3];
+	diff_ret[0]  = t_fprintf(NULL, "%s", "abc\n");
+	diff_ret[1]  = t_fprintf(NULL, "%s", "dxf\nghi\n");
+	diff_ret[2]  = t_fprintf(NULL, "%s", "jkl\n");
+	int diff_res = t_expect_fstr_end(0, NULL, NULL, 0);
+
+	tmp = t_get_data();
+	t_test_arena_free(&tmp.buf);
+
+	t_set_data(data);
+	EXPECT_EQ(ok_ret[0], 4);
+	EXPECT_EQ(ok_ret[1], 4);
+	EXPECT_EQ(ok_res, 0);
+	EXPECT_EQ(diff_ret[0], 4);
+	EXPECT_EQ(diff_ret[1], -1);
+	EXPECT_EQ(diff_ret[2], -1);
+	EXPECT_EQ(diff_res, 1);
+	EXPECT_STR(buf,
+		   "│ " CR CW "\n"
+		   "│ " CR "exp:1: def\\n" CW "\n"
+		   "│ " CR "act:1: dxf\\n" CW "\n"
+		   "│ " CR "        ^" CW "\n");
+
+	END;
+}
+
+TEST(t_expect_fstr_stream_large)
+{
+	START;
+
+	const size_t len = 100000;
+
+	char *exp = malloc(len + 1);
+	for (size_t i = 0; i < len; i++) {
+		exp[i] = (char)('0' + i % 10);
+	}
+	exp[len] = '\0';
+
+	tdata_t data = t_get_data();
+	tdata_t tmp  = {0};
+	tmp.dst	     = DST_NONE();
+
+	t_set_data(tmp);
+	t_expect_fstr_stream_start(exp, len);
+	for (size_t i = 0; i < len / 10; i++) {
+		t_fprintf(NULL, "%s", "0123456789");
+	}
+	int res = t_expect_fstr_end(1, NULL, NULL, 0);
+
+	t_expect_fstr_stream_start(exp, len);
+	for (size_t i = 0; i < len / 10 - 1; i++) {
+		t_fprintf(NULL, "%s", "0123456789");
+	}
+	int short_res = t_expect_fstr_end(1, NULL, NULL, 0);
+
+	tmp = t_get_data();
+	t_set_data(data);
+
+	EXPECT_EQ(res, 0);
+	EXPECT_EQ(short_res, 1);
+	EXPECT_EQ(tmp.buf.len, 10);
+	EXPECT_EQ(tmp.buf.head->size, 256);
+	EXPECT_PTR(tmp.buf.head->next, NULL);
+
+	t_test_arena_free(&tmp.buf);
+	free(exp);
+
+	END;
+}
+
 TEST(t_expect)
 {
 	SSTART;
@@ -1420,8 +4082,15 @@ TEST(t_expect)
 	RUN(t_expect_p);
 	RUN(t_expect_str);
 	RUN(t_expect_wstr);
+	RUN(t_expect_mem);
+	RUN(t_expect_mem_array);
+	RUN(t_expect_farr);
+	RUN(t_expect_alloc);
 	RUN(t_expect_fail);
 	RUN(t_expect_fstr);
+	RUN(t_expect_fstr_large);
+	RUN(t_expect_fstr_stream);
+	RUN(t_expect_fstr_stream_large);
 	SEND;
 }
 
@@ -1451,15 +4120,43 @@ TEST(ctest)
 	RUN(t_init_finish);
 	RUN(t_init_args);
 	RUN(t_init_help);
+	RUN(t_init_jobs);
+	RUN(t_init_errors);
+	RUN(t_init_list);
+	RUN(t_test_registry);
 	RUN(t_run);
-	RUN(t_run_filter);
-	RUN(t_run_filter_suite);
-	RUN(t_run_filter_suite_child);
-	RUN(t_run_filter_parent);
+	RUN(t_run_jobs);
+	RUN(t_run_threads);
+	RUN(t_run_threads_leak);
+#if !defined(C_WIN)
+	RUN(t_run_timeout);
+	RUN(t_run_isolate);
+	RUN(t_run_durations);
+#endif
+	RUN(t_run_shard);
+	RUN(t_run_journal);
+	RUN(t_run_repeat);
+	RUN(t_run_filters);
 	RUN(t_filter_finish_unmatched);
 	RUN(t_priv);
 	RUN(t_setup_teardown);
 	RUN(t_start_end);
+	RUN(t_start_end_time);
+	RUN(t_start_end_allocs);
+	RUN(t_start_end_leak);
+	RUN(t_alloc_mark);
+	RUN(t_alloc_own);
+	RUN(t_alloc_budgets);
+#if defined(__GLIBC__)
+	RUN(t_alloc_aligned);
+#endif
+	RUN(t_benchmarks);
+	RUN(t_properties);
+	RUN(t_fuzzing);
+	RUN(t_differential);
+	RUN(t_tables);
+	RUN(t_output_buffer);
+	RUN(t_output_async);
 	RUN(t_end_leak);
 	RUN(t_cstart_cend);
 	RUN(t_sstart);
@@ -1478,8 +4175,9 @@ TEST(ctest)
 int main(int argc, char **argv)
 {
 	c_print_init();
-	if (t_init(argc, argv)) {
-		return 0;
+	int ret = t_init(argc, argv);
+	if (ret) {
+		return ret < 0;
 	}
 	t_run(test_ctest, 1);
 	return t_finish();